@@ -0,0 +1,418 @@
+#ifndef CLUSTER_PATH_H
+#define CLUSTER_PATH_H
+
+// Paths across maps too big to search cell by cell (HPA*): the map is cut into square
+// clusters and each pair of neighbouring clusters is joined by entrances, one per short run
+// of open cells along their border and one at each end of a long run. The shortest path
+// between the entrances of a cluster is found once, inside the cluster, so a query searches
+// a graph of entrances and only the stretches of the path the caller actually walks are
+// searched cell by cell.
+//
+// The graph is built for one set of keys. Paths through a door are tagged with the key
+// types they need, and where the way around the doors is longer or missing both are kept,
+// so someone holding fewer of the keys is routed around the doors they can't open (short of
+// an entrance that lies on such a door). A door that opens only changes the cluster it is
+// in and, on a border, the one across it.
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+
+#include "Map.h"
+
+const int CLUSTER_SIZE = 32;           // cells per side
+const int CLUSTER_WIDE_ENTRANCE = 6;   // open runs this long get an entrance at each end
+
+const int CLUSTER_DX[4] = { 1, -1, 0, 0 };   // +x, -x, +z, -z
+const int CLUSTER_DZ[4] = { 0, 0, 1, -1 };
+
+struct ClusterEdge {
+    uint16_t to;      // node of the same cluster
+    int32_t cost;     // steps
+    KeyMask needs;    // key types of the doors on the way
+};
+
+// A cell on the cluster's border where an entrance crosses into the next cluster
+struct ClusterNode {
+    int x, z;
+    uint8_t crossings;    // bit per direction, in CLUSTER_DX order
+    uint32_t firstEdge;
+    uint32_t edgeCount;
+};
+
+struct Cluster {
+    std::vector<ClusterNode> nodes;
+    std::vector<ClusterEdge> edges;
+};
+
+struct ClusterGraph {
+    int width, height;
+    int clustersX, clustersZ;
+    KeyMask keys;                  // doors of these key types are open
+    std::vector<Cluster> clusters;
+    std::vector<uint32_t> firstNode;   // per cluster, where its nodes start in the numbering of all of them
+};
+
+// Numbers the nodes of all clusters one after the other, for searches to index by
+inline void numberClusterNodes(ClusterGraph& graph) {
+    graph.firstNode.resize(graph.clusters.size() + 1);
+    uint32_t total = 0;
+    for (size_t i = 0; i < graph.clusters.size(); i++) {
+        graph.firstNode[i] = total;
+        total += (uint32_t)graph.clusters[i].nodes.size();
+    }
+    graph.firstNode[graph.clusters.size()] = total;
+}
+
+// Positions along the border between cluster (cx, cz) and the next one in +x (dir 0) or +z
+// (dir 2) where an entrance crosses it, counted from the cluster's corner
+inline void clusterEntrances(const Map& map, KeyMask keys, int cx, int cz, int dir, std::vector<int>& out) {
+    out.clear();
+    int x0 = cx * CLUSTER_SIZE, z0 = cz * CLUSTER_SIZE;
+    int length = dir == 0 ? std::min(CLUSTER_SIZE, map.height - z0) : std::min(CLUSTER_SIZE, map.width - x0);
+    int ax = dir == 0 ? x0 + CLUSTER_SIZE - 1 : x0, az = dir == 0 ? z0 : z0 + CLUSTER_SIZE - 1;
+    int run = 0;
+    for (int i = 0; i <= length; i++) {
+        bool open = false;
+        if (i < length) {
+            int x = ax + (dir == 0 ? 0 : i), z = az + (dir == 0 ? i : 0);
+            open = !blocksPlayer(map, x, z, keys) && !blocksPlayer(map, x + CLUSTER_DX[dir], z + CLUSTER_DZ[dir], keys);
+        }
+        if (open) {
+            run++;
+            continue;
+        }
+        if (run >= CLUSTER_WIDE_ENTRANCE) {
+            out.push_back(i - run);
+            out.push_back(i - 1);
+        } else if (run > 0) {
+            out.push_back(i - run + run / 2);
+        }
+        run = 0;
+    }
+}
+
+// Breadth-first distances from (sx, sz) to the cells of cluster (cx, cz), without leaving
+// it. dist is -1 where unreached; needs gets the door types on the way where it is given.
+// parent, where given, gets the direction each cell was reached in.
+inline void searchCluster(const Map& map, KeyMask keys, int cx, int cz, int sx, int sz, std::vector<int>& dist,
+                          std::vector<KeyMask>* needs, std::vector<uint8_t>* parent) {
+    int x0 = cx * CLUSTER_SIZE, z0 = cz * CLUSTER_SIZE;
+    int w = std::min(CLUSTER_SIZE, map.width - x0), h = std::min(CLUSTER_SIZE, map.height - z0);
+    dist.assign(CLUSTER_SIZE * CLUSTER_SIZE, -1);
+    if (needs) needs->assign(CLUSTER_SIZE * CLUSTER_SIZE, 0);
+    if (parent) parent->assign(CLUSTER_SIZE * CLUSTER_SIZE, 0);
+    if (blocksPlayer(map, sx, sz, keys)) return;
+    
+    int queue[CLUSTER_SIZE * CLUSTER_SIZE];
+    int head = 0, tail = 0;
+    int start = (sz - z0) * CLUSTER_SIZE + (sx - x0);
+    dist[start] = 0;
+    queue[tail++] = start;
+    while (head < tail) {
+        int local = queue[head++];
+        int lx = local % CLUSTER_SIZE, lz = local / CLUSTER_SIZE;
+        for (int d = 0; d < 4; d++) {
+            int nx = lx + CLUSTER_DX[d], nz = lz + CLUSTER_DZ[d];
+            if (nx < 0 || nx >= w || nz < 0 || nz >= h) continue;
+            int next = nz * CLUSTER_SIZE + nx;
+            if (dist[next] >= 0 || blocksPlayer(map, x0 + nx, z0 + nz, keys)) continue;
+            dist[next] = dist[local] + 1;
+            if (needs) {
+                char c = map.cell(x0 + nx, z0 + nz);
+                (*needs)[next] = (*needs)[local] | (isDoorCell(c) ? 1ull << cellKeyType(c) : 0);
+            }
+            if (parent) (*parent)[next] = (uint8_t)d;
+            queue[tail++] = next;
+        }
+    }
+}
+
+// Finds the entrances of cluster (cx, cz) and the paths between them
+inline void buildCluster(const Map& map, ClusterGraph& graph, int cx, int cz) {
+    Cluster& cluster = graph.clusters[(size_t)cz * graph.clustersX + cx];
+    cluster.nodes.clear();
+    cluster.edges.clear();
+    int x0 = cx * CLUSTER_SIZE, z0 = cz * CLUSTER_SIZE;
+    int w = std::min(CLUSTER_SIZE, map.width - x0), h = std::min(CLUSTER_SIZE, map.height - z0);
+    
+    // Own borders in +x and +z, and the borders of the clusters before it in -x and -z
+    std::vector<int> positions;
+    for (int d = 0; d < 4; d++) {
+        int bx = cx - (d == 1), bz = cz - (d == 3);
+        if (bx < 0 || bz < 0 || (d == 0 && cx + 1 >= graph.clustersX) || (d == 2 && cz + 1 >= graph.clustersZ)) continue;
+        clusterEntrances(map, graph.keys, bx, bz, d & 2, positions);
+        for (size_t i = 0; i < positions.size(); i++) {
+            int x = d == 0 ? x0 + w - 1 : d == 1 ? x0 : x0 + positions[i];
+            int z = d == 2 ? z0 + h - 1 : d == 3 ? z0 : z0 + positions[i];
+            size_t n = 0;
+            while (n < cluster.nodes.size() && (cluster.nodes[n].x != x || cluster.nodes[n].z != z)) n++;
+            if (n == cluster.nodes.size()) {
+                ClusterNode node = { x, z, 0, 0, 0 };
+                cluster.nodes.push_back(node);
+            }
+            cluster.nodes[n].crossings |= 1 << d;
+        }
+    }
+    
+    // Doors that are open only change the paths of clusters that hold one
+    bool hasDoors = false;
+    for (int z = z0; z < z0 + h && !hasDoors; z++) {
+        for (int x = x0; x < x0 + w && !hasDoors; x++) {
+            char c = map.cell(x, z);
+            hasDoors = isDoorCell(c) && ((graph.keys >> cellKeyType(c)) & 1);
+        }
+    }
+    
+    std::vector<int> dist, closedDist;
+    std::vector<KeyMask> needs;
+    for (size_t n = 0; n < cluster.nodes.size(); n++) {
+        ClusterNode& node = cluster.nodes[n];
+        node.firstEdge = (uint32_t)cluster.edges.size();
+        searchCluster(map, graph.keys, cx, cz, node.x, node.z, dist, &needs, NULL);
+        if (hasDoors) searchCluster(map, 0, cx, cz, node.x, node.z, closedDist, NULL, NULL);
+        for (size_t m = 0; m < cluster.nodes.size(); m++) {
+            if (m == n) continue;
+            int local = (cluster.nodes[m].z - z0) * CLUSTER_SIZE + (cluster.nodes[m].x - x0);
+            if (hasDoors && closedDist[local] >= 0) {
+                ClusterEdge edge = { (uint16_t)m, closedDist[local], 0 };
+                cluster.edges.push_back(edge);
+                if (dist[local] == closedDist[local]) continue;
+            }
+            if (dist[local] >= 0) {
+                ClusterEdge edge = { (uint16_t)m, dist[local], needs[local] };
+                cluster.edges.push_back(edge);
+            }
+        }
+        node.edgeCount = (uint32_t)cluster.edges.size() - node.firstEdge;
+    }
+}
+
+// Builds the graph with the doors of keys open
+inline void buildClusterGraph(const Map& map, KeyMask keys, ClusterGraph& graph) {
+    graph.width = map.width;
+    graph.height = map.height;
+    graph.clustersX = (map.width + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+    graph.clustersZ = (map.height + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+    graph.keys = keys;
+    graph.clusters.assign((size_t)graph.clustersX * graph.clustersZ, Cluster());
+    for (int cz = 0; cz < graph.clustersZ; cz++) {
+        for (int cx = 0; cx < graph.clustersX; cx++) buildCluster(map, graph, cx, cz);
+    }
+    numberClusterNodes(graph);
+}
+
+// Opens the doors of key types in keys that weren't open yet, rebuilding the clusters that
+// hold them and, for doors on a border, the clusters across it. Returns how many doors were
+// opened. Doors already open stay open, as no cluster is rebuilt to shut them.
+inline int unlockClusterDoors(const Map& map, ClusterGraph& graph, KeyMask keys) {
+    KeyMask opened = keys & ~graph.keys;
+    graph.keys |= keys;
+    if (!opened) return 0;
+    
+    int count = 0;
+    std::vector<size_t> dirty;
+    for (size_t i = 0; i < map.doors.size(); i++) {
+        const MapItem& door = map.doors[i];
+        if (!((opened >> door.type) & 1)) continue;
+        count++;
+        int cx = door.x / CLUSTER_SIZE, cz = door.z / CLUSTER_SIZE;
+        dirty.push_back((size_t)cz * graph.clustersX + cx);
+        if (door.x % CLUSTER_SIZE == 0 && cx > 0) dirty.push_back((size_t)cz * graph.clustersX + cx - 1);
+        if (door.x % CLUSTER_SIZE == CLUSTER_SIZE - 1 && cx + 1 < graph.clustersX) dirty.push_back((size_t)cz * graph.clustersX + cx + 1);
+        if (door.z % CLUSTER_SIZE == 0 && cz > 0) dirty.push_back((size_t)(cz - 1) * graph.clustersX + cx);
+        if (door.z % CLUSTER_SIZE == CLUSTER_SIZE - 1 && cz + 1 < graph.clustersZ) dirty.push_back((size_t)(cz + 1) * graph.clustersX + cx);
+    }
+    std::sort(dirty.begin(), dirty.end());
+    dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+    for (size_t i = 0; i < dirty.size(); i++)
+        buildCluster(map, graph, (int)(dirty[i] % graph.clustersX), (int)(dirty[i] / graph.clustersX));
+    numberClusterNodes(graph);
+    return count;
+}
+
+inline size_t clusterGraphBytes(const ClusterGraph& graph) {
+    size_t bytes = graph.clusters.size() * sizeof(Cluster) + graph.firstNode.size() * sizeof(uint32_t);
+    for (size_t i = 0; i < graph.clusters.size(); i++)
+        bytes += graph.clusters[i].nodes.capacity() * sizeof(ClusterNode) + graph.clusters[i].edges.capacity() * sizeof(ClusterEdge);
+    return bytes;
+}
+
+// A path through the graph: from each waypoint to the next is either a path inside one
+// cluster or one step across a border
+struct ClusterPath {
+    int length;            // steps, -1 if there is no path
+    KeyMask needs;         // key types of the doors on the way
+    std::vector<std::pair<int, int> > waypoints;   // start and goal included
+    int expanded;          // entrances expanded by the search
+};
+
+// Scratch space for searches, kept between them so that nothing is cleared per query. Nodes
+// are numbered as in ClusterGraph::firstNode, then the start and the goal.
+struct ClusterSearch {
+    std::vector<uint32_t> stamp;    // the search that last reached the node
+    std::vector<int32_t> g;
+    std::vector<uint32_t> parent;
+    std::vector<KeyMask> needs;     // of the edge the node was reached by
+    std::vector<uint8_t> closed;    // set once expanded, valid where stamp is current
+    std::vector<std::pair<int64_t, uint32_t> > open;   // (f, -g) packed into the key, node
+    std::vector<int> fromStart, toGoal;
+    std::vector<KeyMask> startNeeds, goalNeeds;
+    uint32_t current;
+};
+
+// Puts node to on the open list at cost g, h from the goal, reached from node from by an
+// edge needing needs, unless it is already there at no more than g
+inline void reachClusterNode(ClusterSearch& search, uint32_t from, uint32_t to, int g, int h, KeyMask needs) {
+    if (search.stamp[to] == search.current && (search.closed[to] || search.g[to] <= g)) return;
+    search.stamp[to] = search.current;
+    search.g[to] = g;
+    search.parent[to] = from;
+    search.needs[to] = needs;
+    search.closed[to] = 0;
+    int64_t f = g + h;
+    search.open.push_back(std::make_pair((f << 32) | (uint32_t)(0x7FFFFFFF - g), to));
+    std::push_heap(search.open.begin(), search.open.end(), std::greater<std::pair<int64_t, uint32_t> >());
+}
+
+// Searches the graph for a path from (sx, sz) to (gx, gz) for someone holding keys, which
+// should be among the graph's keys: paths needing other keys are skipped. The path is the
+// shortest through the entrances, within a few steps of the shortest there is.
+inline ClusterPath findClusterPath(const Map& map, const ClusterGraph& graph, ClusterSearch& search, KeyMask keys,
+                                   int sx, int sz, int gx, int gz) {
+    ClusterPath path;
+    path.length = -1;
+    path.needs = 0;
+    path.expanded = 0;
+    uint32_t total = graph.firstNode.back();
+    if (search.stamp.size() != total + 2) {
+        search.stamp.assign(total + 2, 0);
+        search.g.resize(total + 2);
+        search.parent.resize(total + 2);
+        search.needs.resize(total + 2);
+        search.closed.resize(total + 2);
+        search.current = 0;
+    }
+    search.current++;
+    search.open.clear();
+    if (blocksPlayer(map, sx, sz, keys) || blocksPlayer(map, gx, gz, keys)) return path;
+    
+    const uint32_t START = total, GOAL = total + 1;
+    int scx = sx / CLUSTER_SIZE, scz = sz / CLUSTER_SIZE, gcx = gx / CLUSTER_SIZE, gcz = gz / CLUSTER_SIZE;
+    size_t startCluster = (size_t)scz * graph.clustersX + scx, goalCluster = (size_t)gcz * graph.clustersX + gcx;
+    searchCluster(map, keys, scx, scz, sx, sz, search.fromStart, &search.startNeeds, NULL);
+    searchCluster(map, keys, gcx, gcz, gx, gz, search.toGoal, &search.goalNeeds, NULL);
+    
+    search.stamp[START] = search.current;
+    search.g[START] = 0;
+    search.closed[START] = 0;
+    search.open.push_back(std::make_pair((int64_t)(std::abs(gx - sx) + std::abs(gz - sz)) << 32, START));
+    
+    while (!search.open.empty()) {
+        std::pop_heap(search.open.begin(), search.open.end(), std::greater<std::pair<int64_t, uint32_t> >());
+        uint32_t node = search.open.back().second;
+        search.open.pop_back();
+        if (search.closed[node]) continue;
+        search.closed[node] = 1;
+        path.expanded++;
+        if (node == GOAL) break;
+        int g = search.g[node];
+        
+        if (node == START) {
+            const Cluster& cluster = graph.clusters[startCluster];
+            for (size_t n = 0; n < cluster.nodes.size(); n++) {
+                const ClusterNode& target = cluster.nodes[n];
+                int local = (target.z - scz * CLUSTER_SIZE) * CLUSTER_SIZE + (target.x - scx * CLUSTER_SIZE);
+                if (search.fromStart[local] < 0) continue;
+                reachClusterNode(search, node, graph.firstNode[startCluster] + (uint32_t)n, g + search.fromStart[local],
+                                 std::abs(gx - target.x) + std::abs(gz - target.z), search.startNeeds[local]);
+            }
+            if (startCluster == goalCluster) {
+                int local = (gz - scz * CLUSTER_SIZE) * CLUSTER_SIZE + (gx - scx * CLUSTER_SIZE);
+                if (search.fromStart[local] >= 0) reachClusterNode(search, node, GOAL, g + search.fromStart[local], 0, search.startNeeds[local]);
+            }
+            continue;
+        }
+        
+        size_t c = std::upper_bound(graph.firstNode.begin(), graph.firstNode.end(), node) - graph.firstNode.begin() - 1;
+        const Cluster& cluster = graph.clusters[c];
+        const ClusterNode& entrance = cluster.nodes[node - graph.firstNode[c]];
+        if (blocksPlayer(map, entrance.x, entrance.z, keys)) continue;
+        for (uint32_t e = entrance.firstEdge; e < entrance.firstEdge + entrance.edgeCount; e++) {
+            const ClusterEdge& edge = cluster.edges[e];
+            if (edge.needs & ~keys) continue;
+            const ClusterNode& target = cluster.nodes[edge.to];
+            reachClusterNode(search, node, graph.firstNode[c] + edge.to, g + edge.cost,
+                             std::abs(gx - target.x) + std::abs(gz - target.z), edge.needs);
+        }
+        if (c == goalCluster) {
+            int local = (entrance.z - gcz * CLUSTER_SIZE) * CLUSTER_SIZE + (entrance.x - gcx * CLUSTER_SIZE);
+            if (search.toGoal[local] >= 0) reachClusterNode(search, node, GOAL, g + search.toGoal[local], 0, search.goalNeeds[local]);
+        }
+        
+        // Across the border, to the entrance node on the other side
+        for (int d = 0; d < 4; d++) {
+            if (!((entrance.crossings >> d) & 1)) continue;
+            int nx = entrance.x + CLUSTER_DX[d], nz = entrance.z + CLUSTER_DZ[d];
+            size_t across = (size_t)(nz / CLUSTER_SIZE) * graph.clustersX + nx / CLUSTER_SIZE;
+            const Cluster& other = graph.clusters[across];
+            for (size_t n = 0; n < other.nodes.size(); n++) {
+                if (other.nodes[n].x != nx || other.nodes[n].z != nz) continue;
+                reachClusterNode(search, node, graph.firstNode[across] + (uint32_t)n, g + 1, std::abs(gx - nx) + std::abs(gz - nz), 0);
+                break;
+            }
+        }
+    }
+    
+    if (search.stamp[GOAL] != search.current || !search.closed[GOAL]) return path;
+    path.length = search.g[GOAL];
+    for (uint32_t node = GOAL;; node = search.parent[node]) {
+        if (node == START) {
+            path.waypoints.push_back(std::make_pair(sx, sz));
+            break;
+        }
+        path.needs |= search.needs[node];
+        if (node == GOAL) {
+            path.waypoints.push_back(std::make_pair(gx, gz));
+        } else {
+            size_t c = std::upper_bound(graph.firstNode.begin(), graph.firstNode.end(), node) - graph.firstNode.begin() - 1;
+            const ClusterNode& entrance = graph.clusters[c].nodes[node - graph.firstNode[c]];
+            path.waypoints.push_back(std::make_pair(entrance.x, entrance.z));
+        }
+    }
+    std::reverse(path.waypoints.begin(), path.waypoints.end());
+    return path;
+}
+
+// The cells from waypoint i of the path to waypoint i + 1, that one included, for someone
+// holding keys; false if they aren't joined any more
+inline bool refineClusterPath(const Map& map, const ClusterPath& path, KeyMask keys, size_t i,
+                              std::vector<std::pair<int, int> >& cells) {
+    cells.clear();
+    int ax = path.waypoints[i].first, az = path.waypoints[i].second;
+    int bx = path.waypoints[i + 1].first, bz = path.waypoints[i + 1].second;
+    if (std::abs(bx - ax) + std::abs(bz - az) == 1) {
+        if (blocksPlayer(map, bx, bz, keys)) return false;
+        cells.push_back(std::make_pair(bx, bz));
+        return true;
+    }
+    
+    // Both ends are in the same cluster; walk back from the far end
+    int cx = ax / CLUSTER_SIZE, cz = az / CLUSTER_SIZE;
+    std::vector<int> dist;
+    std::vector<uint8_t> parent;
+    searchCluster(map, keys, cx, cz, ax, az, dist, NULL, &parent);
+    int x0 = cx * CLUSTER_SIZE, z0 = cz * CLUSTER_SIZE;
+    if (dist[(bz - z0) * CLUSTER_SIZE + (bx - x0)] < 0) return false;
+    for (int x = bx, z = bz; x != ax || z != az;) {
+        cells.push_back(std::make_pair(x, z));
+        int d = parent[(z - z0) * CLUSTER_SIZE + (x - x0)];
+        x -= CLUSTER_DX[d];
+        z -= CLUSTER_DZ[d];
+    }
+    std::reverse(cells.begin(), cells.end());
+    return true;
+}
+
+#endif
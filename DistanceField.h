@@ -0,0 +1,223 @@
+#ifndef DISTANCE_FIELD_H
+#define DISTANCE_FIELD_H
+
+// Distance from every cell to the nearest cell that blocks the player: walls, doors whose key
+// isn't held and the outside of the map. A move that stays within the clearance around the
+// player is accepted with one lookup, and a ray can jump over the clearance around each point
+// instead of visiting every cell in it.
+//
+// Distances are capped at FIELD_MAX_CELLS, so the field around a cell only depends on the
+// cells within that distance of it. The field is built tile by tile from a window that much
+// larger, and a door that opens only changes the tiles within that distance of it.
+
+#include <cstdint>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "Map.h"
+
+const int FIELD_MAX_CELLS = 31;
+const int FIELD_STEPS_PER_CELL = 8;   // stored in eighths of a cell, rounded down
+const int FIELD_TILE = 256;           // cells per side of the tiles the field is built in
+const int FIELD_UNLOCK_TILE = 32;     // and of the tiles recomputed around opened doors
+const int FIELD_JUMP_CELLS = 6;       // rays only jump from cells at least this far from a blocker
+
+// A point is at most this far from its cell's center, and a blocker cell's box reaches this
+// far from the blocker's center
+const float FIELD_HALF_DIAGONAL = 0.7072f;
+
+struct DistanceField {
+    int width, height;
+    KeyMask keys;                  // doors of these key types are open
+    std::vector<uint8_t> steps;    // per cell, center to the nearest blocker's center
+};
+
+// Distance from the center of cell (x, z) to the center of the nearest blocker, in cells
+inline float fieldCells(const DistanceField& field, int x, int z) {
+    if (x < 0 || x >= field.width || z < 0 || z >= field.height) return 0;
+    return field.steps[(size_t)z * field.width + x] * (1.0f / FIELD_STEPS_PER_CELL);
+}
+
+// How far point p (in cells, cell centers on integers) is from every blocker's box, at least
+inline float fieldClearance(const DistanceField& field, glm::vec2 p) {
+    glm::vec2 center(std::floor(p.x + 0.5f), std::floor(p.y + 0.5f));
+    float cells = fieldCells(field, (int)center.x, (int)center.y);
+    return std::max(0.0f, cells - glm::length(p - center) - FIELD_HALF_DIAGONAL);
+}
+
+// Squared distance transform of one line (Felzenszwalb and Huttenlocher): out[i] is the
+// minimum over j of (i - j)^2 + f[j], from the lower envelope of those parabolas. v and
+// bounds are scratch space for n and n + 1 entries.
+inline void distanceTransform1D(const float* f, int n, float* out, int* v, float* bounds) {
+    const float FAR = 1e20f;
+    int k = 0;
+    v[0] = 0;
+    bounds[0] = -FAR;
+    bounds[1] = FAR;
+    for (int q = 1; q < n; q++) {
+        float s = ((f[q] + (float)q * q) - (f[v[k]] + (float)v[k] * v[k])) / (2.0f * (q - v[k]));
+        while (s <= bounds[k]) {
+            k--;
+            s = ((f[q] + (float)q * q) - (f[v[k]] + (float)v[k] * v[k])) / (2.0f * (q - v[k]));
+        }
+        k++;
+        v[k] = q;
+        bounds[k] = s;
+        bounds[k + 1] = FAR;
+    }
+    k = 0;
+    for (int q = 0; q < n; q++) {
+        while (bounds[k + 1] < q) k++;
+        float dq = (float)(q - v[k]);
+        out[q] = dq * dq + f[v[k]];
+    }
+}
+
+// Recomputes cells [x0, x1) x [z0, z1) from the blockers within FIELD_MAX_CELLS of them: a
+// column pass then a row pass of the 1D transform over the padded window.
+inline void computeFieldRegion(const Map& map, DistanceField& field, int x0, int z0, int x1, int z1) {
+    const int pad = FIELD_MAX_CELLS;
+    int wx0 = x0 - pad, wz0 = z0 - pad;
+    int w = x1 - x0 + 2 * pad, h = z1 - z0 + 2 * pad;
+    int longest = std::max(w, h);
+    std::vector<float> grid((size_t)w * h), line(longest), out(longest), bounds(longest + 1);
+    std::vector<int> v(longest);
+    
+    // Columns: squared vertical distance to the nearest blocker, outside the map counts
+    for (int x = 0; x < w; x++) {
+        for (int z = 0; z < h; z++) line[z] = blocksPlayer(map, wx0 + x, wz0 + z, field.keys) ? 0.0f : 1e20f;
+        distanceTransform1D(line.data(), h, out.data(), v.data(), bounds.data());
+        for (int z = 0; z < h; z++) grid[(size_t)z * w + x] = out[z];
+    }
+    
+    // Rows, only those of the region itself
+    const float maxSteps = (float)(FIELD_MAX_CELLS * FIELD_STEPS_PER_CELL);
+    for (int z = pad; z < pad + (z1 - z0); z++) {
+        distanceTransform1D(&grid[(size_t)z * w], w, out.data(), v.data(), bounds.data());
+        uint8_t* row = &field.steps[(size_t)(wz0 + z) * field.width];
+        for (int x = pad; x < pad + (x1 - x0); x++)
+            row[wx0 + x] = (uint8_t)std::min(maxSteps, std::floor(std::sqrt(out[x]) * FIELD_STEPS_PER_CELL));
+    }
+}
+
+// Builds the field with the doors of keys open
+inline void buildDistanceField(const Map& map, KeyMask keys, DistanceField& field) {
+    field.width = map.width;
+    field.height = map.height;
+    field.keys = keys;
+    field.steps.assign((size_t)map.width * map.height, 0);
+    for (int z = 0; z < map.height; z += FIELD_TILE) {
+        for (int x = 0; x < map.width; x += FIELD_TILE)
+            computeFieldRegion(map, field, x, z, std::min(x + FIELD_TILE, map.width), std::min(z + FIELD_TILE, map.height));
+    }
+}
+
+// Opens the doors of key types in keys that weren't open yet, recomputing only the tiles
+// within FIELD_MAX_CELLS of those doors, or the whole field when that is most of it.
+// Returns how many doors were opened.
+inline int unlockFieldDoors(const Map& map, DistanceField& field, KeyMask keys) {
+    KeyMask opened = keys & ~field.keys;
+    field.keys = keys;
+    if (!opened) return 0;
+    
+    int tilesX = (map.width + FIELD_UNLOCK_TILE - 1) / FIELD_UNLOCK_TILE;
+    int tilesZ = (map.height + FIELD_UNLOCK_TILE - 1) / FIELD_UNLOCK_TILE;
+    std::vector<uint8_t> dirty((size_t)tilesX * tilesZ, 0);
+    size_t dirtyCount = 0;
+    int count = 0;
+    for (size_t i = 0; i < map.doors.size(); i++) {
+        const MapItem& door = map.doors[i];
+        if (!((opened >> door.type) & 1)) continue;
+        int tx0 = std::max(0, door.x - FIELD_MAX_CELLS) / FIELD_UNLOCK_TILE;
+        int tz0 = std::max(0, door.z - FIELD_MAX_CELLS) / FIELD_UNLOCK_TILE;
+        int tx1 = std::min(map.width - 1, door.x + FIELD_MAX_CELLS) / FIELD_UNLOCK_TILE;
+        int tz1 = std::min(map.height - 1, door.z + FIELD_MAX_CELLS) / FIELD_UNLOCK_TILE;
+        for (int tz = tz0; tz <= tz1; tz++) {
+            for (int tx = tx0; tx <= tx1; tx++) {
+                uint8_t& tile = dirty[(size_t)tz * tilesX + tx];
+                dirtyCount += !tile;
+                tile = 1;
+            }
+        }
+        count++;
+    }
+    
+    // Each tile drags its padding along, so past a quarter of the map one pass is cheaper
+    if (dirtyCount * 4 > dirty.size()) {
+        buildDistanceField(map, keys, field);
+        return count;
+    }
+    
+    // Runs of dirty tiles along a row share one window
+    for (int tz = 0; tz < tilesZ; tz++) {
+        for (int tx = 0; tx < tilesX; tx++) {
+            if (!dirty[(size_t)tz * tilesX + tx]) continue;
+            int end = tx;
+            while (end < tilesX && dirty[(size_t)tz * tilesX + end]) end++;
+            computeFieldRegion(map, field, tx * FIELD_UNLOCK_TILE, tz * FIELD_UNLOCK_TILE,
+                               std::min(end * FIELD_UNLOCK_TILE, map.width), std::min((tz + 1) * FIELD_UNLOCK_TILE, map.height));
+            tx = end;
+        }
+    }
+    return count;
+}
+
+// sweepPlayer that first checks whether the whole move stays within the clearance around
+// the player, which away from walls is almost every move
+inline glm::vec3 movePlayer(const Map& map, const DistanceField& field, glm::vec3 pos, glm::vec3 move, KeyMask keys,
+                            float radius = PLAYER_RADIUS) {
+    if (field.keys == keys) {
+        float clearance = fieldClearance(field, glm::vec2(pos.x, pos.z) / CELL_SIZE) * CELL_SIZE;
+        if (glm::length(glm::vec2(move.x, move.z)) + radius <= clearance) return pos + glm::vec3(move.x, 0, move.z);
+    }
+    return sweepPlayer(map, pos, move, keys, radius);
+}
+
+// Walks the segment from -> to (in cells, cell centers on integers) and returns the fraction
+// of the way at which it enters the first blocker, or 1 if it reaches the end. It steps
+// cell by cell like a DDA until it reaches a cell FIELD_JUMP_CELLS from every blocker, then
+// jumps over the clearance around that cell and starts stepping again from there.
+inline float traceField(const DistanceField& field, glm::vec2 from, glm::vec2 to) {
+    glm::vec2 d = to - from;
+    float length = glm::length(d);
+    int stepX = d.x > 0 ? 1 : -1;
+    int stepZ = d.y > 0 ? 1 : -1;
+    float tDeltaX = d.x != 0 ? std::fabs(1.0f / d.x) : INFINITY;
+    float tDeltaZ = d.y != 0 ? std::fabs(1.0f / d.y) : INFINITY;
+    const int jumpSteps = FIELD_JUMP_CELLS * FIELD_STEPS_PER_CELL;
+    
+    float t = 0;
+    for (;;) {
+        // Shift so that cell (x, z) covers [x, x + 1)
+        glm::vec2 p = from + d * t + 0.5f;
+        int x = (int)std::floor(p.x);
+        int z = (int)std::floor(p.y);
+        float tMaxX = d.x != 0 ? t + (d.x > 0 ? x + 1 - p.x : p.x - x) * tDeltaX : INFINITY;
+        float tMaxZ = d.y != 0 ? t + (d.y > 0 ? z + 1 - p.y : p.y - z) * tDeltaZ : INFINITY;
+        
+        for (;;) {
+            int steps = x >= 0 && x < field.width && z >= 0 && z < field.height ? field.steps[(size_t)z * field.width + x] : 0;
+            if (steps == 0) return t;
+            if (steps >= jumpSteps) break;
+            if (tMaxX > 1.0f && tMaxZ > 1.0f) return 1.0f;
+            
+            if (tMaxX < tMaxZ) {
+                t = tMaxX;
+                x += stepX;
+                tMaxX += tDeltaX;
+            } else {
+                t = tMaxZ;
+                z += stepZ;
+                tMaxZ += tDeltaZ;
+            }
+        }
+        
+        // The point is at most a half diagonal from its cell's center and so is every
+        // blocker's box from its center, which is cheaper than measuring the first
+        t += (fieldCells(field, x, z) - 2 * FIELD_HALF_DIAGONAL) / length;
+        if (t >= 1.0f) return 1.0f;
+    }
+}
+
+#endif
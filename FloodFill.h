@@ -0,0 +1,178 @@
+#ifndef FLOOD_FILL_H
+#define FLOOD_FILL_H
+
+// Which cells can be reached at all, 64 cells at a time. Cells are bits laid out like
+// Map::blockers, and the fill works a word at a time: the reached bits of the words above,
+// below and beside it seed a word, which then spreads along its own open bits in a few
+// shifts. A word is only looked at again when a neighbour gains cells, so a fill costs about
+// as many word steps as there are runs of open cells it reaches, rather than one step per
+// cell.
+//
+// checkReachability uses it to validate a map: it collects every key that can be reached,
+// opens their doors and fills on from where it stopped, until no new key turns up.
+
+#include <cstdint>
+#include <vector>
+
+#include "Map.h"
+
+struct CellBits {
+    int width, height;
+    int wordsPerRow;
+    std::vector<uint64_t> words;   // rows padded to whole words, padding bits clear
+};
+
+inline void clearCellBits(CellBits& bits, int width, int height) {
+    bits.width = width;
+    bits.height = height;
+    bits.wordsPerRow = (width + 63) / 64;
+    bits.words.assign((size_t)bits.wordsPerRow * height, 0);
+}
+
+inline bool cellBit(const CellBits& bits, int x, int z) {
+    return (bits.words[(size_t)z * bits.wordsPerRow + (x >> 6)] >> (x & 63)) & 1;
+}
+
+inline void setCellBit(CellBits& bits, int x, int z) {
+    bits.words[(size_t)z * bits.wordsPerRow + (x >> 6)] |= 1ull << (x & 63);
+}
+
+inline size_t countCellBits(const CellBits& bits) {
+    size_t count = 0;
+    for (size_t w = 0; w < bits.words.size(); w++) count += __builtin_popcountll(bits.words[w]);
+    return count;
+}
+
+// Cells that don't block the player with the doors of keys open
+inline void openCellBits(const Map& map, KeyMask keys, CellBits& open) {
+    clearCellBits(open, map.width, map.height);
+    for (size_t w = 0; w < open.words.size(); w++) open.words[w] = ~map.blockers[w];
+    if (map.width & 63) {
+        for (int z = 0; z < map.height; z++) open.words[(size_t)z * open.wordsPerRow + open.wordsPerRow - 1] &= ~(~0ull << (map.width & 63));
+    }
+    for (size_t i = 0; i < map.doors.size(); i++) {
+        const MapItem& door = map.doors[i];
+        if (!blocksPlayer(map, door.x, door.z, keys)) setCellBit(open, door.x, door.z);
+    }
+}
+
+// Spreads seeds along the runs of open bits they are in, both ways (Kogge-Stone)
+inline uint64_t fillWord(uint64_t seeds, uint64_t open) {
+    uint64_t up = seeds & open, down = up;
+    uint64_t upOpen = open, downOpen = open;
+    for (int shift = 1; shift < 64; shift *= 2) {
+        up |= upOpen & (up << shift);
+        upOpen &= upOpen << shift;
+        down |= downOpen & (down >> shift);
+        downOpen &= downOpen >> shift;
+    }
+    return up | down;
+}
+
+// Grows reached through open, starting from the words in work (which it empties). Every
+// word whose reached bits could spread, to itself or a neighbour, has to be in work.
+inline void growFill(const CellBits& open, CellBits& reached, std::vector<size_t>& work) {
+    const int W = open.wordsPerRow;
+    const uint64_t* o = open.words.data();
+    uint64_t* r = reached.words.data();
+    while (!work.empty()) {
+        size_t w = work.back();
+        work.pop_back();
+        if (!o[w]) continue;
+        int z = (int)(w / W), column = (int)(w % W);
+        uint64_t seeds = (r[w] << 1) | (r[w] >> 1);
+        if (z > 0) seeds |= r[w - W];
+        if (z + 1 < open.height) seeds |= r[w + W];
+        if (column > 0) seeds |= r[w - 1] >> 63;
+        if (column + 1 < W) seeds |= r[w + 1] << 63;
+        
+        // Only seeds on cells not reached yet can spread
+        seeds &= o[w] & ~r[w];
+        if (!seeds) continue;
+        uint64_t filled = r[w] | fillWord(seeds, o[w]);
+        
+        // Only neighbours that have open cells next to the new ones can gain any
+        uint64_t added = filled & ~r[w];
+        r[w] = filled;
+        if (z > 0 && (added & o[w - W] & ~r[w - W])) work.push_back(w - W);
+        if (z + 1 < open.height && (added & o[w + W] & ~r[w + W])) work.push_back(w + W);
+        if (column > 0 && (added & 1) && (o[w - 1] & ~r[w - 1]) >> 63) work.push_back(w - 1);
+        if (column + 1 < W && (added >> 63) && (o[w + 1] & ~r[w + 1] & 1)) work.push_back(w + 1);
+    }
+}
+
+// The open cells reachable from (sx, sz), none if it isn't open
+inline void floodFill(const CellBits& open, int sx, int sz, CellBits& reached) {
+    clearCellBits(reached, open.width, open.height);
+    if (sx < 0 || sx >= open.width || sz < 0 || sz >= open.height || !cellBit(open, sx, sz)) return;
+    setCellBit(reached, sx, sz);
+    
+    // The start bit can spread into its own word or any beside it
+    const int W = open.wordsPerRow;
+    size_t w = (size_t)sz * W + (sx >> 6);
+    std::vector<size_t> work(1, w);
+    if (sz > 0) work.push_back(w - W);
+    if (sz + 1 < open.height) work.push_back(w + W);
+    if (sx >= 64) work.push_back(w - 1);
+    if ((sx >> 6) + 1 < W) work.push_back(w + 1);
+    growFill(open, reached, work);
+}
+
+// Opens the doors of key types in types and grows reached through them
+inline void openDoorsFill(const Map& map, KeyMask types, CellBits& open, CellBits& reached) {
+    std::vector<size_t> work;
+    for (size_t i = 0; i < map.doors.size(); i++) {
+        const MapItem& door = map.doors[i];
+        if (!((types >> door.type) & 1)) continue;
+        setCellBit(open, door.x, door.z);
+        work.push_back((size_t)door.z * open.wordsPerRow + (door.x >> 6));
+    }
+    growFill(open, reached, work);
+}
+
+struct Reachability {
+    bool goal;                      // the goal can be reached, picking up keys on the way
+    KeyMask keys;                   // key types that can be picked up
+    size_t reached, open;           // cells reached, and open once those keys' doors are
+    std::vector<MapItem> lostKeys;  // keys that can't be reached
+    std::vector<MapItem> stuckDoors;  // doors next to reachable cells whose key can't be reached
+};
+
+// What can be reached from the start: fill, pick up every key reached, open their doors
+// and fill on, until a pass finds no new key type
+inline Reachability checkReachability(const Map& map) {
+    Reachability result;
+    CellBits open, reached;
+    openCellBits(map, 0, open);
+    floodFill(open, worldToCell(map.startPos.x), worldToCell(map.startPos.z), reached);
+    
+    KeyMask keys = 0;
+    for (;;) {
+        KeyMask found = 0;
+        for (size_t i = 0; i < map.keys.size(); i++)
+            if (cellBit(reached, map.keys[i].x, map.keys[i].z)) found |= 1ull << map.keys[i].type;
+        if (!(found & ~keys)) break;
+        openDoorsFill(map, found & ~keys, open, reached);
+        keys |= found;
+    }
+    
+    result.keys = keys;
+    result.goal = cellBit(reached, worldToCell(map.goalPos.x), worldToCell(map.goalPos.z));
+    result.reached = countCellBits(reached);
+    result.open = countCellBits(open);
+    for (size_t i = 0; i < map.keys.size(); i++)
+        if (!cellBit(reached, map.keys[i].x, map.keys[i].z)) result.lostKeys.push_back(map.keys[i]);
+    for (size_t i = 0; i < map.doors.size(); i++) {
+        const MapItem& door = map.doors[i];
+        if ((keys >> door.type) & 1) continue;
+        bool touched = false;
+        for (int d = 0; d < 4 && !touched; d++) {
+            int x = door.x + (d == 0) - (d == 1), z = door.z + (d == 2) - (d == 3);
+            touched = map.inBounds(x, z) && cellBit(reached, x, z);
+        }
+        if (touched) result.stuckDoors.push_back(door);
+    }
+    return result;
+}
+
+#endif
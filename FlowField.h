@@ -0,0 +1,142 @@
+#ifndef FLOW_FIELD_H
+#define FLOW_FIELD_H
+
+// Shared ways to a target for any number of agents. A flow field holds, for every cell, the
+// step towards the target along a shortest path with a given set of keys held, so an agent
+// moves by reading one byte for its cell. It is built from the distances to the target
+// (PathDistance.h) once per target, and a cache keeps the fields of recent (target, keys)
+// pairs, dropping the least recently used ones to stay within a memory budget.
+//
+// Which doors are open is part of what a field is cached under. Picking up a key doesn't
+// edit the map's walls or doors, so a cached field stays right until they change.
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include "Map.h"
+#include "Solver.h"
+#include "PathDistance.h"
+#include "ThreadPool.h"
+
+// Steps stored in FlowField::dirs, besides an index into FLOW_DX / FLOW_DZ
+const int FLOW_DX[4] = { 1, -1, 0, 0 };
+const int FLOW_DZ[4] = { 0, 0, 1, -1 };
+const uint8_t FLOW_HERE = 4;   // the target cell
+const uint8_t FLOW_NONE = 5;   // blocked, or the target can't be reached from here
+
+struct FlowField {
+    int targetX, targetZ;
+    KeyMask keys;                   // only the types that open doors
+    int width, height;
+    std::vector<uint8_t> dirs;      // one per cell, row by row
+    size_t reached;                 // cells that lead to the target, the target included
+    int32_t farthest;               // steps from the farthest of them
+    uint64_t lastUsed;              // FlowFieldCache::clock when last returned
+};
+
+// The step to take from (x, z): an index into FLOW_DX / FLOW_DZ, FLOW_HERE or FLOW_NONE
+inline uint8_t flowStep(const FlowField& field, int x, int z) {
+    return field.dirs[(size_t)z * field.width + x];
+}
+
+// The field towards (tx, tz) with the doors of keys open. dist is scratch space for the
+// distances, kept by the caller so repeated builds don't reallocate it.
+inline void buildFlowField(const Map& map, KeyMask keys, int tx, int tz, FlowField& field, PathDistances& dist,
+                           ThreadPool& pool) {
+    PathDistanceStats stats = computePathDistances(map, keys, tx, tz, dist, pool);
+    field.targetX = tx;
+    field.targetZ = tz;
+    field.keys = keys;
+    field.width = map.width;
+    field.height = map.height;
+    field.dirs.resize((size_t)map.width * map.height);
+    field.reached = stats.reached;
+    field.farthest = stats.levels - 1;
+    
+    // Each reached cell steps to the first neighbour one step closer
+    int rowsPerTask = std::max(1, map.height / (pool.size() * 8));
+    pool.run((map.height + rowsPerTask - 1) / rowsPerTask, [&](int task) {
+        int z1 = std::min(map.height, (task + 1) * rowsPerTask);
+        for (int z = task * rowsPerTask; z < z1; z++) {
+            for (int x = 0; x < map.width; x++) {
+                size_t c = (size_t)z * map.width + x;
+                int32_t d = dist[c];
+                uint8_t step = d < 0 ? FLOW_NONE : FLOW_HERE;
+                for (int dir = 0; dir < 4 && d > 0; dir++) {
+                    int nx = x + FLOW_DX[dir], nz = z + FLOW_DZ[dir];
+                    if (map.inBounds(nx, nz) && dist[(size_t)nz * map.width + nx] == d - 1) {
+                        step = (uint8_t)dir;
+                        break;
+                    }
+                }
+                field.dirs[c] = step;
+            }
+        }
+    });
+}
+
+// Owns its fields, which go with it; clearFlowFieldCache drops them sooner
+struct FlowFieldCache {
+    size_t budget;                  // bytes of fields kept, though the latest is always kept
+    size_t bytes;
+    KeyMask doorTypes;              // keys of other types don't change a field
+    uint64_t clock;
+    std::vector<std::unique_ptr<FlowField> > fields;
+    PathDistances dist;             // scratch for builds
+    uint64_t hits, misses, evictions;
+};
+
+inline void initFlowFieldCache(FlowFieldCache& cache, const Map& map, size_t budget) {
+    cache.budget = budget;
+    cache.bytes = 0;
+    cache.doorTypes = doorKeyTypes(map);
+    cache.clock = 0;
+    cache.hits = cache.misses = cache.evictions = 0;
+}
+
+// Drops every field, for a new map or one whose walls or doors changed
+inline void clearFlowFieldCache(FlowFieldCache& cache) {
+    cache.fields.clear();
+    cache.bytes = 0;
+}
+
+// The field towards (tx, tz) holding keys, built if it isn't cached. Fields are few, so
+// they are looked up by a scan. The reference stays valid until a later call evicts it.
+inline const FlowField& flowField(FlowFieldCache& cache, const Map& map, int tx, int tz, KeyMask keys,
+                                  ThreadPool& pool) {
+    keys &= cache.doorTypes;
+    cache.clock++;
+    for (size_t i = 0; i < cache.fields.size(); i++) {
+        FlowField* field = cache.fields[i].get();
+        if (field->targetX != tx || field->targetZ != tz || field->keys != keys) continue;
+        field->lastUsed = cache.clock;
+        cache.hits++;
+        return *field;
+    }
+    cache.misses++;
+    
+    // Make room by dropping the least recently used, reusing the first one's buffer
+    size_t need = (size_t)map.width * map.height;
+    std::unique_ptr<FlowField> field;
+    while (!cache.fields.empty() && cache.bytes + need > cache.budget) {
+        size_t oldest = 0;
+        for (size_t i = 1; i < cache.fields.size(); i++)
+            if (cache.fields[i]->lastUsed < cache.fields[oldest]->lastUsed) oldest = i;
+        cache.bytes -= cache.fields[oldest]->dirs.size();
+        if (!field) field = std::move(cache.fields[oldest]);
+        cache.fields[oldest] = std::move(cache.fields.back());
+        cache.fields.pop_back();
+        cache.evictions++;
+    }
+    if (!field) field.reset(new FlowField());
+    
+    buildFlowField(map, keys, tx, tz, *field, cache.dist, pool);
+    field->lastUsed = cache.clock;
+    cache.bytes += field->dirs.size();
+    cache.fields.push_back(std::move(field));
+    return *cache.fields.back();
+}
+
+#endif
@@ -0,0 +1,267 @@
+#ifndef JUMP_PATH_H
+#define JUMP_PATH_H
+
+// Shortest paths between cells for navigation: A* over jump points (JPS+) on the 4-connected
+// cell grid, with the jump distances of every cell precomputed for one set of keys.
+//
+// Of all the equally short paths between two cells only one is searched: the one that turns
+// from a horizontal move to a vertical one only where it has to, because the cell it would
+// otherwise have turned at earlier is blocked (a forced neighbour). Vertical moves may turn
+// either way at any cell. So a horizontal jump runs until the next forced neighbour, and a
+// vertical jump runs until a row from which a horizontal jump would find one, and only the
+// cells where jumps stop are ever put on the open list.
+//
+// A door that opens only changes the rows next to it, and the columns where those rows'
+// jumps changed.
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+
+#include "Map.h"
+
+enum JumpDir { JUMP_EAST, JUMP_WEST, JUMP_SOUTH, JUMP_NORTH };   // +x, -x, +z, -z
+const int JUMP_DX[4] = { 1, -1, 0, 0 };
+const int JUMP_DZ[4] = { 0, 0, 1, -1 };
+const int JUMP_CAP = 32000;   // longer jumps stop at a cell on the way
+
+// Per cell and direction: > 0 for the steps to the next jump point, otherwise minus the
+// free steps before a blocker or the edge of the map. Blocked cells are all 0.
+struct JumpTable {
+    int width, height;
+    KeyMask keys;                  // doors of these key types are open
+    std::vector<int16_t> dist;     // 4 per cell, in JumpDir order
+};
+
+inline bool jumpFree(const Map& map, KeyMask keys, int x, int z) {
+    return !blocksPlayer(map, x, z, keys);
+}
+
+// Whether a horizontal move in direction dir arriving at (x, z) has to be allowed to turn
+// vertically there: the cell beside it is free but the one beside the cell it came from isn't
+inline bool jumpForced(const Map& map, KeyMask keys, int x, int z, int dir) {
+    int bx = x - JUMP_DX[dir];
+    return (jumpFree(map, keys, x, z - 1) && !jumpFree(map, keys, bx, z - 1)) ||
+           (jumpFree(map, keys, x, z + 1) && !jumpFree(map, keys, bx, z + 1));
+}
+
+// One step further than next's distance, or a jump point at next
+inline int16_t jumpFrom(int16_t next, bool nextIsJumpPoint) {
+    if (nextIsJumpPoint) return 1;
+    int d = next > 0 ? next + 1 : next - 1;
+    return (int16_t)(std::abs(d) > JUMP_CAP ? 1 : d);
+}
+
+inline int16_t& jumpDist(JumpTable& table, int x, int z, int dir) {
+    return table.dist[((size_t)z * table.width + x) * 4 + dir];
+}
+
+inline int16_t jumpDist(const JumpTable& table, int x, int z, int dir) {
+    return table.dist[((size_t)z * table.width + x) * 4 + dir];
+}
+
+// East and west distances of the cells of row z between x0 and x1 inclusive, which must
+// reach from a blocker (or the edge) to a blocker
+inline void computeJumpRow(const Map& map, JumpTable& table, int z, int x0, int x1) {
+    for (int x = x1; x >= x0; x--) {
+        bool blocked = x + 1 >= map.width || !jumpFree(map, table.keys, x + 1, z) || !jumpFree(map, table.keys, x, z);
+        jumpDist(table, x, z, JUMP_EAST) = blocked ? 0 :
+            jumpFrom(jumpDist(table, x + 1, z, JUMP_EAST), jumpForced(map, table.keys, x + 1, z, JUMP_EAST));
+    }
+    for (int x = x0; x <= x1; x++) {
+        bool blocked = x == 0 || !jumpFree(map, table.keys, x - 1, z) || !jumpFree(map, table.keys, x, z);
+        jumpDist(table, x, z, JUMP_WEST) = blocked ? 0 :
+            jumpFrom(jumpDist(table, x - 1, z, JUMP_WEST), jumpForced(map, table.keys, x - 1, z, JUMP_WEST));
+    }
+}
+
+// A vertical jump stops at a cell from which a horizontal jump finds a jump point
+inline bool jumpRowStop(const JumpTable& table, int x, int z) {
+    return jumpDist(table, x, z, JUMP_EAST) > 0 || jumpDist(table, x, z, JUMP_WEST) > 0;
+}
+
+// South and north distances of the cells of column x between z0 and z1 inclusive, which
+// must reach from a blocker (or the edge) to a blocker
+inline void computeJumpColumn(const Map& map, JumpTable& table, int x, int z0, int z1) {
+    for (int z = z1; z >= z0; z--) {
+        bool blocked = z + 1 >= map.height || !jumpFree(map, table.keys, x, z + 1) || !jumpFree(map, table.keys, x, z);
+        jumpDist(table, x, z, JUMP_SOUTH) = blocked ? 0 :
+            jumpFrom(jumpDist(table, x, z + 1, JUMP_SOUTH), jumpRowStop(table, x, z + 1));
+    }
+    for (int z = z0; z <= z1; z++) {
+        bool blocked = z == 0 || !jumpFree(map, table.keys, x, z - 1) || !jumpFree(map, table.keys, x, z);
+        jumpDist(table, x, z, JUMP_NORTH) = blocked ? 0 :
+            jumpFrom(jumpDist(table, x, z - 1, JUMP_NORTH), jumpRowStop(table, x, z - 1));
+    }
+}
+
+// Builds the table with the doors of keys open
+inline void buildJumpTable(const Map& map, KeyMask keys, JumpTable& table) {
+    table.width = map.width;
+    table.height = map.height;
+    table.keys = keys;
+    table.dist.assign((size_t)map.width * map.height * 4, 0);
+    for (int z = 0; z < map.height; z++) computeJumpRow(map, table, z, 0, map.width - 1);
+    for (int x = 0; x < map.width; x++) computeJumpColumn(map, table, x, 0, map.height - 1);
+}
+
+// Opens the doors of key types in keys that weren't open yet. A door only changes whether
+// the cells of the rows beside it are forced neighbours, so the runs of free cells through
+// it and around it along the rows are recomputed, then the runs along the columns through
+// it and wherever those rows' vertical stops changed. Each run is recomputed once however
+// many doors share it. Returns how many doors were opened.
+inline int unlockJumpDoors(const Map& map, JumpTable& table, KeyMask keys) {
+    KeyMask opened = keys & ~table.keys;
+    table.keys = keys;
+    if (!opened) return 0;
+    
+    int count = 0;
+    std::vector<std::pair<int, int> > rowCells, columnCells;   // (z, x) and (x, z)
+    for (size_t i = 0; i < map.doors.size(); i++) {
+        const MapItem& door = map.doors[i];
+        if (!((opened >> door.type) & 1)) continue;
+        count++;
+        for (int z = std::max(0, door.z - 1); z <= std::min(map.height - 1, door.z + 1); z++) {
+            for (int x = std::max(0, door.x - 1); x <= std::min(map.width - 1, door.x + 1); x++) {
+                if (jumpFree(map, keys, x, z)) rowCells.push_back(std::make_pair(z, x));
+            }
+        }
+        columnCells.push_back(std::make_pair(door.x, door.z));
+    }
+    
+    std::sort(rowCells.begin(), rowCells.end());
+    std::vector<uint8_t> stops;
+    int doneZ = -1, doneX = -1;
+    for (size_t i = 0; i < rowCells.size(); i++) {
+        int z = rowCells[i].first, x = rowCells[i].second;
+        if (z == doneZ && x <= doneX) continue;
+        int x0 = x, x1 = x;
+        while (x0 > 0 && jumpFree(map, keys, x0 - 1, z)) x0--;
+        while (x1 < map.width - 1 && jumpFree(map, keys, x1 + 1, z)) x1++;
+        stops.resize(x1 - x0 + 1);
+        for (int r = x0; r <= x1; r++) stops[r - x0] = jumpRowStop(table, r, z);
+        computeJumpRow(map, table, z, x0, x1);
+        for (int r = x0; r <= x1; r++) {
+            if (stops[r - x0] != jumpRowStop(table, r, z)) columnCells.push_back(std::make_pair(r, z));
+        }
+        doneZ = z;
+        doneX = x1;
+    }
+    
+    std::sort(columnCells.begin(), columnCells.end());
+    int doneColumn = -1, doneRow = -1;
+    for (size_t i = 0; i < columnCells.size(); i++) {
+        int x = columnCells[i].first, z = columnCells[i].second;
+        if (x == doneColumn && z <= doneRow) continue;
+        int z0 = z, z1 = z;
+        while (z0 > 0 && jumpFree(map, keys, x, z0 - 1)) z0--;
+        while (z1 < map.height - 1 && jumpFree(map, keys, x, z1 + 1)) z1++;
+        computeJumpColumn(map, table, x, z0, z1);
+        doneColumn = x;
+        doneRow = z1;
+    }
+    return count;
+}
+
+// Scratch space for searches, kept between them so that nothing is cleared per query
+struct JumpSearch {
+    std::vector<uint32_t> stamp;    // the search that last reached the cell
+    std::vector<int32_t> g;
+    std::vector<uint32_t> parent;   // cell index
+    std::vector<uint8_t> dir;       // direction the cell was reached in, 4 for the start
+    std::vector<uint8_t> closed;    // set once expanded, valid where stamp is current
+    std::vector<std::pair<int64_t, uint32_t> > open;   // (f, -g) packed into the key, cell
+    uint32_t current;
+    int expanded;                   // jump points expanded by the last search
+};
+
+// Finds a shortest path from (sx, sz) to (gx, gz) and returns its length in steps, or -1 if
+// there is none. waypoints gets the cells where it turns, start and goal included; the
+// cells between two of them are a straight line.
+inline int findJumpPath(const Map& map, const JumpTable& table, JumpSearch& search, int sx, int sz, int gx, int gz,
+                        std::vector<std::pair<int, int> >& waypoints) {
+    waypoints.clear();
+    size_t cells = (size_t)map.width * map.height;
+    if (search.stamp.size() != cells) {
+        search.stamp.assign(cells, 0);
+        search.g.resize(cells);
+        search.parent.resize(cells);
+        search.dir.resize(cells);
+        search.closed.resize(cells);
+        search.current = 0;
+    }
+    search.current++;
+    search.expanded = 0;
+    search.open.clear();
+    if (!map.inBounds(sx, sz) || !map.inBounds(gx, gz) || !jumpFree(map, table.keys, sx, sz) ||
+        !jumpFree(map, table.keys, gx, gz)) return -1;
+    
+    uint32_t start = (uint32_t)map.index(sx, sz), goal = (uint32_t)map.index(gx, gz);
+    search.stamp[start] = search.current;
+    search.g[start] = 0;
+    search.dir[start] = 4;
+    search.closed[start] = 0;
+    search.open.push_back(std::make_pair((int64_t)(std::abs(gx - sx) + std::abs(gz - sz)) << 32, start));
+    
+    while (!search.open.empty()) {
+        std::pop_heap(search.open.begin(), search.open.end(), std::greater<std::pair<int64_t, uint32_t> >());
+        uint32_t cell = search.open.back().second;
+        search.open.pop_back();
+        if (search.closed[cell]) continue;
+        search.closed[cell] = 1;
+        search.expanded++;
+        
+        if (cell == goal) {
+            for (uint32_t c = goal;; c = search.parent[c]) {
+                waypoints.push_back(std::make_pair((int)(c % map.width), (int)(c / map.width)));
+                if (c == start) break;
+            }
+            std::reverse(waypoints.begin(), waypoints.end());
+            return search.g[goal];
+        }
+        
+        int x = (int)(cell % map.width), z = (int)(cell / map.width);
+        int arrived = search.dir[cell];
+        for (int d = 0; d < 4; d++) {
+            // Never straight back; after a horizontal move only on, or up or down where forced
+            if (arrived != 4) {
+                if (d == (arrived ^ 1)) continue;
+                if (arrived <= JUMP_WEST && d != arrived &&
+                    (jumpFree(map, table.keys, x - JUMP_DX[arrived], z + JUMP_DZ[d]) ||
+                     !jumpFree(map, table.keys, x, z + JUMP_DZ[d]))) continue;
+            }
+            
+            int dist = jumpDist(table, x, z, d);
+            int reach = std::abs(dist);
+            int steps = dist > 0 ? dist : 0;
+            if (d <= JUMP_WEST) {
+                // Along the row: stop at the goal if it is in reach
+                int toGoal = (gx - x) * JUMP_DX[d];
+                if (gz == z && toGoal > 0 && toGoal <= reach) steps = toGoal;
+            } else {
+                // Down the column: stop at the goal's row if it is in reach, from where a
+                // horizontal jump may get to it
+                int toRow = (gz - z) * JUMP_DZ[d];
+                if (toRow > 0 && toRow <= reach) steps = toRow;
+            }
+            if (steps == 0) continue;
+            
+            int nx = x + JUMP_DX[d] * steps, nz = z + JUMP_DZ[d] * steps;
+            uint32_t next = (uint32_t)map.index(nx, nz);
+            int g = search.g[cell] + steps;
+            if (search.stamp[next] == search.current && (search.closed[next] || search.g[next] <= g)) continue;
+            search.stamp[next] = search.current;
+            search.g[next] = g;
+            search.parent[next] = cell;
+            search.dir[next] = (uint8_t)d;
+            search.closed[next] = 0;
+            int64_t f = g + std::abs(gx - nx) + std::abs(gz - nz);
+            search.open.push_back(std::make_pair((f << 32) | (uint32_t)(0x7FFFFFFF - g), next));
+            std::push_heap(search.open.begin(), search.open.end(), std::greater<std::pair<int64_t, uint32_t> >());
+        }
+    }
+    return -1;
+}
+
+#endif
@@ -0,0 +1,763 @@
+#ifndef MAP_H
+#define MAP_H
+
+// The maze grid, its loader and the movement rules shared by the game and the tools.
+//
+// Map files are "width height" followed by one row of cells per line:
+//   W wall, 0 floor, S start, G goal, a-e keys, A-E doors opened by the matching key
+// Maps with other keys put the number of key types after the size and declare each on its
+// own line before the rows, replacing a-e:
+//   <key letter> <door letter> #rrggbb
+
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+#include <cstdarg>
+#include <cmath>
+
+#include "glm/glm.hpp"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+// World units per cell; cell (x, z) is centered on (x * CELL_SIZE, z * CELL_SIZE)
+const float CELL_SIZE = 2.0f;
+
+// The player is a circle of this radius on the floor plane for collisions
+const float PLAYER_RADIUS = 0.3f;
+
+// Keys and doors as they were placed in the file
+struct MapItem {
+    int x, z;
+    uint8_t type;    // index into Map::keyTypes
+};
+
+const int MAX_KEY_TYPES = 64;
+
+struct KeyType {
+    char key, door;       // letters in text maps
+    uint8_t color[3];     // RGB of the key and its doors
+};
+
+// Collected keys, bit t set once a key of type t is picked up
+typedef uint64_t KeyMask;
+
+// Keys and doors are stored as their type with the top bits set, 0x80 | type for a key and
+// 0xC0 | type for its door, so a door test is a shift of the key mask rather than a lookup.
+// Walls, floor, start and goal are stored as their letters.
+const uint8_t CELL_KEY = 0x80;
+const uint8_t CELL_DOOR = 0xC0;
+
+inline char keyCell(int type) { return (char)(CELL_KEY | type); }
+inline char doorCell(int type) { return (char)(CELL_DOOR | type); }
+inline bool isKeyCell(char c) { return ((uint8_t)c & 0xC0) == CELL_KEY; }
+inline bool isDoorCell(char c) { return ((uint8_t)c & 0xC0) == CELL_DOOR; }
+inline int cellKeyType(char c) { return (uint8_t)c & 0x3F; }
+inline bool isBlockerCell(char c) { return c == 'W' || isDoorCell(c); }
+
+// a-e and A-E in the colors maps have always had
+inline std::vector<KeyType> defaultKeyTypes() {
+    static const KeyType types[] = {
+        { 'a', 'A', { 255, 0, 0 } },      // red
+        { 'b', 'B', { 0, 255, 0 } },      // green
+        { 'c', 'C', { 0, 128, 255 } },    // blue
+        { 'd', 'D', { 255, 255, 0 } },    // yellow
+        { 'e', 'E', { 255, 0, 255 } }     // magenta
+    };
+    return std::vector<KeyType>(types, types + sizeof(types) / sizeof(types[0]));
+}
+
+// Leaves chars uninitialized on resize so the loader threads are the first to touch
+// (and fault in) the rows they fill, instead of one thread zeroing the whole map
+template <typename T>
+struct UninitializedAllocator : std::allocator<T> {
+    template <typename U> struct rebind { typedef UninitializedAllocator<U> other; };
+    UninitializedAllocator() {}
+    template <typename U> UninitializedAllocator(const UninitializedAllocator<U>&) {}
+    template <typename U> void construct(U* p) { ::new ((void*)p) U; }
+    template <typename U, typename... Args> void construct(U* p, Args&&... args) { ::new ((void*)p) U(std::forward<Args>(args)...); }
+};
+
+struct Map {
+    int width, height;
+    std::vector<char, UninitializedAllocator<char> > cells;   // row-major, one contiguous allocation
+    std::vector<uint64_t> blockers;  // 1 bit per cell set for walls and doors, rows padded to whole words
+    int wordsPerRow;
+    glm::vec3 startPos;
+    glm::vec3 goalPos;
+    std::vector<MapItem> keys;    // as loaded, pickups don't remove them
+    std::vector<MapItem> doors;
+    std::vector<KeyType> keyTypes;
+    
+    bool inBounds(int x, int z) const {
+        return x >= 0 && x < width && z >= 0 && z < height;
+    }
+    
+    size_t index(int x, int z) const {
+        return (size_t)z * width + x;
+    }
+    
+    char cell(int x, int z) const {
+        return cells[index(x, z)];
+    }
+    
+    // Wall or door, from the bit layer; everything else never stops the player
+    bool isBlocker(int x, int z) const {
+        return (blockers[(size_t)z * wordsPerRow + (x >> 6)] >> (x & 63)) & 1;
+    }
+    
+    void setCell(int x, int z, char c) {
+        cells[index(x, z)] = c;
+        uint64_t bit = 1ull << (x & 63);
+        uint64_t& word = blockers[(size_t)z * wordsPerRow + (x >> 6)];
+        if (isBlockerCell(c)) word |= bit;
+        else word &= ~bit;
+    }
+};
+
+// Sizes the map without writing the cells, for loaders that fill every one
+inline void allocateMap(Map& map, int width, int height) {
+    map.width = width;
+    map.height = height;
+    map.cells.clear();
+    map.cells.resize((size_t)width * height);
+    map.wordsPerRow = (width + 63) / 64;
+    map.blockers.assign((size_t)map.wordsPerRow * height, 0);
+    map.startPos = glm::vec3(0, 1.0f, 0);
+    map.goalPos = glm::vec3(0, 1.0f, 0);
+    map.keys.clear();
+    map.doors.clear();
+    map.keyTypes = defaultKeyTypes();
+}
+
+// Allocates an all-floor map
+inline void initMap(Map& map, int width, int height) {
+    allocateMap(map, width, height);
+    memset(map.cells.data(), '0', map.cells.size());
+}
+
+inline int worldToCell(float v) {
+    return (int)(v / CELL_SIZE + 0.5f);
+}
+
+// ---- Loading ----
+
+struct MapError {
+    size_t line, column;   // 1-based, column 0 when the whole line is at fault
+    std::string message;
+};
+
+// What a pass over some rows found besides the cells themselves
+struct MapScan {
+    int starts, goals;
+    int startX, startZ, goalX, goalZ;
+    std::vector<MapItem> keys;
+    std::vector<MapItem> doors;
+    std::vector<MapError> errors;   // the first MAP_MAX_ERRORS
+    size_t errorCount;
+    size_t firstLine;               // file line of row 0, after the size and key declarations
+};
+
+const size_t MAP_MAX_ERRORS = 20;
+
+enum {
+    CELL_CLASS_VALID = 1,
+    CELL_CLASS_BLOCKER = 2,   // wall or door, mirrored into Map::blockers
+    CELL_CLASS_ITEM = 4       // S, G, key or door: recorded in MapScan
+};
+
+// How the bytes of a text map become cells, for the key types it declares
+struct CellLegend {
+    uint8_t classes[256];   // CELL_CLASS_* flags, 0 for anything that isn't a cell
+    char cells[256];        // what each byte is stored as: key and door letters become keyCell/doorCell
+};
+
+inline void initCellLegend(CellLegend& legend, const std::vector<KeyType>& keyTypes) {
+    memset(legend.classes, 0, sizeof(legend.classes));
+    for (int b = 0; b < 256; b++) legend.cells[b] = (char)b;
+    legend.classes[(uint8_t)'0'] = CELL_CLASS_VALID;
+    legend.classes[(uint8_t)'W'] = CELL_CLASS_VALID | CELL_CLASS_BLOCKER;
+    legend.classes[(uint8_t)'S'] = CELL_CLASS_VALID | CELL_CLASS_ITEM;
+    legend.classes[(uint8_t)'G'] = CELL_CLASS_VALID | CELL_CLASS_ITEM;
+    for (size_t t = 0; t < keyTypes.size(); t++) {
+        legend.classes[(uint8_t)keyTypes[t].key] = CELL_CLASS_VALID | CELL_CLASS_ITEM;
+        legend.classes[(uint8_t)keyTypes[t].door] = CELL_CLASS_VALID | CELL_CLASS_BLOCKER | CELL_CLASS_ITEM;
+        legend.cells[(uint8_t)keyTypes[t].key] = keyCell(t);
+        legend.cells[(uint8_t)keyTypes[t].door] = doorCell(t);
+    }
+}
+
+// The same flags for cells as stored, where keys and doors are already encoded
+inline void storedCellClasses(int keyTypeCount, uint8_t* classes) {
+    memset(classes, 0, 256);
+    classes[(uint8_t)'0'] = CELL_CLASS_VALID;
+    classes[(uint8_t)'W'] = CELL_CLASS_VALID | CELL_CLASS_BLOCKER;
+    classes[(uint8_t)'S'] = CELL_CLASS_VALID | CELL_CLASS_ITEM;
+    classes[(uint8_t)'G'] = CELL_CLASS_VALID | CELL_CLASS_ITEM;
+    for (int t = 0; t < keyTypeCount; t++) {
+        classes[(uint8_t)keyCell(t)] = CELL_CLASS_VALID | CELL_CLASS_ITEM;
+        classes[(uint8_t)doorCell(t)] = CELL_CLASS_VALID | CELL_CLASS_BLOCKER | CELL_CLASS_ITEM;
+    }
+}
+
+// 0x80 in every byte of v equal to c, 0 elsewhere (exact, no false positives from borrows)
+inline uint64_t matchBytes(uint64_t v, char c) {
+    uint64_t x = v ^ (0x0101010101010101ull * (uint8_t)c);
+    uint64_t t = ((x & 0x7f7f7f7f7f7f7f7full) + 0x7f7f7f7f7f7f7f7full) | x;
+    return ~t & 0x8080808080808080ull;
+}
+
+// Packs the top bit of each byte into 8 bits, byte 0 -> bit 0
+inline uint64_t gatherByteFlags(uint64_t flags) {
+    return ((flags >> 7) * 0x0102040810204080ull) >> 56;
+}
+
+// Blocker bits of up to 64 cells, classified by the given table. Returns true if they are
+// all walls and floor; false means an item or an invalid byte is among them. Full blocks of
+// only walls and floor, almost all of a large maze, are checked 8 bytes per step.
+inline bool classifyCellBlock(const char* cells, int count, const uint8_t* classes, uint64_t& word) {
+    word = 0;
+    bool plain = count == 64;
+    for (int k = 0; plain && k < 8; k++) {
+        uint64_t bytes;
+        memcpy(&bytes, cells + k * 8, 8);
+        uint64_t walls = matchBytes(bytes, 'W');
+        plain = (walls | matchBytes(bytes, '0')) == 0x8080808080808080ull;
+        word |= gatherByteFlags(walls) << (k * 8);
+    }
+    if (plain) return true;
+    
+    word = 0;
+    uint8_t all = CELL_CLASS_VALID, any = 0;
+    for (int x = 0; x < count; x++) {
+        uint8_t c = classes[(uint8_t)cells[x]];
+        word |= (uint64_t)((c >> 1) & 1) << x;
+        all &= c;
+        any |= c;
+    }
+    return (all & CELL_CLASS_VALID) && !(any & CELL_CLASS_ITEM);
+}
+
+inline void initMapScan(MapScan& scan) {
+    scan.starts = scan.goals = 0;
+    scan.startX = scan.startZ = scan.goalX = scan.goalZ = -1;
+    scan.keys.clear();
+    scan.doors.clear();
+    scan.errors.clear();
+    scan.errorCount = 0;
+    scan.firstLine = 2;
+}
+
+inline void addMapError(MapScan& scan, size_t line, size_t column, const char* format, ...) {
+    scan.errorCount++;
+    if (scan.errors.size() >= MAP_MAX_ERRORS) return;
+    
+    char message[160];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    
+    MapError error = { line, column, message };
+    scan.errors.push_back(error);
+}
+
+inline int hexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Parses "<key letter> <door letter> #rrggbb" from [p, end). Letters are any byte that isn't
+// blank or already taken.
+inline bool parseKeyType(const char* p, const char* end, const bool* taken, KeyType& type) {
+    for (int i = 0; i < 2; i++) {
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
+        if (p == end || (uint8_t)*p <= ' ' || *p == 127 || taken[(uint8_t)*p]) return false;
+        (i == 0 ? type.key : type.door) = *p++;
+        if (p < end && *p != ' ' && *p != '\t') return false;
+    }
+    if (type.key == type.door) return false;
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    if (end - p < 7 || *p++ != '#') return false;
+    for (int i = 0; i < 3; i++, p += 2) {
+        int high = hexDigit(p[0]), low = hexDigit(p[1]);
+        if (high < 0 || low < 0) return false;
+        type.color[i] = (uint8_t)(high * 16 + low);
+    }
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    return p == end;
+}
+
+// Parses "width height [keyTypes]" on the first line and the key declarations after it,
+// or picks the default a-e keys. Returns the start of the first row, or NULL.
+inline const char* parseMapHeader(const char* begin, const char* end, int& width, int& height,
+                                  std::vector<KeyType>& keyTypes, MapScan& scan) {
+    const char* p = begin;
+    long long values[3] = { 0, 0, 0 };
+    const long long limits[3] = { 1 << 30, 1 << 30, MAX_KEY_TYPES };
+    const char* names[3] = { "width", "height", "key type count" };
+    int fields = 0;
+    for (; fields < 3; fields++) {
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
+        if (fields == 2 && (p == end || *p == '\r' || *p == '\n')) break;
+        const char* digits = p;
+        long long& value = values[fields];
+        while (p < end && *p >= '0' && *p <= '9' && value <= limits[fields]) value = value * 10 + (*p++ - '0');
+        if (p == digits || value <= 0 || value > limits[fields]) {
+            addMapError(scan, 1, (size_t)(digits - begin) + 1, "expected a %s from 1 to %lld", names[fields], limits[fields]);
+            return NULL;
+        }
+    }
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    if (p < end && *p != '\n') {
+        addMapError(scan, 1, 0, "unexpected text after the map size");
+        return NULL;
+    }
+    p = p < end ? p + 1 : p;
+    
+    width = (int)values[0];
+    height = (int)values[1];
+    if (fields < 3) {
+        keyTypes = defaultKeyTypes();
+        scan.firstLine = 2;
+        return p;
+    }
+    
+    bool taken[256] = { false };
+    taken[(uint8_t)'0'] = taken[(uint8_t)'W'] = taken[(uint8_t)'S'] = taken[(uint8_t)'G'] = true;
+    keyTypes.clear();
+    bool ok = true;
+    for (int t = 0; t < values[2]; t++) {
+        size_t line = (size_t)t + 2;
+        if (p >= end) {
+            addMapError(scan, line, 0, "missing key type %d of %lld", t + 1, values[2]);
+            return NULL;
+        }
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        if (!eol) eol = end;
+        const char* lineEnd = eol > p && eol[-1] == '\r' ? eol - 1 : eol;
+        
+        KeyType type;
+        if (parseKeyType(p, lineEnd, taken, type)) {
+            taken[(uint8_t)type.key] = taken[(uint8_t)type.door] = true;
+            keyTypes.push_back(type);
+        } else {
+            addMapError(scan, line, 0, "expected \"<key letter> <door letter> #rrggbb\" with letters not used before");
+            ok = false;
+        }
+        p = eol < end ? eol + 1 : end;
+    }
+    scan.firstLine = (size_t)values[2] + 2;
+    return ok ? p : NULL;
+}
+
+// Parses rows [firstRow, lastRow) starting at p straight into the map store, which must
+// already be sized. Returns the position after the last row read.
+inline const char* parseMapRows(const char* p, const char* end, int firstRow, int lastRow,
+                                const CellLegend& legend, Map& map, MapScan& scan) {
+    const uint8_t* classes = legend.classes;
+    
+    for (int z = firstRow; z < lastRow; z++) {
+        size_t line = scan.firstLine + z;
+        if (p >= end) {
+            addMapError(scan, line, 0, "missing row %d of %d", z + 1, map.height);
+            for (; z < lastRow; z++)
+                for (int x = 0; x < map.width; x++) map.setCell(x, z, 'W');
+            return p;
+        }
+        
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        if (!eol) eol = end;
+        const char* rowEnd = eol;
+        if (rowEnd > p && rowEnd[-1] == '\r') rowEnd--;
+        
+        size_t length = rowEnd - p;
+        if (length != (size_t)map.width)
+            addMapError(scan, line, 0, "row %d has %zu cells, expected %d", z + 1, length, map.width);
+        int count = (int)std::min(length, (size_t)map.width);
+        
+        char* cells = &map.cells[map.index(0, z)];
+        uint64_t* blockers = &map.blockers[(size_t)z * map.wordsPerRow];
+        memcpy(cells, p, count);
+        
+        // Validate and build the blocker bits 64 cells at a time
+        for (int x0 = 0; x0 < count; x0 += 64) {
+            int x1 = std::min(x0 + 64, count);
+            uint64_t word;
+            bool plain = classifyCellBlock(cells + x0, x1 - x0, classes, word);
+            blockers[x0 >> 6] = word;
+            if (plain) continue;
+            
+            // Rare: an invalid byte or an item somewhere in these 64 cells
+            for (int x = x0; x < x1; x++) {
+                char c = cells[x];
+                uint8_t cls = classes[(uint8_t)c];
+                if (!(cls & CELL_CLASS_VALID)) {
+                    if (c >= 32 && c < 127) addMapError(scan, line, x + 1, "invalid cell '%c'", c);
+                    else addMapError(scan, line, x + 1, "invalid byte 0x%02x", (uint8_t)c);
+                    cells[x] = 'W';
+                    blockers[x0 >> 6] |= 1ull << (x - x0);
+                } else if (cls & CELL_CLASS_ITEM) {
+                    cells[x] = legend.cells[(uint8_t)c];
+                    MapItem item = { x, z, (uint8_t)cellKeyType(cells[x]) };
+                    if (c == 'S') {
+                        if (scan.starts++ == 0) { scan.startX = x; scan.startZ = z; }
+                        else addMapError(scan, line, x + 1, "second start, the first is at (%d, %d)", scan.startX, scan.startZ);
+                    } else if (c == 'G') {
+                        if (scan.goals++ == 0) { scan.goalX = x; scan.goalZ = z; }
+                        else addMapError(scan, line, x + 1, "second goal, the first is at (%d, %d)", scan.goalX, scan.goalZ);
+                    } else if (isKeyCell(cells[x])) scan.keys.push_back(item);
+                    else scan.doors.push_back(item);
+                }
+            }
+        }
+        // Short rows are padded with walls so the store stays consistent
+        for (int x = count; x < map.width; x++) map.setCell(x, z, 'W');
+        
+        p = eol < end ? eol + 1 : end;
+    }
+    return p;
+}
+
+// Checks what only the whole file can tell and copies the scan results into the map
+inline void finishMapScan(Map& map, MapScan& scan) {
+    if (scan.starts == 0) addMapError(scan, 0, 0, "no start cell 'S'");
+    if (scan.goals == 0) addMapError(scan, 0, 0, "no goal cell 'G'");
+    
+    if (scan.starts) map.startPos = glm::vec3(scan.startX * CELL_SIZE, 1.0f, scan.startZ * CELL_SIZE);
+    if (scan.goals) map.goalPos = glm::vec3(scan.goalX * CELL_SIZE, 1.0f, scan.goalZ * CELL_SIZE);
+    map.keys = scan.keys;
+    map.doors = scan.doors;
+}
+
+inline void printMapErrors(const char* filename, const MapScan& scan) {
+    for (size_t i = 0; i < scan.errors.size(); i++) {
+        const MapError& e = scan.errors[i];
+        if (e.line == 0) printf("%s: %s\n", filename, e.message.c_str());
+        else if (e.column == 0) printf("%s:%zu: %s\n", filename, e.line, e.message.c_str());
+        else printf("%s:%zu:%zu: %s\n", filename, e.line, e.column, e.message.c_str());
+    }
+    if (scan.errorCount > scan.errors.size())
+        printf("%s: %zu more errors\n", filename, scan.errorCount - scan.errors.size());
+}
+
+// Appends a later part's results to the scan of the rows before it
+inline void mergeMapScan(MapScan& scan, const MapScan& part) {
+    if (part.starts) {
+        if (scan.starts)
+            addMapError(scan, scan.firstLine + part.startZ, (size_t)part.startX + 1, "second start, the first is at (%d, %d)", scan.startX, scan.startZ);
+        else { scan.startX = part.startX; scan.startZ = part.startZ; }
+        scan.starts += part.starts;
+    }
+    if (part.goals) {
+        if (scan.goals)
+            addMapError(scan, scan.firstLine + part.goalZ, (size_t)part.goalX + 1, "second goal, the first is at (%d, %d)", scan.goalX, scan.goalZ);
+        else { scan.goalX = part.goalX; scan.goalZ = part.goalZ; }
+        scan.goals += part.goals;
+    }
+    scan.keys.insert(scan.keys.end(), part.keys.begin(), part.keys.end());
+    scan.doors.insert(scan.doors.end(), part.doors.begin(), part.doors.end());
+    scan.errors.insert(scan.errors.end(), part.errors.begin(), part.errors.end());
+    scan.errorCount += part.errorCount;
+}
+
+inline bool compareMapErrors(const MapError& a, const MapError& b) {
+    return a.line < b.line || (a.line == b.line && a.column < b.column);
+}
+
+// Below this a single thread finishes before the others would have started
+const size_t MAP_PARALLEL_MIN_BYTES = 4 << 20;
+
+// Parses rows in parallel: the text is cut into one range of whole lines per thread, the
+// newlines in each range are counted to learn which row it starts at, then every range
+// is parsed into its own rows and its scan is merged in file order. Returns the position
+// after the last row.
+inline const char* parseMapRowsParallel(const char* rows, const char* end, const CellLegend& legend,
+                                        Map& map, MapScan& scan, ThreadPool& pool) {
+    int parts = pool.size();
+    std::vector<const char*> bounds(parts + 1);
+    bounds[0] = rows;
+    bounds[parts] = end;
+    for (int t = 1; t < parts; t++) {
+        const char* p = std::max(bounds[t - 1], rows + (size_t)(end - rows) * t / parts);
+        const char* eol = p > rows ? (const char*)memchr(p - 1, '\n', end - (p - 1)) : p - 1;
+        bounds[t] = eol ? eol + 1 : end;
+    }
+    
+    std::vector<size_t> lines(parts + 1, 0);
+    pool.run(parts, [&](int t) {
+        size_t count = 0;
+        for (const char* p = bounds[t]; p < bounds[t + 1]; p++) {
+            p = (const char*)memchr(p, '\n', bounds[t + 1] - p);
+            if (!p) break;
+            count++;
+        }
+        lines[t + 1] = count;
+    });
+    for (int t = 0; t < parts; t++) lines[t + 1] += lines[t];
+    
+    std::vector<MapScan> scans(parts);
+    std::vector<const char*> ends(parts);
+    pool.run(parts, [&](int t) {
+        initMapScan(scans[t]);
+        scans[t].firstLine = scan.firstLine;
+        int firstRow = (int)std::min(lines[t], (size_t)map.height);
+        int lastRow = t + 1 < parts ? (int)std::min(lines[t + 1], (size_t)map.height) : map.height;
+        ends[t] = parseMapRows(bounds[t], end, firstRow, lastRow, legend, map, scans[t]);
+    });
+    
+    const char* last = rows;
+    for (int t = 0; t < parts; t++) {
+        mergeMapScan(scan, scans[t]);
+        if (lines[t] < (size_t)map.height) last = ends[t];
+    }
+    std::stable_sort(scan.errors.begin(), scan.errors.end(), compareMapErrors);
+    if (scan.errors.size() > MAP_MAX_ERRORS) scan.errors.resize(MAP_MAX_ERRORS);
+    return last;
+}
+
+// Maps the file and parses it in place in one pass, split across threads (0 for one per
+// core) when it's large. Prints diagnostics and returns false if the file can't be read
+// or any row is malformed.
+inline bool loadMap(const char* filename, Map& map, int threads = 0) {
+    MappedFile file;
+    if (!mapFile(filename, file)) {
+        printf("%s: can't open map\n", filename);
+        return false;
+    }
+    
+    MapScan scan;
+    initMapScan(scan);
+    const char* end = file.data + file.size;
+    int width = 0, height = 0;
+    std::vector<KeyType> keyTypes;
+    const char* rows = parseMapHeader(file.data, end, width, height, keyTypes, scan);
+    
+    if (rows) {
+        allocateMap(map, width, height);
+        map.keyTypes = keyTypes;
+        CellLegend legend;
+        initCellLegend(legend, keyTypes);
+        const char* p;
+        if (threads != 1 && (size_t)(end - rows) >= MAP_PARALLEL_MIN_BYTES) {
+            ThreadPool pool(threads);
+            p = parseMapRowsParallel(rows, end, legend, map, scan, pool);
+        } else {
+            p = parseMapRows(rows, end, 0, height, legend, map, scan);
+        }
+        while (p < end && isspace((unsigned char)*p)) p++;
+        if (p < end) addMapError(scan, scan.firstLine + height, 0, "unexpected data after the last row");
+        finishMapScan(map, scan);
+    }
+    unmapFile(file);
+    
+    printMapErrors(filename, scan);
+    return scan.errorCount == 0;
+}
+
+// The movement rules take any grid with inBounds, isBlocker and cell: a whole Map or the
+// resident part of a streamed one (MapStream.h)
+
+// Outside the map, walls and doors whose key hasn't been collected stop the player
+template <typename Grid>
+inline bool blocksPlayer(const Grid& map, int x, int z, KeyMask keys) {
+    if (!map.inBounds(x, z)) return true;
+    if (!map.isBlocker(x, z)) return false;
+    
+    // Only doors have both top bits set, and their low bits pick the key; walls never open
+    uint8_t cell = (uint8_t)map.cell(x, z);
+    return !((keys >> (cell & 0x3F)) & (cell >> 7) & (cell >> 6) & 1);
+}
+
+template <typename Grid>
+inline bool checkCollision(const Grid& map, glm::vec3 pos, KeyMask keys) {
+    // Check center position
+    if (blocksPlayer(map, worldToCell(pos.x), worldToCell(pos.z), keys)) return true;
+    
+    // Check collision in a small radius around player 
+    float radius = PLAYER_RADIUS;
+    
+    // Check 4 corners around player
+    glm::vec3 offsets[] = {
+        glm::vec3(radius, 0, radius),
+        glm::vec3(-radius, 0, radius),
+        glm::vec3(radius, 0, -radius),
+        glm::vec3(-radius, 0, -radius)
+    };
+    
+    for (int i = 0; i < 4; i++) {
+        glm::vec3 checkPos = pos + offsets[i];
+        if (blocksPlayer(map, worldToCell(checkPos.x), worldToCell(checkPos.z), keys)) return true;
+    }
+    
+    return false;
+}
+
+// ---- Swept movement ----
+
+// Distance kept between the player and what it stopped against, so the next sweep doesn't
+// start touching it
+const float SWEEP_SKIN = 0.001f;
+const int SWEEP_MAX_SLIDES = 4;
+
+// Earliest t in [0, 1] at which a circle of radius r moving from p by d touches the box
+// [boxMin, boxMax], and the normal it touches along. This is the point p against the box
+// grown by r with rounded corners: the slabs of the grown box, and where the ray enters a
+// corner of it, the circle around the box corner. A circle already touching the box only
+// hits when moving further in.
+inline bool sweepCircleBox(glm::vec2 p, glm::vec2 d, float r, glm::vec2 boxMin, glm::vec2 boxMax,
+                           float& t, glm::vec2& normal) {
+    glm::vec2 closest = glm::clamp(p, boxMin, boxMax);
+    glm::vec2 away = p - closest;
+    float distance2 = glm::dot(away, away);
+    if (distance2 < r * r) {
+        if (distance2 > 0) normal = away / std::sqrt(distance2);
+        else {
+            // Center inside the box: push out the nearest side
+            glm::vec2 toMin = p - boxMin, toMax = boxMax - p;
+            float m = std::min(std::min(toMin.x, toMax.x), std::min(toMin.y, toMax.y));
+            normal = m == toMin.x ? glm::vec2(-1, 0) : m == toMax.x ? glm::vec2(1, 0) : m == toMin.y ? glm::vec2(0, -1) : glm::vec2(0, 1);
+        }
+        if (glm::dot(d, normal) >= 0) return false;
+        t = 0;
+        return true;
+    }
+    
+    // Slabs of the grown box
+    float tEnter = 0, tExit = 1;
+    int axis = -1;
+    for (int i = 0; i < 2; i++) {
+        float lo = boxMin[i] - r, hi = boxMax[i] + r;
+        if (d[i] == 0) {
+            if (p[i] < lo || p[i] > hi) return false;
+            continue;
+        }
+        float t0 = (lo - p[i]) / d[i], t1 = (hi - p[i]) / d[i];
+        if (t0 > t1) std::swap(t0, t1);
+        if (t0 > tEnter) { tEnter = t0; axis = i; }
+        tExit = std::min(tExit, t1);
+        if (tEnter > tExit) return false;
+    }
+    
+    // Starting inside the grown box without touching puts p in one of its corners
+    glm::vec2 q = p + d * tEnter;
+    bool outsideX = q.x < boxMin.x || q.x > boxMax.x;
+    bool outsideZ = q.y < boxMin.y || q.y > boxMax.y;
+    if (!(outsideX && outsideZ)) {
+        if (axis < 0) return false;
+        t = tEnter;
+        normal = glm::vec2(0);
+        normal[axis] = d[axis] > 0 ? -1.0f : 1.0f;
+        return true;
+    }
+    
+    // Corner: ray against the circle of radius r around it
+    glm::vec2 corner(q.x < boxMin.x ? boxMin.x : boxMax.x, q.y < boxMin.y ? boxMin.y : boxMax.y);
+    glm::vec2 m = p - corner;
+    float a = glm::dot(d, d), b = glm::dot(m, d), c = glm::dot(m, m) - r * r;
+    float discriminant = b * b - a * c;
+    if (discriminant < 0) return false;
+    float tCorner = (-b - std::sqrt(discriminant)) / a;
+    if (tCorner < 0 || tCorner > 1) return false;
+    t = tCorner;
+    normal = glm::normalize(p + d * t - corner);
+    return true;
+}
+
+// Sweeps a circle of radius r from p by d through the grid and returns the earliest hit on
+// a cell that blocks the player. The center's path is walked cell by cell (a DDA over the
+// grid lines); since r is under half a cell, anything the circle can touch while its
+// center is in a cell is that cell or one of its 8 neighbors. Those the previous cell
+// already covered are skipped, so each step along the walk tests 3 new cells. The walk
+// stops once the best hit comes before the center leaves the current cell.
+template <typename Grid>
+inline bool sweepCircle(const Grid& map, glm::vec2 p, glm::vec2 d, float r, KeyMask keys, float& t, glm::vec2& normal) {
+    const float half = CELL_SIZE * 0.5f;
+    glm::vec2 g = p / CELL_SIZE + 0.5f;   // grid space, cell (x, z) covers [x, x + 1)
+    glm::vec2 gd = d / CELL_SIZE;
+    int x = (int)std::floor(g.x), z = (int)std::floor(g.y);
+    int stepX = gd.x > 0 ? 1 : -1, stepZ = gd.y > 0 ? 1 : -1;
+    float tMaxX = gd.x != 0 ? (gd.x > 0 ? x + 1 - g.x : g.x - x) / std::fabs(gd.x) : 2.0f;
+    float tMaxZ = gd.y != 0 ? (gd.y > 0 ? z + 1 - g.y : g.y - z) / std::fabs(gd.y) : 2.0f;
+    float tDeltaX = gd.x != 0 ? 1.0f / std::fabs(gd.x) : 2.0f;
+    float tDeltaZ = gd.y != 0 ? 1.0f / std::fabs(gd.y) : 2.0f;
+    
+    // Bounds of the whole sweep, which rule out most neighbors of short moves without a box test
+    glm::vec2 sweepMin = glm::min(p, p + d) - r, sweepMax = glm::max(p, p + d) + r;
+    bool hit = false;
+    t = 2.0f;
+    int lastX = x + 3, lastZ = z + 3;   // no neighbors in common with the first cell
+    for (;;) {
+        for (int nz = z - 1; nz <= z + 1; nz++) {
+            for (int nx = x - 1; nx <= x + 1; nx++) {
+                if (std::abs(nx - lastX) <= 1 && std::abs(nz - lastZ) <= 1) continue;
+                if (!blocksPlayer(map, nx, nz, keys)) continue;
+                glm::vec2 center(nx * CELL_SIZE, nz * CELL_SIZE);
+                if (center.x + half < sweepMin.x || center.x - half > sweepMax.x ||
+                    center.y + half < sweepMin.y || center.y - half > sweepMax.y) continue;
+                float cellT;
+                glm::vec2 cellNormal;
+                if (sweepCircleBox(p, d, r, center - half, center + half, cellT, cellNormal) && cellT < t) {
+                    t = cellT;
+                    normal = cellNormal;
+                    hit = true;
+                }
+            }
+        }
+        
+        float tLeave = std::min(tMaxX, tMaxZ);
+        if (t <= tLeave || tLeave >= 1.0f) return hit;
+        lastX = x;
+        lastZ = z;
+        if (tMaxX < tMaxZ) {
+            x += stepX;
+            tMaxX += tDeltaX;
+        } else {
+            z += stepZ;
+            tMaxZ += tDeltaZ;
+        }
+    }
+}
+
+// Moves the player from pos by move on the floor plane. Where the circle hits a wall or a
+// locked door it stops there and slides along it with the rest of the move, so however
+// long the move (a frame after a stall), it can't pass through anything.
+template <typename Grid>
+inline glm::vec3 sweepPlayer(const Grid& map, glm::vec3 pos, glm::vec3 move, KeyMask keys, float radius = PLAYER_RADIUS) {
+    glm::vec2 p(pos.x, pos.z), d(move.x, move.z);
+    for (int slide = 0; slide < SWEEP_MAX_SLIDES && glm::dot(d, d) > 1e-12f; slide++) {
+        float t;
+        glm::vec2 normal;
+        if (!sweepCircle(map, p, d, radius, keys, t, normal)) {
+            p += d;
+            break;
+        }
+        
+        // Back off along the move so the skin holds along the normal, then drop the part
+        // of what's left that goes into the surface
+        float approach = -glm::dot(d, normal);
+        float backoff = approach > 0 ? std::min(t, SWEEP_SKIN / approach) : 0.0f;
+        p += d * (t - backoff);
+        d *= 1.0f - (t - backoff);
+        d -= normal * glm::dot(d, normal);
+    }
+    return glm::vec3(p.x, pos.y, p.y);
+}
+
+template <typename Grid>
+inline bool checkWin(const Grid& map, glm::vec3 pos) {
+    int gridX = worldToCell(pos.x);
+    int gridZ = worldToCell(pos.z);
+    
+    if (!map.inBounds(gridX, gridZ))
+        return false;
+    
+    return map.cell(gridX, gridZ) == 'G';
+}
+
+#endif
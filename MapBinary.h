@@ -0,0 +1,523 @@
+#ifndef MAP_BINARY_H
+#define MAP_BINARY_H
+
+// Compiled maps (.mzb). The cells are cut into MZB_CHUNK_SIZE square chunks, each
+// compressed on its own so any chunk can be decoded without touching the rest:
+//   header | chunk table | chunk payloads (8-byte aligned) | key and door table | key types
+// Start, goal, keys and doors are stored in tables so nothing has to be scanned to find them.
+// Cells are stored as in Map, with keys and doors encoded as their type.
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "Map.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+const uint32_t MZB_VERSION = 2;   // 2: key types table, keys and doors stored by type
+const uint32_t MZB_CHUNK_SIZE = 64;       // one blocker word per chunk row
+const uint32_t MZB_HEADER_SIZE = 128;     // the chunk table starts here
+
+// Chunk encodings
+const uint32_t MZB_RAW = 0;    // the cells, row by row
+const uint32_t MZB_RLE = 1;    // (count 1-255, cell) pairs
+const uint32_t MZB_BITS = 2;   // one uint64 per row, bit set = wall, then a uint32 count of
+                               // MzbException for cells that are neither wall nor floor
+
+struct MzbHeader {
+    char magic[4];            // "MZB1"
+    uint32_t version;
+    uint32_t width, height;
+    uint32_t chunkSize;
+    uint32_t chunksX, chunksZ;
+    int32_t startX, startZ;
+    int32_t goalX, goalZ;
+    uint32_t keyCount;        // the item table holds the keys, then the doors
+    uint32_t doorCount;
+    uint32_t checksum;        // FNV-1a of the header (this field zeroed) and the tables
+    uint32_t keyTypeCount;
+    uint64_t itemsOffset;
+    uint64_t chunksOffset;
+    uint64_t fileSize;
+    uint64_t keyTypesOffset;
+};
+
+struct MzbItem {
+    int32_t x, z;
+    uint8_t type;             // index into the key types
+    char padding[3];
+};
+
+struct MzbKeyType {
+    char key, door;           // letters the text map used
+    uint8_t color[3];
+    char padding[3];
+};
+
+struct MzbChunk {
+    uint64_t offset;          // of the payload from the start of the file
+    uint32_t size;            // payload bytes
+    uint32_t encoding;        // MZB_RAW, MZB_RLE or MZB_BITS
+    uint32_t checksum;        // FNV-1a of the payload
+    uint32_t reserved;
+};
+
+struct MzbException {
+    uint16_t index;           // z * chunk width + x within the chunk
+    char cell;
+    char padding;
+};
+
+struct MzbFile {
+    MappedFile mapped;
+    const MzbHeader* header;
+    const MzbItem* items;
+    const MzbChunk* chunks;
+    const MzbKeyType* keyTypes;
+    uint8_t cellClasses[256];   // CELL_CLASS_* of each stored cell for the file's key types
+};
+
+inline uint32_t mzbChecksum(const void* data, size_t bytes, uint32_t hash = 2166136261u) {
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < bytes; i++) hash = (hash ^ p[i]) * 16777619u;
+    return hash;
+}
+
+// "maps/big.txt" -> "maps/big.mzb"
+inline std::string mzbPath(const std::string& textPath) {
+    size_t dot = textPath.find_last_of('.');
+    size_t slash = textPath.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return textPath + ".mzb";
+    return textPath.substr(0, dot) + ".mzb";
+}
+
+// Cell rectangle covered by a chunk, clipped to the map
+inline void mzbChunkRect(const MzbHeader& header, int cx, int cz, int& x0, int& z0, int& w, int& h) {
+    x0 = cx * header.chunkSize;
+    z0 = cz * header.chunkSize;
+    w = std::min(header.chunkSize, header.width - x0);
+    h = std::min(header.chunkSize, header.height - z0);
+}
+
+// ---- Writing ----
+
+// Large files need 64-bit offsets on every platform
+inline bool seekFile(FILE* file, uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(file, (__int64)offset, SEEK_SET) == 0;
+#else
+    return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+inline void encodeRLE(const std::vector<char>& cells, std::vector<char>& out) {
+    out.clear();
+    for (size_t i = 0; i < cells.size();) {
+        size_t run = 1;
+        while (i + run < cells.size() && run < 255 && cells[i + run] == cells[i]) run++;
+        out.push_back((char)run);
+        out.push_back(cells[i]);
+        i += run;
+    }
+}
+
+inline void encodeBits(const std::vector<char>& cells, int w, int h, std::vector<char>& out) {
+    std::vector<uint64_t> rows(h, 0);
+    std::vector<MzbException> exceptions;
+    for (int z = 0; z < h; z++) {
+        for (int x = 0; x < w; x++) {
+            char c = cells[z * w + x];
+            if (c == 'W') rows[z] |= 1ull << x;
+            else if (c != '0') {
+                MzbException e = { (uint16_t)(z * w + x), c, 0 };
+                exceptions.push_back(e);
+            }
+        }
+    }
+    uint32_t count = exceptions.size();
+    out.resize(h * sizeof(uint64_t) + sizeof(count) + count * sizeof(MzbException));
+    char* p = out.data();
+    memcpy(p, rows.data(), h * sizeof(uint64_t));
+    memcpy(p + h * sizeof(uint64_t), &count, sizeof(count));
+    if (count) memcpy(p + h * sizeof(uint64_t) + sizeof(count), exceptions.data(), count * sizeof(MzbException));
+}
+
+// Writes a .mzb one band of chunk rows at a time, so maps too large to hold in memory can
+// be compiled as they're generated
+struct MzbWriter {
+    FILE* file;
+    MzbHeader header;
+    std::vector<MzbChunk> table;
+    uint32_t bandsWritten;
+    uint64_t offset;
+    bool ok;
+};
+
+inline bool beginMzbFile(MzbWriter& writer, const char* filepath, int width, int height) {
+    MzbHeader& header = writer.header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "MZB1", 4);
+    header.version = MZB_VERSION;
+    header.width = width;
+    header.height = height;
+    header.chunkSize = MZB_CHUNK_SIZE;
+    header.chunksX = (width + MZB_CHUNK_SIZE - 1) / MZB_CHUNK_SIZE;
+    header.chunksZ = (height + MZB_CHUNK_SIZE - 1) / MZB_CHUNK_SIZE;
+    header.chunksOffset = MZB_HEADER_SIZE;
+    
+    writer.table.assign((size_t)header.chunksX * header.chunksZ, MzbChunk());
+    writer.bandsWritten = 0;
+    writer.offset = header.chunksOffset + writer.table.size() * sizeof(MzbChunk);
+    writer.file = fopen(filepath, "wb");
+    // Payloads go behind room left for the header and chunk table
+    writer.ok = writer.file && seekFile(writer.file, writer.offset);
+    return writer.ok;
+}
+
+// Encodes the next band of MZB_CHUNK_SIZE rows (fewer for the last), rows stride bytes apart,
+// picking the smallest encoding for each chunk
+inline bool writeMzbBand(MzbWriter& writer, const char* rows, size_t stride) {
+    const MzbHeader& header = writer.header;
+    uint32_t cz = writer.bandsWritten++;
+    std::vector<char> cells, rle, bits;
+    char zeros[8] = {0};
+    for (uint32_t cx = 0; writer.ok && cx < header.chunksX; cx++) {
+        int x0, z0, w, h;
+        mzbChunkRect(header, cx, cz, x0, z0, w, h);
+        cells.resize((size_t)w * h);
+        for (int z = 0; z < h; z++) memcpy(&cells[(size_t)z * w], rows + z * stride + x0, w);
+        
+        encodeRLE(cells, rle);
+        encodeBits(cells, w, h, bits);
+        const std::vector<char>* payload = &cells;
+        uint32_t encoding = MZB_RAW;
+        if (rle.size() < payload->size()) { payload = &rle; encoding = MZB_RLE; }
+        if (bits.size() < payload->size()) { payload = &bits; encoding = MZB_BITS; }
+        
+        MzbChunk& chunk = writer.table[(size_t)cz * header.chunksX + cx];
+        chunk.offset = writer.offset;
+        chunk.size = payload->size();
+        chunk.encoding = encoding;
+        chunk.checksum = mzbChecksum(payload->data(), payload->size());
+        chunk.reserved = 0;
+        
+        size_t pad = (8 - payload->size() % 8) % 8;
+        writer.ok = fwrite(payload->data(), 1, payload->size(), writer.file) == payload->size() &&
+                    fwrite(zeros, 1, pad, writer.file) == pad;
+        writer.offset += payload->size() + pad;
+    }
+    return writer.ok;
+}
+
+// Appends the key and door table and the key types and fills in the header and chunk table
+inline bool finishMzbFile(MzbWriter& writer, int startX, int startZ, int goalX, int goalZ,
+                          const std::vector<MapItem>& keys, const std::vector<MapItem>& doors,
+                          const std::vector<KeyType>& keyTypes) {
+    MzbHeader& header = writer.header;
+    if (!writer.file) return false;
+    writer.ok = writer.ok && writer.bandsWritten == header.chunksZ;
+    
+    header.startX = startX;
+    header.startZ = startZ;
+    header.goalX = goalX;
+    header.goalZ = goalZ;
+    header.keyCount = keys.size();
+    header.doorCount = doors.size();
+    std::vector<MzbItem> items;
+    for (int list = 0; list < 2; list++) {
+        const std::vector<MapItem>& source = list == 0 ? keys : doors;
+        for (size_t i = 0; i < source.size(); i++) {
+            MzbItem item = { source[i].x, source[i].z, source[i].type, {0, 0, 0} };
+            items.push_back(item);
+        }
+    }
+    std::vector<MzbKeyType> types(keyTypes.size());
+    for (size_t t = 0; t < keyTypes.size(); t++) {
+        MzbKeyType type = { keyTypes[t].key, keyTypes[t].door,
+                            { keyTypes[t].color[0], keyTypes[t].color[1], keyTypes[t].color[2] }, { 0, 0, 0 } };
+        types[t] = type;
+    }
+    header.keyTypeCount = types.size();
+    header.itemsOffset = writer.offset;
+    header.keyTypesOffset = header.itemsOffset + items.size() * sizeof(MzbItem);
+    header.fileSize = header.keyTypesOffset + types.size() * sizeof(MzbKeyType);
+    
+    uint32_t checksum = mzbChecksum(&header, sizeof(header));
+    checksum = mzbChecksum(items.data(), items.size() * sizeof(MzbItem), checksum);
+    checksum = mzbChecksum(types.data(), types.size() * sizeof(MzbKeyType), checksum);
+    header.checksum = mzbChecksum(writer.table.data(), writer.table.size() * sizeof(MzbChunk), checksum);
+    
+    char padding[MZB_HEADER_SIZE] = {0};
+    writer.ok = writer.ok &&
+        fwrite(items.data(), sizeof(MzbItem), items.size(), writer.file) == items.size() &&
+        fwrite(types.data(), sizeof(MzbKeyType), types.size(), writer.file) == types.size() &&
+        seekFile(writer.file, 0) &&
+        fwrite(&header, sizeof(header), 1, writer.file) == 1 &&
+        fwrite(padding, 1, MZB_HEADER_SIZE - sizeof(header), writer.file) == MZB_HEADER_SIZE - sizeof(header) &&
+        fwrite(writer.table.data(), sizeof(MzbChunk), writer.table.size(), writer.file) == writer.table.size();
+    bool closed = fclose(writer.file) == 0;
+    writer.file = NULL;
+    return writer.ok && closed;
+}
+
+// Returns false if the file can't be written
+inline bool writeMzbFile(const char* filepath, const Map& map) {
+    MzbWriter writer;
+    if (!beginMzbFile(writer, filepath, map.width, map.height)) {
+        if (writer.file) fclose(writer.file);
+        return false;
+    }
+    for (int z = 0; z < map.height; z += MZB_CHUNK_SIZE)
+        writeMzbBand(writer, &map.cells[map.index(0, z)], map.width);
+    return finishMzbFile(writer, worldToCell(map.startPos.x), worldToCell(map.startPos.z),
+                         worldToCell(map.goalPos.x), worldToCell(map.goalPos.z), map.keys, map.doors, map.keyTypes);
+}
+
+// ---- Reading ----
+
+inline bool isMzbFile(const char* filepath) {
+    char magic[4] = {0};
+    FILE* file = fopen(filepath, "rb");
+    if (!file) return false;
+    bool found = fread(magic, 1, 4, file) == 4 && memcmp(magic, "MZB1", 4) == 0;
+    fclose(file);
+    return found;
+}
+
+inline bool mzbCellInBounds(const MzbHeader& header, int32_t x, int32_t z) {
+    return x >= 0 && (uint32_t)x < header.width && z >= 0 && (uint32_t)z < header.height;
+}
+
+// Maps the file and validates the header and tables; chunks are checked as they're decoded.
+// Prints why and returns false if it can't be used.
+
+inline bool openMzbFile(const char* filepath, MzbFile& mzb) {
+    if (!mapFile(filepath, mzb.mapped)) {
+        printf("%s: can't open map\n", filepath);
+        return false;
+    }
+    
+    const char* error = NULL;
+    const MzbHeader* header = (const MzbHeader*)mzb.mapped.data;
+    size_t size = mzb.mapped.size;
+    uint64_t chunkCount = 0, itemCount = 0;
+    if (size < MZB_HEADER_SIZE || memcmp(header->magic, "MZB1", 4) != 0)
+        error = "not a compiled map";
+    else if (header->version < MZB_VERSION)
+        error = "compiled by an older mapc, compile it again";
+    else if (header->version != MZB_VERSION)
+        error = "unsupported version";
+    else if (header->chunkSize != MZB_CHUNK_SIZE || header->width == 0 || header->height == 0 ||
+             header->width > (1u << 30) || header->height > (1u << 30) ||
+             header->chunksX != (header->width + MZB_CHUNK_SIZE - 1) / MZB_CHUNK_SIZE ||
+             header->chunksZ != (header->height + MZB_CHUNK_SIZE - 1) / MZB_CHUNK_SIZE)
+        error = "bad dimensions";
+    else {
+        chunkCount = (uint64_t)header->chunksX * header->chunksZ;
+        itemCount = (uint64_t)header->keyCount + header->doorCount;
+        if (header->fileSize != size || header->itemsOffset < MZB_HEADER_SIZE || header->itemsOffset > size ||
+            header->itemsOffset % 4 != 0 || header->chunksOffset < MZB_HEADER_SIZE ||
+            (size - header->itemsOffset) / sizeof(MzbItem) < itemCount ||
+            header->chunksOffset % 8 != 0 || header->chunksOffset > size ||
+            (size - header->chunksOffset) / sizeof(MzbChunk) < chunkCount ||
+            header->keyTypesOffset > size || (size - header->keyTypesOffset) / sizeof(MzbKeyType) < header->keyTypeCount)
+            error = "truncated";
+        else if (header->keyTypeCount > MAX_KEY_TYPES)
+            error = "too many key types";
+    }
+    
+    if (!error) {
+        MzbHeader copy = *header;
+        copy.checksum = 0;
+        uint32_t checksum = mzbChecksum(&copy, sizeof(copy));
+        checksum = mzbChecksum(mzb.mapped.data + header->itemsOffset, itemCount * sizeof(MzbItem), checksum);
+        checksum = mzbChecksum(mzb.mapped.data + header->keyTypesOffset, header->keyTypeCount * sizeof(MzbKeyType), checksum);
+        checksum = mzbChecksum(mzb.mapped.data + header->chunksOffset, chunkCount * sizeof(MzbChunk), checksum);
+        if (checksum != header->checksum) error = "header checksum mismatch";
+    }
+    
+    if (!error) {
+        const MzbChunk* chunks = (const MzbChunk*)(mzb.mapped.data + header->chunksOffset);
+        for (uint64_t i = 0; i < chunkCount && !error; i++)
+            if (chunks[i].offset > size || chunks[i].size > size - chunks[i].offset || chunks[i].encoding > MZB_BITS)
+                error = "chunk table points outside the file";
+        
+        // Everything downstream indexes cells with these directly
+        if (!mzbCellInBounds(*header, header->startX, header->startZ) || !mzbCellInBounds(*header, header->goalX, header->goalZ))
+            error = "start or goal outside the map";
+        const MzbItem* items = (const MzbItem*)(mzb.mapped.data + header->itemsOffset);
+        for (uint64_t i = 0; i < itemCount && !error; i++) {
+            if (items[i].type >= header->keyTypeCount) error = "key or door of an undeclared type";
+            else if (!mzbCellInBounds(*header, items[i].x, items[i].z)) error = "key or door outside the map";
+        }
+    }
+    
+    if (error) {
+        printf("%s: %s\n", filepath, error);
+        unmapFile(mzb.mapped);
+        return false;
+    }
+    
+    mzb.header = header;
+    mzb.items = (const MzbItem*)(mzb.mapped.data + header->itemsOffset);
+    mzb.chunks = (const MzbChunk*)(mzb.mapped.data + header->chunksOffset);
+    mzb.keyTypes = (const MzbKeyType*)(mzb.mapped.data + header->keyTypesOffset);
+    storedCellClasses(header->keyTypeCount, mzb.cellClasses);
+    return true;
+}
+
+inline void closeMzbFile(MzbFile& mzb) {
+    unmapFile(mzb.mapped);
+}
+
+// Decodes one chunk into cells, which points at the chunk's first cell in rows of stride
+// bytes, and its blocker bits into one word per row, blockerStride words apart. Returns
+// false if the payload is corrupt or holds invalid cells.
+inline bool decodeMzbChunk(const MzbFile& mzb, int cx, int cz, char* cells, size_t stride,
+                           uint64_t* blockers, size_t blockerStride) {
+    const MzbChunk& chunk = mzb.chunks[(size_t)cz * mzb.header->chunksX + cx];
+    const char* payload = mzb.mapped.data + chunk.offset;
+    if (mzbChecksum(payload, chunk.size) != chunk.checksum) return false;
+    
+    int x0, z0, w, h;
+    mzbChunkRect(*mzb.header, cx, cz, x0, z0, w, h);
+    size_t count = (size_t)w * h;
+    const uint8_t* classes = mzb.cellClasses;
+    
+    if (chunk.encoding == MZB_RAW || chunk.encoding == MZB_RLE) {
+        if (chunk.encoding == MZB_RAW) {
+            if (chunk.size != count) return false;
+            for (int z = 0; z < h; z++) memcpy(cells + z * stride, payload + (size_t)z * w, w);
+        } else {
+            size_t i = 0;
+            if (chunk.size % 2 != 0) return false;
+            for (uint32_t p = 0; p < chunk.size; p += 2) {
+                size_t run = (uint8_t)payload[p];
+                if (run == 0 || i + run > count) return false;
+                for (size_t end = i + run; i < end; i++) cells[(i / w) * stride + i % w] = payload[p + 1];
+            }
+            if (i != count) return false;
+        }
+        bool valid = true;
+        for (int z = 0; z < h; z++) {
+            const char* row = cells + z * stride;
+            if (classifyCellBlock(row, w, classes, blockers[z * blockerStride])) continue;
+            for (int x = 0; x < w; x++) valid = valid && classes[(uint8_t)row[x]] != 0;
+        }
+        return valid;
+    }
+    
+    // MZB_BITS: the rows are the blocker words already; expand each byte to 8 cells
+    static const struct Expand {
+        uint64_t bytes[256];
+        Expand() {
+            for (int b = 0; b < 256; b++) {
+                bytes[b] = 0;
+                for (int i = 0; i < 8; i++) bytes[b] |= (uint64_t)(b >> i & 1 ? 'W' : '0') << (i * 8);
+            }
+        }
+    } expand;
+    
+    size_t rowBytes = (size_t)h * sizeof(uint64_t);
+    uint32_t exceptionCount;
+    if (chunk.size < rowBytes + sizeof(exceptionCount)) return false;
+    memcpy(&exceptionCount, payload + rowBytes, sizeof(exceptionCount));
+    if (chunk.size != rowBytes + sizeof(exceptionCount) + (size_t)exceptionCount * sizeof(MzbException)) return false;
+    
+    uint64_t rowMask = w == 64 ? ~0ull : (1ull << w) - 1;
+    for (int z = 0; z < h; z++) {
+        uint64_t bits;
+        memcpy(&bits, payload + z * sizeof(uint64_t), sizeof(bits));
+        if (bits & ~rowMask) return false;
+        blockers[z * blockerStride] = bits;
+        char* row = cells + z * stride;
+        int x = 0;
+        for (; x + 8 <= w; x += 8) memcpy(row + x, &expand.bytes[(bits >> x) & 0xff], 8);
+        for (; x < w; x++) row[x] = (bits >> x) & 1 ? 'W' : '0';
+    }
+    const char* exceptions = payload + rowBytes + sizeof(exceptionCount);
+    for (uint32_t i = 0; i < exceptionCount; i++) {
+        MzbException e;
+        memcpy(&e, exceptions + i * sizeof(MzbException), sizeof(e));
+        uint8_t cls = classes[(uint8_t)e.cell];
+        if (e.index >= count || !cls) return false;
+        int x = e.index % w, z = e.index / w;
+        cells[z * stride + x] = e.cell;
+        uint64_t& word = blockers[z * blockerStride];
+        word = (word & ~(1ull << x)) | (uint64_t)((cls >> 1) & 1) << x;
+    }
+    return true;
+}
+
+inline std::vector<KeyType> readMzbKeyTypes(const MzbFile& mzb) {
+    std::vector<KeyType> types(mzb.header->keyTypeCount);
+    for (size_t t = 0; t < types.size(); t++) {
+        const MzbKeyType& type = mzb.keyTypes[t];
+        KeyType keyType = { type.key, type.door, { type.color[0], type.color[1], type.color[2] } };
+        types[t] = keyType;
+    }
+    return types;
+}
+
+// Copies start, goal, keys, doors and key types from the tables
+inline void readMzbItems(const MzbFile& mzb, Map& map) {
+    const MzbHeader& header = *mzb.header;
+    map.startPos = glm::vec3(header.startX * CELL_SIZE, 1.0f, header.startZ * CELL_SIZE);
+    map.goalPos = glm::vec3(header.goalX * CELL_SIZE, 1.0f, header.goalZ * CELL_SIZE);
+    map.keys.clear();
+    map.doors.clear();
+    for (uint32_t i = 0; i < header.keyCount + header.doorCount; i++) {
+        MapItem item = { mzb.items[i].x, mzb.items[i].z, mzb.items[i].type };
+        (i < header.keyCount ? map.keys : map.doors).push_back(item);
+    }
+    map.keyTypes = readMzbKeyTypes(mzb);
+}
+
+// Decodes every chunk into a full map, one band of chunk rows per task
+inline bool loadMzbMap(const char* filepath, Map& map, int threads = 0) {
+    MzbFile mzb;
+    if (!openMzbFile(filepath, mzb)) return false;
+    
+    const MzbHeader header = *mzb.header;
+    allocateMap(map, header.width, header.height);
+    readMzbItems(mzb, map);
+    
+    std::vector<char> corrupt((size_t)header.chunksX * header.chunksZ, 0);
+    ThreadPool pool(header.width * (size_t)header.height >= MAP_PARALLEL_MIN_BYTES ? threads : 1);
+    pool.run(header.chunksZ, [&](int cz) {
+        for (uint32_t cx = 0; cx < header.chunksX; cx++) {
+            int x0, z0, w, h;
+            mzbChunkRect(header, cx, cz, x0, z0, w, h);
+            // Chunks are one blocker word wide
+            if (!decodeMzbChunk(mzb, cx, cz, &map.cells[map.index(x0, z0)], map.width,
+                                &map.blockers[(size_t)z0 * map.wordsPerRow + cx], map.wordsPerRow)) {
+                corrupt[(size_t)cz * header.chunksX + cx] = 1;
+                for (int z = z0; z < z0 + h; z++)
+                    for (int x = x0; x < x0 + w; x++) map.setCell(x, z, 'W');
+            }
+        }
+    });
+    closeMzbFile(mzb);
+    
+    bool ok = true;
+    for (uint32_t cz = 0; cz < header.chunksZ; cz++) {
+        for (uint32_t cx = 0; cx < header.chunksX; cx++) {
+            if (!corrupt[(size_t)cz * header.chunksX + cx]) continue;
+            printf("%s: chunk (%u, %u) is corrupt\n", filepath, cx, cz);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// Loads a compiled map or a text map, whichever the file holds
+inline bool loadMapAnyFormat(const char* filepath, Map& map, int threads = 0) {
+    if (isMzbFile(filepath)) return loadMzbMap(filepath, map, threads);
+    return loadMap(filepath, map, threads);
+}
+
+#endif
@@ -0,0 +1,301 @@
+#ifndef MAP_STREAM_H
+#define MAP_STREAM_H
+
+// Streaming for compiled maps too large to hold in memory. Only the .mzb chunks within
+// STREAM_RADIUS chunks of the player stay decoded; a background thread decodes the ones
+// the player moves towards and the game thread installs them and evicts those left behind.
+// Cell edits (picked up keys) go into a per-chunk delta that outlives eviction and is
+// reapplied whenever the chunk comes back.
+
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include "Map.h"
+#include "MapBinary.h"
+
+const int STREAM_RADIUS = 2;         // chunks kept around the player's chunk, 5x5 of 64x64 cells
+const int STREAM_EVICT_MARGIN = 1;   // evicted only once this much further, so edges don't thrash
+
+// Slot states besides an index into MapStream::resident
+const int32_t STREAM_ABSENT = -1;
+const int32_t STREAM_LOADING = -2;
+
+struct StreamChunk {
+    int cx, cz;
+    int x0, z0, x1, z1;                                // cells [x0, x1) x [z0, z1)
+    char cells[MZB_CHUNK_SIZE * MZB_CHUNK_SIZE];       // rows MZB_CHUNK_SIZE apart
+    uint64_t blockers[MZB_CHUNK_SIZE];                 // one word per row
+    bool valid;                                        // decoded without errors
+    bool changed;                                      // installed or edited since the renderer last baked it
+};
+
+struct CellEdit {
+    uint16_t index;    // z * MZB_CHUNK_SIZE + x within the chunk
+    char cell;
+};
+
+struct MapStream {
+    MzbFile mzb;
+    int width, height;
+    glm::vec3 startPos;
+    glm::vec3 goalPos;
+    std::vector<KeyType> keyTypes;
+    int chunksX, chunksZ;
+    int centerX, centerZ;                  // chunk the player was last in
+    std::vector<int32_t> slots;            // per chunk: index into resident, STREAM_ABSENT or STREAM_LOADING
+    std::vector<StreamChunk*> resident;
+    std::vector<StreamChunk*> spare;       // buffers of evicted chunks, reused for new requests
+    std::unordered_map<int, std::vector<CellEdit> > deltas;
+    std::vector<int> evicted;              // chunks dropped by the last update, for the renderer
+    int pending;                           // requested and not installed yet
+    
+    // Shared with the I/O thread
+    std::thread io;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<StreamChunk*> requests;
+    std::vector<StreamChunk*> loaded;
+    bool stop;
+    
+    bool inBounds(int x, int z) const {
+        return x >= 0 && x < width && z >= 0 && z < height;
+    }
+    
+    int chunkIndex(int x, int z) const {
+        return (z / (int)MZB_CHUNK_SIZE) * chunksX + x / (int)MZB_CHUNK_SIZE;
+    }
+    
+    // Cells that aren't resident read as walls, so the player can't walk into them
+    char cell(int x, int z) const {
+        int32_t slot = slots[chunkIndex(x, z)];
+        if (slot < 0) return 'W';
+        return resident[slot]->cells[(z % MZB_CHUNK_SIZE) * MZB_CHUNK_SIZE + x % MZB_CHUNK_SIZE];
+    }
+    
+    bool isBlocker(int x, int z) const {
+        int32_t slot = slots[chunkIndex(x, z)];
+        if (slot < 0) return true;
+        return (resident[slot]->blockers[z % MZB_CHUNK_SIZE] >> (x % MZB_CHUNK_SIZE)) & 1;
+    }
+    
+    // Only resident cells can change; the edit is kept for when the chunk is reloaded
+    void setCell(int x, int z, char c) {
+        int chunk = chunkIndex(x, z);
+        int32_t slot = slots[chunk];
+        if (slot < 0) return;
+        
+        StreamChunk& resChunk = *resident[slot];
+        int lx = x % MZB_CHUNK_SIZE, lz = z % MZB_CHUNK_SIZE;
+        uint16_t index = (uint16_t)(lz * MZB_CHUNK_SIZE + lx);
+        resChunk.cells[index] = c;
+        uint64_t bit = 1ull << lx;
+        if (isBlockerCell(c)) resChunk.blockers[lz] |= bit;
+        else resChunk.blockers[lz] &= ~bit;
+        resChunk.changed = true;
+        
+        std::vector<CellEdit>& edits = deltas[chunk];
+        for (size_t i = 0; i < edits.size(); i++) {
+            if (edits[i].index == index) {
+                edits[i].cell = c;
+                return;
+            }
+        }
+        CellEdit edit = { index, c };
+        edits.push_back(edit);
+    }
+};
+
+// Decodes requested chunks until the stream is closed
+inline void streamWorker(MapStream* stream) {
+    for (;;) {
+        StreamChunk* chunk;
+        {
+            std::unique_lock<std::mutex> lock(stream->mutex);
+            stream->wake.wait(lock, [stream] { return stream->stop || !stream->requests.empty(); });
+            if (stream->stop) return;
+            chunk = stream->requests.front();
+            stream->requests.pop_front();
+        }
+        
+        chunk->valid = decodeMzbChunk(stream->mzb, chunk->cx, chunk->cz, chunk->cells, MZB_CHUNK_SIZE, chunk->blockers, 1);
+        
+        std::lock_guard<std::mutex> lock(stream->mutex);
+        stream->loaded.push_back(chunk);
+    }
+}
+
+inline void requestChunk(MapStream& stream, int cx, int cz) {
+    int index = cz * stream.chunksX + cx;
+    if (stream.slots[index] != STREAM_ABSENT) return;
+    
+    StreamChunk* chunk;
+    if (stream.spare.empty()) chunk = new StreamChunk;
+    else {
+        chunk = stream.spare.back();
+        stream.spare.pop_back();
+    }
+    chunk->cx = cx;
+    chunk->cz = cz;
+    stream.slots[index] = STREAM_LOADING;
+    stream.pending++;
+    
+    std::lock_guard<std::mutex> lock(stream.mutex);
+    stream.requests.push_back(chunk);
+    stream.wake.notify_one();
+}
+
+// Makes a decoded chunk visible to lookups with its delta applied. Returns how many were installed.
+inline int installLoadedChunks(MapStream& stream) {
+    std::vector<StreamChunk*> loaded;
+    {
+        std::lock_guard<std::mutex> lock(stream.mutex);
+        loaded.swap(stream.loaded);
+    }
+    
+    for (size_t i = 0; i < loaded.size(); i++) {
+        StreamChunk& chunk = *loaded[i];
+        int index = chunk.cz * stream.chunksX + chunk.cx;
+        int w, h;
+        mzbChunkRect(*stream.mzb.header, chunk.cx, chunk.cz, chunk.x0, chunk.z0, w, h);
+        chunk.x1 = chunk.x0 + w;
+        chunk.z1 = chunk.z0 + h;
+        if (!chunk.valid) {
+            printf("Chunk (%d, %d) is corrupt, filled with walls\n", chunk.cx, chunk.cz);
+            memset(chunk.cells, 'W', sizeof(chunk.cells));
+            for (int z = 0; z < h; z++) chunk.blockers[z] = w == 64 ? ~0ull : (1ull << w) - 1;
+        }
+        
+        stream.slots[index] = stream.resident.size();
+        stream.resident.push_back(&chunk);
+        stream.pending--;
+        
+        std::unordered_map<int, std::vector<CellEdit> >::const_iterator delta = stream.deltas.find(index);
+        if (delta != stream.deltas.end()) {
+            for (size_t e = 0; e < delta->second.size(); e++) {
+                const CellEdit& edit = delta->second[e];
+                stream.setCell(chunk.x0 + edit.index % MZB_CHUNK_SIZE, chunk.z0 + edit.index / MZB_CHUNK_SIZE, edit.cell);
+            }
+        }
+        chunk.changed = true;
+        
+        // Neighbors baked while this chunk was missing treated it as wall
+        const int offsets[4][2] = { {1, 0}, {-1, 0}, {0, 1}, {0, -1} };
+        for (int n = 0; n < 4; n++) {
+            int nx = chunk.cx + offsets[n][0], nz = chunk.cz + offsets[n][1];
+            if (nx < 0 || nx >= stream.chunksX || nz < 0 || nz >= stream.chunksZ) continue;
+            int32_t slot = stream.slots[nz * stream.chunksX + nx];
+            if (slot >= 0) stream.resident[slot]->changed = true;
+        }
+    }
+    return loaded.size();
+}
+
+// Installs finished loads, requests the chunks around the player's cell (nearest first) and
+// evicts those beyond the margin. Returns how many chunks were installed.
+inline int updateMapStream(MapStream& stream, int cellX, int cellZ) {
+    int installed = installLoadedChunks(stream);
+    stream.evicted.clear();
+    
+    int cx = std::max(0, std::min(cellX / (int)MZB_CHUNK_SIZE, stream.chunksX - 1));
+    int cz = std::max(0, std::min(cellZ / (int)MZB_CHUNK_SIZE, stream.chunksZ - 1));
+    if (cx != stream.centerX || cz != stream.centerZ) {
+        stream.centerX = cx;
+        stream.centerZ = cz;
+        for (int ring = 0; ring <= STREAM_RADIUS; ring++) {
+            for (int z = cz - ring; z <= cz + ring; z++) {
+                for (int x = cx - ring; x <= cx + ring; x++) {
+                    if (std::max(abs(x - cx), abs(z - cz)) != ring) continue;
+                    if (x < 0 || x >= stream.chunksX || z < 0 || z >= stream.chunksZ) continue;
+                    requestChunk(stream, x, z);
+                }
+            }
+        }
+    }
+    
+    // Also catches chunks that finished loading after the player had moved on
+    for (size_t i = 0; i < stream.resident.size();) {
+        StreamChunk* chunk = stream.resident[i];
+        if (std::max(abs(chunk->cx - cx), abs(chunk->cz - cz)) <= STREAM_RADIUS + STREAM_EVICT_MARGIN) {
+            i++;
+            continue;
+        }
+        int index = chunk->cz * stream.chunksX + chunk->cx;
+        stream.slots[index] = STREAM_ABSENT;
+        stream.evicted.push_back(index);
+        stream.spare.push_back(chunk);
+        
+        stream.resident[i] = stream.resident.back();
+        stream.resident.pop_back();
+        if (i < stream.resident.size())
+            stream.slots[stream.resident[i]->cz * stream.chunksX + stream.resident[i]->cx] = i;
+    }
+    return installed;
+}
+
+// Blocks until every requested chunk is installed, for the first frame
+inline void flushMapStream(MapStream& stream) {
+    while (stream.pending > 0) {
+        installLoadedChunks(stream);
+        if (stream.pending > 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+// Opens a compiled map for streaming and loads the chunks around the start
+inline bool openMapStream(const char* filepath, MapStream& stream) {
+    if (!openMzbFile(filepath, stream.mzb)) return false;
+    
+    const MzbHeader& header = *stream.mzb.header;
+    stream.width = header.width;
+    stream.height = header.height;
+    stream.startPos = glm::vec3(header.startX * CELL_SIZE, 1.0f, header.startZ * CELL_SIZE);
+    stream.goalPos = glm::vec3(header.goalX * CELL_SIZE, 1.0f, header.goalZ * CELL_SIZE);
+    stream.keyTypes = readMzbKeyTypes(stream.mzb);
+    stream.chunksX = header.chunksX;
+    stream.chunksZ = header.chunksZ;
+    stream.centerX = stream.centerZ = -1;
+    stream.slots.assign((size_t)stream.chunksX * stream.chunksZ, STREAM_ABSENT);
+    stream.pending = 0;
+    stream.stop = false;
+    stream.io = std::thread(streamWorker, &stream);
+    
+    updateMapStream(stream, header.startX, header.startZ);
+    flushMapStream(stream);
+    return true;
+}
+
+inline void closeMapStream(MapStream& stream) {
+    {
+        std::lock_guard<std::mutex> lock(stream.mutex);
+        stream.stop = true;
+    }
+    stream.wake.notify_all();
+    stream.io.join();
+    
+    for (size_t i = 0; i < stream.requests.size(); i++) delete stream.requests[i];
+    for (size_t i = 0; i < stream.loaded.size(); i++) delete stream.loaded[i];
+    for (size_t i = 0; i < stream.resident.size(); i++) delete stream.resident[i];
+    for (size_t i = 0; i < stream.spare.size(); i++) delete stream.spare[i];
+    stream.requests.clear();
+    stream.loaded.clear();
+    stream.resident.clear();
+    stream.spare.clear();
+    closeMzbFile(stream.mzb);
+}
+
+// Decoded chunk buffers plus the slot table, i.e. what the stream holds besides the mapping
+inline size_t mapStreamBytes(const MapStream& stream) {
+    size_t buffers = stream.resident.size() + stream.spare.size() + stream.pending;
+    return buffers * sizeof(StreamChunk) + stream.slots.size() * sizeof(int32_t);
+}
+
+#endif
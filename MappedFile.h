@@ -0,0 +1,84 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+// Read-only memory mapping of a whole file
+
+#include <cstddef>
+
+#ifdef _WIN32
+ #include <windows.h>
+#else
+ #include <fcntl.h>
+ #include <sys/mman.h>
+ #include <sys/stat.h>
+ #include <unistd.h>
+#endif
+
+struct MappedFile {
+    const char* data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+};
+
+// Returns false if the file can't be opened or mapped. Empty files map to data == NULL.
+inline bool mapFile(const char* path, MappedFile& mapped) {
+    mapped.data = NULL;
+    mapped.size = 0;
+#ifdef _WIN32
+    mapped.file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    mapped.mapping = NULL;
+    if (mapped.file == INVALID_HANDLE_VALUE) return false;
+    
+    LARGE_INTEGER size;
+    GetFileSizeEx(mapped.file, &size);
+    mapped.size = (size_t)size.QuadPart;
+    if (mapped.size == 0) return true;
+    
+    mapped.mapping = CreateFileMappingA(mapped.file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapped.mapping) mapped.data = (const char*)MapViewOfFile(mapped.mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!mapped.data) {
+        if (mapped.mapping) CloseHandle(mapped.mapping);
+        CloseHandle(mapped.file);
+        return false;
+    }
+    return true;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    mapped.size = (size_t)st.st_size;
+    if (mapped.size == 0) {
+        close(fd);
+        return true;
+    }
+    
+    void* data = mmap(NULL, mapped.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);   // the mapping keeps the file referenced
+    if (data == MAP_FAILED) return false;
+    
+    mapped.data = (const char*)data;
+    return true;
+#endif
+}
+
+inline void unmapFile(MappedFile& mapped) {
+#ifdef _WIN32
+    if (mapped.data) UnmapViewOfFile(mapped.data);
+    if (mapped.mapping) CloseHandle(mapped.mapping);
+    CloseHandle(mapped.file);
+#else
+    if (mapped.data) munmap((void*)mapped.data, mapped.size);
+#endif
+    mapped.data = NULL;
+    mapped.size = 0;
+}
+
+#endif
@@ -10,7 +10,16 @@
 #include <vector>
 #include <fstream>
 #include <string>
-#include <set>
+#include <bitset>
+#include <map>
+#include <unordered_map>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <atomic>
 
 #ifdef _MSC_VER
 #define _CRT_SECURE_NO_WARNINGS
@@ -20,15 +29,16 @@
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtc/type_ptr.hpp"
+#include "glm/gtc/matrix_access.hpp"
 
-using namespace std;
+#include "Mesh.h"
+#include "Map.h"
+#include "MapBinary.h"
+#include "MapStream.h"
+#include "DistanceField.h"
+#include "Simulation.h"
 
-struct Map {
-    int width, height;
-    vector<vector<char>> grid;
-    glm::vec3 startPos;
-    glm::vec3 goalPos;
-};
+using namespace std;
 
 struct Camera {
     glm::vec3 position;
@@ -63,35 +73,114 @@ struct Camera {
 
 struct Model {
     GLuint vao;
+    GLuint vbo;
+    GLuint instanceVbo;   // per-instance model matrix and color, 0 if not instanced
     int numVertices;
+    GLuint ebo;           // index buffer, 0 for plain triangle lists
+    int numIndices;
+    GLenum indexType;
+};
+
+// Per-instance vertex attributes, tightly packed
+struct Instance {
+    glm::mat4 model;
+    glm::vec3 color;
+    glm::mat3 normalMatrix;   // inverse transpose of the model's upper 3x3
+};
+
+// Static floor and wall geometry is baked into one VBO per CHUNK_SIZE x CHUNK_SIZE cells
+const int CHUNK_SIZE = 16;
+
+// Key, door or goal cell, animated per frame
+struct Prop {
+    int x, z;
+    char cell;
+};
+
+struct Chunk {
+    int x0, z0, x1, z1;   // cells [x0, x1) x [z0, z1)
+    glm::vec3 boundsMin, boundsMax;
+    Model floor;
+    Model walls;
+    int wallCells;
+    vector<Prop> props;
+    bool dirty;
+};
+
+struct ChunkGrid {
+    int chunksX, chunksZ;
+    vector<Chunk> chunks;
+};
+
+// A linked program with its uniform and attribute locations resolved once, plus the
+// last uniform values sent to it. Values start out as NaN so the first set always goes through.
+struct ShaderProgram {
+    GLuint id;
+    GLint view, proj, lightPos, viewPos, shininess, useTexture;
+    GLint instanceModel, instanceColor, instanceNormal;
+    glm::mat4 viewValue, projValue;
+    glm::vec3 lightPosValue, viewPosValue;
+    float shininessValue;
+    int useTextureValue;
+};
+
+// Shadow of the GL state the frame loop touches, so calls that change nothing are dropped
+struct RenderState {
+    GLuint program, vao, texture;
+    glm::mat4 instanceModel;   // current values of the instance attributes
+    glm::vec3 instanceColor;
+    int calls;                 // state calls issued and dropped this frame
+    int skipped;
+};
+
+// Potentially visible set: for every open cell, the chunks that can be seen from anywhere in it
+struct PVS {
+    KeyMask openDoors;               // bit t set when doors of key type t no longer block sight
+    int words;                       // 64-bit words per chunk bitset
+    vector<int> cellSet;             // per cell index into sets, -1 where the player can't stand
+    vector<vector<uint64_t>> sets;   // unique chunk bitsets, shared by cells that see the same
+};
+
+// Planes as (normal, d), inside where dot(normal, p) + d >= 0
+struct Frustum {
+    glm::vec4 planes[6];
 };
 
 int screen_width = 800;
 int screen_height = 600;
 char window_title[] = "3D Maze Game";
 float avg_render_time = 0;
+float avg_gpu_time[2] = {0, 0};   // per normal matrix variant, see vertexSource
+int gpu_time_samples[2] = {0, 0};
 
 
+// The normal matrix comes with each instance; compiling with NORMAL_MATRIX_IN_SHADER
+// instead inverts the model matrix per vertex, which is kept for GPU time comparisons
 const GLchar* vertexSource =
-    "#version 150 core\n"
     "in vec3 position;"
     "in vec3 inColor;"
     "in vec3 inNormal;"
+    "in vec2 inTexCoord;"
+    "in mat4 instanceModel;"
+    "in vec3 instanceColor;"
+    "in mat3 instanceNormal;"
     "out vec3 Color;"
     "out vec3 normal;"
     "out vec3 fragPos;"
     "out vec2 texCoord;"
-    "uniform mat4 model;"
     "uniform mat4 view;"
     "uniform mat4 proj;"
-    "uniform vec3 objectColor;"
     "void main() {"
-    "   fragPos = vec3(model * vec4(position, 1.0));"
-    "   Color = objectColor;"
-    "   gl_Position = proj * view * model * vec4(position,1.0);"
-    "   vec4 norm4 = transpose(inverse(model)) * vec4(inNormal,1.0);"
-    "   normal = normalize(norm4.xyz);"
-    "   texCoord = position.xy + 0.5;"
+    "   fragPos = vec3(instanceModel * vec4(position, 1.0));"
+    "   Color = instanceColor;"
+    "   gl_Position = proj * view * instanceModel * vec4(position,1.0);"
+    "\n#ifdef NORMAL_MATRIX_IN_SHADER\n"
+    "   mat3 normalMatrix = mat3(transpose(inverse(instanceModel)));"
+    "\n#else\n"
+    "   mat3 normalMatrix = instanceNormal;"
+    "\n#endif\n"
+    "   normal = normalize(normalMatrix * inNormal);"
+    "   texCoord = inTexCoord;"
     "}";
      
 const GLchar* fragmentSource =
@@ -158,30 +247,24 @@ GLuint loadBMP(const char* filepath) {
     return textureID;
 }
 
-Model loadModel(const char* filepath, GLuint shaderProgram) {
-    Model model;
-    
-    ifstream file(filepath);
-    
-    int numFloats;
-    file >> numFloats;
-    
-    float* data = new float[numFloats];
-    for (int i = 0; i < numFloats; i++) {
-        file >> data[i];
+// Vertex data on the CPU as a triangle list, from the .mesh file if there is a valid one
+vector<float> readModelData(const char* filepath) {
+    MeshFile mesh;
+    if (openMeshFile(meshPath(filepath).c_str(), mesh)) {
+        vector<float> data;
+        data.reserve(mesh.header->indexCount * 8);
+        for (uint32_t i = 0; i < mesh.header->indexCount; i++) {
+            const float* v = mesh.vertices + meshIndex(mesh, i) * 8;
+            data.insert(data.end(), v, v + 8);
+        }
+        closeMeshFile(mesh);
+        return data;
     }
-    file.close();
-    
-    model.numVertices = numFloats / 8;
+    return readTextMesh(filepath);
+}
 
-    glGenVertexArrays(1, &model.vao);
-    glBindVertexArray(model.vao);
-    
-    GLuint vbo;
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, numFloats * sizeof(float), data, GL_STATIC_DRAW);
-    
+// Vertex layout: position (3), texture coordinate (2), normal (3)
+void setupVertexAttribs(GLuint shaderProgram) {
     GLint posAttrib = glGetAttribLocation(shaderProgram, "position");
     glVertexAttribPointer(posAttrib, 3, GL_FLOAT, GL_FALSE, 8*sizeof(float), 0);
     glEnableVertexAttribArray(posAttrib);
@@ -190,199 +273,927 @@ Model loadModel(const char* filepath, GLuint shaderProgram) {
     glVertexAttribPointer(colAttrib, 3, GL_FLOAT, GL_FALSE, 8*sizeof(float), (void*)(3*sizeof(float)));
     glEnableVertexAttribArray(colAttrib);
     
+    GLint texAttrib = glGetAttribLocation(shaderProgram, "inTexCoord");
+    glVertexAttribPointer(texAttrib, 2, GL_FLOAT, GL_FALSE, 8*sizeof(float), (void*)(3*sizeof(float)));
+    glEnableVertexAttribArray(texAttrib);
+    
     GLint normAttrib = glGetAttribLocation(shaderProgram, "inNormal");
     glVertexAttribPointer(normAttrib, 3, GL_FLOAT, GL_FALSE, 8*sizeof(float), (void*)(5*sizeof(float)));
     glEnableVertexAttribArray(normAttrib);
+}
+
+// Creates the VAO/VBO on first use, afterwards only re-uploads the vertex data
+void uploadModel(Model& model, const float* data, size_t numFloats, GLuint shaderProgram) {
+    if (model.vao == 0) {
+        glGenVertexArrays(1, &model.vao);
+        glBindVertexArray(model.vao);
+        glGenBuffers(1, &model.vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, model.vbo);
+        setupVertexAttribs(shaderProgram);
+    }
     
+    glBindVertexArray(model.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, model.vbo);
+    glBufferData(GL_ARRAY_BUFFER, numFloats * sizeof(float), data, GL_STATIC_DRAW);
     glBindVertexArray(0);
-    delete[] data;
     
+    model.numVertices = numFloats / 8;
+}
+
+// Adds a per-instance buffer to the model's VAO feeding instanceModel and instanceColor.
+// Models without one read these attributes from their current values (see setInstance).
+void enableInstancing(Model& model, GLuint shaderProgram) {
+    glBindVertexArray(model.vao);
+    glGenBuffers(1, &model.instanceVbo);
+    glBindBuffer(GL_ARRAY_BUFFER, model.instanceVbo);
+    
+    // A mat4 attribute takes four consecutive locations, one per column
+    GLint modelAttrib = glGetAttribLocation(shaderProgram, "instanceModel");
+    for (int i = 0; i < 4; i++) {
+        glVertexAttribPointer(modelAttrib + i, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(i * sizeof(glm::vec4)));
+        glEnableVertexAttribArray(modelAttrib + i);
+        glVertexAttribDivisor(modelAttrib + i, 1);
+    }
+    
+    GLint colorAttrib = glGetAttribLocation(shaderProgram, "instanceColor");
+    glVertexAttribPointer(colorAttrib, 3, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)offsetof(Instance, color));
+    glEnableVertexAttribArray(colorAttrib);
+    glVertexAttribDivisor(colorAttrib, 1);
+    
+    GLint normalAttrib = glGetAttribLocation(shaderProgram, "instanceNormal");
+    for (int i = 0; i < 3; i++) {
+        glVertexAttribPointer(normalAttrib + i, 3, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                              (void*)(offsetof(Instance, normalMatrix) + i * sizeof(glm::vec3)));
+        glEnableVertexAttribArray(normalAttrib + i);
+        glVertexAttribDivisor(normalAttrib + i, 1);
+    }
+    
+    glBindVertexArray(0);
+}
+
+void deleteModel(Model& model) {
+    if (model.vao) glDeleteVertexArrays(1, &model.vao);
+    if (model.vbo) glDeleteBuffers(1, &model.vbo);
+    if (model.instanceVbo) glDeleteBuffers(1, &model.instanceVbo);
+    if (model.ebo) glDeleteBuffers(1, &model.ebo);
+    model = Model();
+}
+
+void uploadIndices(Model& model, const void* indices, int numIndices, GLenum indexType) {
+    glBindVertexArray(model.vao);
+    glGenBuffers(1, &model.ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model.ebo);
+    int indexSize = indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, (size_t)numIndices * indexSize, indices, GL_STATIC_DRAW);
+    glBindVertexArray(0);
+    
+    model.numIndices = numIndices;
+    model.indexType = indexType;
+}
+
+Model loadModel(const char* filepath, GLuint shaderProgram) {
+    Model model = Model();
+    Uint32 t_start = SDL_GetTicks();
+    
+    // The mapped vertices and indices go straight to GL; without a .mesh the text file
+    // is parsed and indexed the same way modelc does it
+    string binaryPath = meshPath(filepath);
+    MeshFile mesh;
+    if (openMeshFile(binaryPath.c_str(), mesh)) {
+        uploadModel(model, mesh.vertices, (size_t)mesh.header->vertexCount * 8, shaderProgram);
+        uploadIndices(model, mesh.indices, mesh.header->indexCount,
+                      mesh.header->indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT);
+        closeMeshFile(mesh);
+        printf("Loaded %s (%d vertices, %d indices) in %u ms\n", binaryPath.c_str(),
+               model.numVertices, model.numIndices, SDL_GetTicks() - t_start);
+    } else {
+        IndexedMesh indexed = buildIndexedMesh(readTextMesh(filepath));
+        uploadModel(model, indexed.vertices.data(), indexed.vertices.size(), shaderProgram);
+        uploadIndices(model, indexed.indices.data(), indexed.indices.size(), GL_UNSIGNED_INT);
+        printf("Loaded %s (%d vertices, %d indices) in %u ms, run modelc for faster loading\n", filepath,
+               model.numVertices, model.numIndices, SDL_GetTicks() - t_start);
+    }
+    
+    enableInstancing(model, shaderProgram);
     return model;
 }
 
-Map loadMap(const string& filename) {
-    Map map;
-    ifstream file(filename);
+Instance makeInstance(glm::mat4 model, glm::vec3 color) {
+    Instance instance;
+    instance.model = model;
+    instance.color = color;
+    instance.normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+    return instance;
+}
+
+ShaderProgram resolveProgram(GLuint id) {
+    ShaderProgram program;
+    program.id = id;
+    program.view = glGetUniformLocation(id, "view");
+    program.proj = glGetUniformLocation(id, "proj");
+    program.lightPos = glGetUniformLocation(id, "lightPos");
+    program.viewPos = glGetUniformLocation(id, "viewPos");
+    program.shininess = glGetUniformLocation(id, "shininess");
+    program.useTexture = glGetUniformLocation(id, "useTexture");
+    program.instanceModel = glGetAttribLocation(id, "instanceModel");
+    program.instanceColor = glGetAttribLocation(id, "instanceColor");
+    program.instanceNormal = glGetAttribLocation(id, "instanceNormal");
     
-    file >> map.width >> map.height;
+    program.viewValue = program.projValue = glm::mat4(NAN);
+    program.lightPosValue = program.viewPosValue = glm::vec3(NAN);
+    program.shininessValue = NAN;
+    program.useTextureValue = -1;
+    return program;
+}
+
+// Nothing is known about the GL state yet, so every first call goes through
+RenderState initRenderState() {
+    RenderState state;
+    state.program = state.vao = state.texture = ~0u;
+    state.instanceModel = glm::mat4(NAN);
+    state.instanceColor = glm::vec3(NAN);
+    state.calls = state.skipped = 0;
+    return state;
+}
+
+void useProgram(RenderState& state, const ShaderProgram& program) {
+    if (state.program == program.id) { state.skipped++; return; }
+    glUseProgram(program.id);
+    state.program = program.id;
+    state.calls++;
+}
+
+void bindVertexArray(RenderState& state, GLuint vao) {
+    if (state.vao == vao) { state.skipped++; return; }
+    glBindVertexArray(vao);
+    state.vao = vao;
+    state.calls++;
+}
+
+void bindTexture(RenderState& state, GLuint texture) {
+    if (state.texture == texture) { state.skipped++; return; }
+    glBindTexture(GL_TEXTURE_2D, texture);
+    state.texture = texture;
+    state.calls++;
+}
+
+// Uniform setters for the program in use; current is that program's shadow copy
+void setUniform(RenderState& state, GLint location, float& current, float value) {
+    if (current == value) { state.skipped++; return; }
+    glUniform1f(location, value);
+    current = value;
+    state.calls++;
+}
+
+void setUniform(RenderState& state, GLint location, int& current, int value) {
+    if (current == value) { state.skipped++; return; }
+    glUniform1i(location, value);
+    current = value;
+    state.calls++;
+}
+
+void setUniform(RenderState& state, GLint location, glm::vec3& current, glm::vec3 value) {
+    if (current == value) { state.skipped++; return; }
+    glUniform3fv(location, 1, glm::value_ptr(value));
+    current = value;
+    state.calls++;
+}
+
+void setUniform(RenderState& state, GLint location, glm::mat4& current, glm::mat4 value) {
+    if (current == value) { state.skipped++; return; }
+    glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+    current = value;
+    state.calls++;
+}
+
+// Sets the instance attributes used by VAOs that have no instance buffer.
+// Current attribute values are context state, shared by both programs.
+void setInstance(RenderState& state, const ShaderProgram& program, glm::mat4 model, glm::vec3 color) {
+    if (state.instanceModel != model) {
+        for (int i = 0; i < 4; i++) {
+            glVertexAttrib4fv(program.instanceModel + i, glm::value_ptr(model[i]));
+        }
+        glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+        for (int i = 0; i < 3; i++) {
+            glVertexAttrib3fv(program.instanceNormal + i, glm::value_ptr(normalMatrix[i]));
+        }
+        state.instanceModel = model;
+        state.calls += 7;
+    } else {
+        state.skipped += 7;
+    }
     
-    map.grid.resize(map.height);
-    string line;
-    getline(file, line); // consume newline
+    if (state.instanceColor != color) {
+        glVertexAttrib3fv(program.instanceColor, glm::value_ptr(color));
+        state.instanceColor = color;
+        state.calls++;
+    } else {
+        state.skipped++;
+    }
+}
+
+// Draws all instances of an instanced model in one call
+void drawInstances(RenderState& state, const Model& model, const vector<Instance>& instances) {
+    if (instances.empty()) return;
     
-    for (int y = 0; y < map.height; y++) {
-        getline(file, line);
-        map.grid[y].resize(map.width);
-        for (int x = 0; x < map.width; x++) {
-            if (x < line.length()) {
-                map.grid[y][x] = line[x];
-                
-                if (line[x] == 'S') {
-                    map.startPos = glm::vec3(x * 2.0f, 1.0f, y * 2.0f);
-                    printf("Start found at: (%d, %d)\n", x, y);
-                }
-                if (line[x] == 'G') {
-                    map.goalPos = glm::vec3(x * 2.0f, 1.0f, y * 2.0f);
-                    printf("Goal found at: (%d, %d)\n", x, y);
+    bindVertexArray(state, model.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, model.instanceVbo);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(Instance), instances.data(), GL_STREAM_DRAW);
+    if (model.ebo)
+        glDrawElementsInstanced(GL_TRIANGLES, model.numIndices, model.indexType, 0, instances.size());
+    else
+        glDrawArraysInstanced(GL_TRIANGLES, 0, model.numVertices, instances.size());
+}
+
+// Key and door colors, indexed by key type
+vector<glm::vec3> buildKeyPalette(const vector<KeyType>& keyTypes) {
+    vector<glm::vec3> palette(keyTypes.size());
+    for (size_t t = 0; t < keyTypes.size(); t++)
+        palette[t] = glm::vec3(keyTypes[t].color[0], keyTypes[t].color[1], keyTypes[t].color[2]) / 255.0f;
+    return palette;
+}
+
+
+// Appends a copy of the cube transformed to world space
+void appendCube(vector<float>& out, const vector<float>& cube, glm::mat4 transform) {
+    glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(transform)));
+    
+    for (size_t i = 0; i + 8 <= cube.size(); i += 8) {
+        glm::vec3 p(cube[i], cube[i + 1], cube[i + 2]);
+        glm::vec3 n(cube[i + 5], cube[i + 6], cube[i + 7]);
+        glm::vec3 worldPos = glm::vec3(transform * glm::vec4(p, 1.0f));
+        glm::vec3 worldNormal = glm::normalize(normalMatrix * n);
+        
+        out.push_back(worldPos.x);
+        out.push_back(worldPos.y);
+        out.push_back(worldPos.z);
+        // Same wall texture mapping as drawing the cube on its own: object space xy + 0.5
+        out.push_back(p.x + 0.5f);
+        out.push_back(p.y + 0.5f);
+        out.push_back(worldNormal.x);
+        out.push_back(worldNormal.y);
+        out.push_back(worldNormal.z);
+    }
+}
+
+// Appends a quad spanning origin + [0, 1] * du + [0, 1] * dv, counter-clockwise around du x dv.
+// The texture repeats uLen times along du and vLen times along dv.
+void appendQuad(vector<float>& out, glm::vec3 origin, glm::vec3 du, glm::vec3 dv, float uLen, float vLen) {
+    glm::vec3 normal = glm::normalize(glm::cross(du, dv));
+    glm::vec3 corners[4] = { origin, origin + du, origin + du + dv, origin + dv };
+    glm::vec2 uvs[4] = { glm::vec2(0, 0), glm::vec2(uLen, 0), glm::vec2(uLen, vLen), glm::vec2(0, vLen) };
+    int order[6] = { 0, 1, 2, 0, 2, 3 };
+    
+    for (int i = 0; i < 6; i++) {
+        int c = order[i];
+        out.push_back(corners[c].x);
+        out.push_back(corners[c].y);
+        out.push_back(corners[c].z);
+        out.push_back(uvs[c].x);
+        out.push_back(uvs[c].y);
+        out.push_back(normal.x);
+        out.push_back(normal.y);
+        out.push_back(normal.z);
+    }
+}
+
+// The chunk builders read cells through any grid with inBounds and cell: the whole Map,
+// or a MapStream whose missing chunks read as walls
+
+// Cells outside the map count as walls so the outer faces of the border are dropped
+template <typename Grid>
+bool isWallCell(const Grid& map, int x, int z) {
+    if (x < 0 || x >= map.width || z < 0 || z >= map.height) return true;
+    return map.cell(x, z) == 'W';
+}
+
+// Walls fill their whole 2x2 cell and are 2 high. Only faces that border a non-wall cell
+// are emitted, bottoms are dropped (they sit on the floor) and coplanar runs are merged.
+// Returns the number of wall cells in the chunk.
+template <typename Grid>
+int buildWallMesh(const Chunk& chunk, const Grid& map, vector<float>& out) {
+    const float h = 2.0f;
+    int wallCells = 0;
+    
+    // Faces along x (normals -z/+z), merged into runs along each row
+    for (int z = chunk.z0; z < chunk.z1; z++) {
+        for (int side = -1; side <= 1; side += 2) {
+            int x = chunk.x0;
+            while (x < chunk.x1) {
+                if (!isWallCell(map, x, z) || isWallCell(map, x, z + side)) { x++; continue; }
+                int start = x;
+                while (x < chunk.x1 && isWallCell(map, x, z) && !isWallCell(map, x, z + side)) x++;
+                float len = (float)(x - start);
+                float faceZ = z * 2.0f + side;
+                if (side > 0)
+                    appendQuad(out, glm::vec3(start * 2.0f - 1.0f, 0, faceZ), glm::vec3(len * 2.0f, 0, 0), glm::vec3(0, h, 0), len, 1.0f);
+                else
+                    appendQuad(out, glm::vec3(x * 2.0f - 1.0f, 0, faceZ), glm::vec3(-len * 2.0f, 0, 0), glm::vec3(0, h, 0), len, 1.0f);
+            }
+        }
+    }
+    
+    // Faces along z (normals -x/+x), merged into runs along each column
+    for (int x = chunk.x0; x < chunk.x1; x++) {
+        for (int side = -1; side <= 1; side += 2) {
+            int z = chunk.z0;
+            while (z < chunk.z1) {
+                if (!isWallCell(map, x, z) || isWallCell(map, x + side, z)) { z++; continue; }
+                int start = z;
+                while (z < chunk.z1 && isWallCell(map, x, z) && !isWallCell(map, x + side, z)) z++;
+                float len = (float)(z - start);
+                float faceX = x * 2.0f + side;
+                if (side > 0)
+                    appendQuad(out, glm::vec3(faceX, 0, z * 2.0f - 1.0f), glm::vec3(0, 0, -len * 2.0f), glm::vec3(0, h, 0), len, 1.0f);
+                else
+                    appendQuad(out, glm::vec3(faceX, 0, start * 2.0f - 1.0f), glm::vec3(0, 0, len * 2.0f), glm::vec3(0, h, 0), len, 1.0f);
+            }
+        }
+    }
+    
+    // Tops, greedily merged into rectangles
+    int w = chunk.x1 - chunk.x0;
+    int d = chunk.z1 - chunk.z0;
+    vector<bool> used(w * d, false);
+    for (int z = chunk.z0; z < chunk.z1; z++) {
+        for (int x = chunk.x0; x < chunk.x1; x++) {
+            if (!isWallCell(map, x, z)) continue;
+            wallCells++;
+            if (used[(z - chunk.z0) * w + (x - chunk.x0)]) continue;
+            
+            int x1 = x + 1;
+            while (x1 < chunk.x1 && isWallCell(map, x1, z) && !used[(z - chunk.z0) * w + (x1 - chunk.x0)]) x1++;
+            
+            int z1 = z + 1;
+            bool grow = true;
+            while (grow && z1 < chunk.z1) {
+                for (int i = x; i < x1; i++) {
+                    if (!isWallCell(map, i, z1) || used[(z1 - chunk.z0) * w + (i - chunk.x0)]) { grow = false; break; }
                 }
+                if (grow) z1++;
             }
+            
+            for (int j = z; j < z1; j++)
+                for (int i = x; i < x1; i++)
+                    used[(j - chunk.z0) * w + (i - chunk.x0)] = true;
+            
+            float lenX = (float)(x1 - x);
+            float lenZ = (float)(z1 - z);
+            appendQuad(out, glm::vec3(x * 2.0f - 1.0f, h, z1 * 2.0f - 1.0f), glm::vec3(lenX * 2.0f, 0, 0), glm::vec3(0, 0, -lenZ * 2.0f), lenX, lenZ);
         }
     }
     
-    file.close();
-    return map;
+    return wallCells;
+}
+
+bool isProp(char cell) {
+    return isKeyCell(cell) || isDoorCell(cell) || cell == 'G';
+}
+
+// Sets the cell range and bounds of an empty chunk
+void initChunk(Chunk& chunk, int x0, int z0, int x1, int z1) {
+    chunk.x0 = x0;
+    chunk.z0 = z0;
+    chunk.x1 = x1;
+    chunk.z1 = z1;
+    // Floor slabs reach down to -0.05, walls and props up to about 2.5
+    chunk.boundsMin = glm::vec3(x0 * 2.0f - 1.0f, -0.1f, z0 * 2.0f - 1.0f);
+    chunk.boundsMax = glm::vec3(x1 * 2.0f - 1.0f, 2.5f, z1 * 2.0f - 1.0f);
+    chunk.floor = Model();
+    chunk.walls = Model();
+    chunk.props.clear();
+    chunk.dirty = true;
 }
 
-glm::vec3 getKeyColor(char keyLetter) {
-    switch(keyLetter) {
-        case 'a': case 'A': return glm::vec3(1.0f, 0.0f, 0.0f); // Red
-        case 'b': case 'B': return glm::vec3(0.0f, 1.0f, 0.0f); // Green
-        case 'c': case 'C': return glm::vec3(0.0f, 0.5f, 1.0f); // Blue
-        case 'd': case 'D': return glm::vec3(1.0f, 1.0f, 0.0f); // Yellow
-        case 'e': case 'E': return glm::vec3(1.0f, 0.0f, 1.0f); // Magenta
-        default: return glm::vec3(1.0f, 1.0f, 1.0f);
+template <typename Grid>
+void buildChunk(Chunk& chunk, const Grid& map, const vector<float>& cube, GLuint shaderProgram) {
+    vector<float> floorData;
+    vector<float> wallData;
+    chunk.props.clear();
+    
+    for (int z = chunk.z0; z < chunk.z1; z++) {
+        for (int x = chunk.x0; x < chunk.x1; x++) {
+            char cell = map.cell(x, z);
+            if (isProp(cell)) {
+                Prop prop = { x, z, cell };
+                chunk.props.push_back(prop);
+            }
+        }
+    }
+    
+    // One slab under the whole chunk; only its top is ever seen and lighting is per fragment
+    glm::vec3 center(chunk.x0 + chunk.x1 - 1.0f, 0.0f, chunk.z0 + chunk.z1 - 1.0f);
+    glm::mat4 floorModel = glm::translate(glm::mat4(1), center);
+    floorModel = glm::scale(floorModel, glm::vec3((chunk.x1 - chunk.x0) * 2.0f, 0.1f, (chunk.z1 - chunk.z0) * 2.0f));
+    appendCube(floorData, cube, floorModel);
+    
+    chunk.wallCells = buildWallMesh(chunk, map, wallData);
+    
+    uploadModel(chunk.floor, floorData.data(), floorData.size(), shaderProgram);
+    uploadModel(chunk.walls, wallData.data(), wallData.size(), shaderProgram);
+    chunk.dirty = false;
+}
+
+ChunkGrid buildChunkGrid(const Map& map, const vector<float>& cube, GLuint shaderProgram) {
+    ChunkGrid grid;
+    grid.chunksX = (map.width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    grid.chunksZ = (map.height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    grid.chunks.resize(grid.chunksX * grid.chunksZ);
+    
+    for (int cz = 0; cz < grid.chunksZ; cz++) {
+        for (int cx = 0; cx < grid.chunksX; cx++) {
+            Chunk& chunk = grid.chunks[cz * grid.chunksX + cx];
+            initChunk(chunk, cx * CHUNK_SIZE, cz * CHUNK_SIZE,
+                      min((cx + 1) * CHUNK_SIZE, map.width), min((cz + 1) * CHUNK_SIZE, map.height));
+            buildChunk(chunk, map, cube, shaderProgram);
+        }
+    }
+    
+    printf("Baked %dx%d cells into %d chunks\n", map.width, map.height, (int)grid.chunks.size());
+    
+    // A full cube per wall cell is 12 triangles
+    int wallCells = 0;
+    int wallTriangles = 0;
+    for (size_t i = 0; i < grid.chunks.size(); i++) {
+        wallCells += grid.chunks[i].wallCells;
+        wallTriangles += grid.chunks[i].walls.numVertices / 3;
     }
+    int cubeTriangles = wallCells * 12;
+    printf("Wall mesh: %d walls, %d triangles as cubes, %d after face culling and merging (%.1f%% fewer)\n",
+           wallCells, cubeTriangles, wallTriangles,
+           cubeTriangles > 0 ? 100.0f * (cubeTriangles - wallTriangles) / cubeTriangles : 0.0f);
+    return grid;
 }
 
+void markCellDirty(ChunkGrid& grid, int x, int z) {
+    grid.chunks[(z / CHUNK_SIZE) * grid.chunksX + x / CHUNK_SIZE].dirty = true;
+}
 
-bool checkCollision(const Map& map, glm::vec3 pos, const set<char>& keys) {
-    // Check center position
-    int gridX = (int)(pos.x / 2.0f + 0.5f);
-    int gridZ = (int)(pos.z / 2.0f + 0.5f);
+// Rebuilds only the chunks whose cells changed since they were last baked.
+// Returns how many were rebuilt.
+int updateDirtyChunks(ChunkGrid& grid, const Map& map, const vector<float>& cube, GLuint shaderProgram) {
+    int rebuilt = 0;
+    for (size_t i = 0; i < grid.chunks.size(); i++) {
+        if (grid.chunks[i].dirty) {
+            buildChunk(grid.chunks[i], map, cube, shaderProgram);
+            rebuilt++;
+        }
+    }
+    return rebuilt;
+}
+
+
+// Streamed maps get one render chunk per resident map chunk, keyed by chunk index.
+// Compiled maps above STREAM_MIN_CELLS are streamed instead of loaded whole.
+const uint64_t STREAM_MIN_CELLS = 4096ull * 4096ull;
+const int STREAM_BAKES_PER_FRAME = 4;   // spreads a burst of arrivals over several frames
+
+// Frees the meshes of chunks the last update evicted and bakes new or edited ones,
+// nearest first. Returns how many were baked.
+int syncStreamedChunks(unordered_map<int, Chunk>& chunks, MapStream& stream, const vector<float>& cube, GLuint shaderProgram) {
+    for (size_t i = 0; i < stream.evicted.size(); i++) {
+        unordered_map<int, Chunk>::iterator it = chunks.find(stream.evicted[i]);
+        if (it == chunks.end()) continue;
+        deleteModel(it->second.floor);
+        deleteModel(it->second.walls);
+        chunks.erase(it);
+    }
     
-    if (gridX < 0 || gridX >= map.width || gridZ < 0 || gridZ >= map.height)
-        return true;
+    vector<pair<int, StreamChunk*>> changed;
+    for (size_t i = 0; i < stream.resident.size(); i++) {
+        StreamChunk* resChunk = stream.resident[i];
+        int distance = max(abs(resChunk->cx - stream.centerX), abs(resChunk->cz - stream.centerZ));
+        if (resChunk->changed) changed.push_back(make_pair(distance, resChunk));
+    }
+    sort(changed.begin(), changed.end());
     
-    char cell = map.grid[gridZ][gridX];
+    int baked = 0;
+    for (; baked < (int)changed.size() && baked < STREAM_BAKES_PER_FRAME; baked++) {
+        StreamChunk& resChunk = *changed[baked].second;
+        int index = resChunk.cz * stream.chunksX + resChunk.cx;
+        unordered_map<int, Chunk>::iterator it = chunks.find(index);
+        if (it == chunks.end()) {
+            it = chunks.insert(make_pair(index, Chunk())).first;
+            initChunk(it->second, resChunk.x0, resChunk.z0, resChunk.x1, resChunk.z1);
+        }
+        buildChunk(it->second, stream, cube, shaderProgram);
+        resChunk.changed = false;
+    }
+    return baked;
+}
+
+// Gribb-Hartmann plane extraction from the rows of proj * view
+Frustum extractFrustum(glm::mat4 viewProj) {
+    glm::vec4 r0 = glm::row(viewProj, 0);
+    glm::vec4 r1 = glm::row(viewProj, 1);
+    glm::vec4 r2 = glm::row(viewProj, 2);
+    glm::vec4 r3 = glm::row(viewProj, 3);
     
+    Frustum frustum;
+    frustum.planes[0] = r3 + r0; // left
+    frustum.planes[1] = r3 - r0; // right
+    frustum.planes[2] = r3 + r1; // bottom
+    frustum.planes[3] = r3 - r1; // top
+    frustum.planes[4] = r3 + r2; // near
+    frustum.planes[5] = r3 - r2; // far
+    return frustum;
+}
+
+// An AABB is outside if its corner furthest along a plane normal is still behind that plane
+bool isBoxVisible(const Frustum& frustum, glm::vec3 boxMin, glm::vec3 boxMax) {
+    for (int i = 0; i < 6; i++) {
+        glm::vec4 plane = frustum.planes[i];
+        glm::vec3 farthest(plane.x >= 0 ? boxMax.x : boxMin.x,
+                           plane.y >= 0 ? boxMax.y : boxMin.y,
+                           plane.z >= 0 ? boxMax.z : boxMin.z);
+        if (glm::dot(glm::vec3(plane), farthest) + plane.w < 0) return false;
+    }
+    return true;
+}
+
+// Rays only need to reach the far plane (100 units)
+const int PVS_RANGE = 50;
+const int PVS_MAX_CELLS = 512 * 512;   // larger maps are culled by the frustum alone
+
+bool blocksSight(char cell, KeyMask openDoors) {
     if (cell == 'W') return true;
+    if (isDoorCell(cell)) return !((openDoors >> cellKeyType(cell)) & 1);
+    return false;
+}
+
+// Marks the chunks crossed by the segment from -> to (in cells, cell centers on integers)
+// visible, up to and including the first cell that blocks sight. The distance field finds
+// that cell, jumping over open space, then the chunks are walked CHUNK_SIZE cells per step.
+void castVisibilityRay(const ChunkGrid& chunks, const DistanceField& field,
+                       glm::vec2 from, glm::vec2 to, vector<uint64_t>& bits) {
+    glm::vec2 d = to - from;
+    float end = traceField(field, from, to);
+    if (end < 1.0f) end = min(1.0f, end + 1e-4f / max(glm::length(d), 1.0f));   // into the blocker
+    
+    // Shift and scale so that chunk (x, z) covers [x, x + 1)
+    glm::vec2 p = (from + 0.5f) / (float)CHUNK_SIZE;
+    d /= (float)CHUNK_SIZE;
+    int x = (int)floor(p.x);
+    int z = (int)floor(p.y);
+    int stepX = d.x > 0 ? 1 : -1;
+    int stepZ = d.y > 0 ? 1 : -1;
+    float tDeltaX = d.x != 0 ? fabs(1.0f / d.x) : INFINITY;
+    float tDeltaZ = d.y != 0 ? fabs(1.0f / d.y) : INFINITY;
+    float tMaxX = d.x != 0 ? (d.x > 0 ? x + 1 - p.x : p.x - x) * tDeltaX : INFINITY;
+    float tMaxZ = d.y != 0 ? (d.y > 0 ? z + 1 - p.y : p.y - z) * tDeltaZ : INFINITY;
     
-    if (cell >= 'A' && cell <= 'E') {
-        char requiredKey = cell - 'A' + 'a';
-        if (keys.find(requiredKey) == keys.end()) {
-            return true; // Door is locked
+    while (x >= 0 && x < chunks.chunksX && z >= 0 && z < chunks.chunksZ) {
+        int chunk = z * chunks.chunksX + x;
+        bits[chunk >> 6] |= 1ull << (chunk & 63);
+        if (tMaxX > end && tMaxZ > end) return;
+        
+        if (tMaxX < tMaxZ) {
+            x += stepX;
+            tMaxX += tDeltaX;
+        } else {
+            z += stepZ;
+            tMaxZ += tDeltaZ;
         }
     }
+}
+
+// From the center and four corners of each open cell, cast rays to every cell on the
+// square of radius PVS_RANGE around it. The doors open in the field are open. Only the
+// grid's chunk counts are used, and it gives up between rows once cancel is set.
+PVS buildPVS(const Map& map, const ChunkGrid& chunks, const DistanceField& field, const atomic<bool>& cancel) {
+    KeyMask openDoors = field.keys;
+    PVS pvs;
+    pvs.openDoors = openDoors;
+    pvs.words = (chunks.chunksX * chunks.chunksZ + 63) / 64;
+    pvs.cellSet.assign((size_t)map.width * map.height, -1);
     
-    // Check collision in a small radius around player 
-    float radius = 0.3f;
-    float cellSize = 2.0f;
-    
-    // Check 4 corners around player
-    glm::vec3 offsets[] = {
-        glm::vec3(radius, 0, radius),
-        glm::vec3(-radius, 0, radius),
-        glm::vec3(radius, 0, -radius),
-        glm::vec3(-radius, 0, -radius)
+    const glm::vec2 samples[5] = {
+        glm::vec2(0, 0), glm::vec2(-0.45f, -0.45f), glm::vec2(0.45f, -0.45f),
+        glm::vec2(-0.45f, 0.45f), glm::vec2(0.45f, 0.45f)
     };
     
-    for (int i = 0; i < 4; i++) {
-        glm::vec3 checkPos = pos + offsets[i];
-        int checkX = (int)(checkPos.x / cellSize + 0.5f);
-        int checkZ = (int)(checkPos.z / cellSize + 0.5f);
-        
-        if (checkX < 0 || checkX >= map.width || checkZ < 0 || checkZ >= map.height)
-            return true;
+    std::map<vector<uint64_t>, int> unique;
+    vector<uint64_t> bits(pvs.words);
+    
+    for (int z = 0; z < map.height && !cancel; z++) {
+        for (int x = 0; x < map.width; x++) {
+            if (blocksSight(map.cell(x, z), openDoors)) continue;
+            
+            fill(bits.begin(), bits.end(), 0);
+            glm::vec2 cell((float)x, (float)z);
+            for (int s = 0; s < 5; s++) {
+                glm::vec2 from = cell + samples[s];
+                for (int i = -PVS_RANGE; i <= PVS_RANGE; i++) {
+                    castVisibilityRay(chunks, field, from, cell + glm::vec2(i, -PVS_RANGE), bits);
+                    castVisibilityRay(chunks, field, from, cell + glm::vec2(i, PVS_RANGE), bits);
+                    castVisibilityRay(chunks, field, from, cell + glm::vec2(-PVS_RANGE, i), bits);
+                    castVisibilityRay(chunks, field, from, cell + glm::vec2(PVS_RANGE, i), bits);
+                }
+            }
+            
+            std::map<vector<uint64_t>, int>::iterator it = unique.find(bits);
+            if (it == unique.end()) {
+                it = unique.insert(make_pair(bits, (int)pvs.sets.size())).first;
+                pvs.sets.push_back(bits);
+            }
+            pvs.cellSet[z * map.width + x] = it->second;
+        }
+    }
+    
+    return pvs;
+}
+
+// FNV-1a over what blocks sight, so a cache written for a different map is never used.
+// Other cells count as floor: picking up a key edits the map, but the cache stays good.
+uint64_t hashMap(const Map& map) {
+    uint64_t hash = 14695981039346656037ull;
+    int dims[3] = { map.width, map.height, CHUNK_SIZE };
+    const unsigned char* bytes = (const unsigned char*)dims;
+    for (size_t i = 0; i < sizeof(dims); i++) hash = (hash ^ bytes[i]) * 1099511628211ull;
+    for (size_t i = 0; i < map.cells.size(); i++) {
+        char cell = map.cells[i];
+        if (cell != 'W' && !isDoorCell(cell)) cell = '0';
+        hash = (hash ^ (unsigned char)cell) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Cache layout, all little endian:
+//   "MPVS" version hash entryCount
+//   per entry: openDoors (64 bits) words setCount runCount
+//              cell runs (setIndex, length), covering the grid row by row
+//              per set: nonZeroCount then (wordIndex, word) pairs
+const uint32_t PVS_VERSION = 2;
+
+void savePVSCache(const string& path, const Map& map, const vector<PVS>& cache) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        printf("Could not write PVS cache %s\n", path.c_str());
+        return;
+    }
+    
+    uint64_t hash = hashMap(map);
+    uint32_t count = cache.size();
+    fwrite("MPVS", 1, 4, file);
+    fwrite(&PVS_VERSION, sizeof(PVS_VERSION), 1, file);
+    fwrite(&hash, sizeof(hash), 1, file);
+    fwrite(&count, sizeof(count), 1, file);
+    
+    for (size_t e = 0; e < cache.size(); e++) {
+        const PVS& pvs = cache[e];
         
-        char checkCell = map.grid[checkZ][checkX];
+        vector<int32_t> runs;
+        for (size_t i = 0; i < pvs.cellSet.size(); ) {
+            size_t j = i;
+            while (j < pvs.cellSet.size() && pvs.cellSet[j] == pvs.cellSet[i]) j++;
+            runs.push_back(pvs.cellSet[i]);
+            runs.push_back(j - i);
+            i = j;
+        }
         
-        if (checkCell == 'W') return true;
+        int32_t header[3] = { pvs.words, (int32_t)pvs.sets.size(), (int32_t)runs.size() / 2 };
+        fwrite(&pvs.openDoors, sizeof(pvs.openDoors), 1, file);
+        fwrite(header, sizeof(int32_t), 3, file);
+        fwrite(runs.data(), sizeof(int32_t), runs.size(), file);
         
-        if (checkCell >= 'A' && checkCell <= 'E') {
-            char requiredKey = checkCell - 'A' + 'a';
-            if (keys.find(requiredKey) == keys.end()) {
-                return true;
+        for (size_t s = 0; s < pvs.sets.size(); s++) {
+            const vector<uint64_t>& bits = pvs.sets[s];
+            int32_t nonZero = bits.size() - count_if(bits.begin(), bits.end(), [](uint64_t w) { return w == 0; });
+            fwrite(&nonZero, sizeof(nonZero), 1, file);
+            for (int32_t w = 0; w < (int32_t)bits.size(); w++) {
+                if (bits[w] == 0) continue;
+                fwrite(&w, sizeof(w), 1, file);
+                fwrite(&bits[w], sizeof(uint64_t), 1, file);
             }
         }
     }
     
-    return false;
+    fclose(file);
 }
 
-void checkKeyPickup(Map& map, glm::vec3 pos, set<char>& keys) {
-    int gridX = (int)(pos.x / 2.0f + 0.5f);
-    int gridZ = (int)(pos.z / 2.0f + 0.5f);
+// Returns false (leaving cache empty) when the file is missing, stale or damaged
+bool loadPVSCache(const string& path, const Map& map, const ChunkGrid& chunks, vector<PVS>& cache) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return false;
     
-    if (gridX < 0 || gridX >= map.width || gridZ < 0 || gridZ >= map.height)
-        return;
+    char magic[4];
+    uint32_t version, count;
+    uint64_t hash;
+    bool ok = fread(magic, 1, 4, file) == 4 && memcmp(magic, "MPVS", 4) == 0 &&
+              fread(&version, sizeof(version), 1, file) == 1 && version == PVS_VERSION &&
+              fread(&hash, sizeof(hash), 1, file) == 1 && hash == hashMap(map) &&
+              fread(&count, sizeof(count), 1, file) == 1;
     
-    char cell = map.grid[gridZ][gridX];
+    size_t cells = (size_t)map.width * map.height;
+    int words = (chunks.chunks.size() + 63) / 64;
+    for (uint32_t e = 0; ok && e < count; e++) {
+        PVS pvs;
+        int32_t header[3];
+        ok = fread(&pvs.openDoors, sizeof(pvs.openDoors), 1, file) == 1 &&
+             fread(header, sizeof(int32_t), 3, file) == 3 && header[0] == words && header[1] >= 0 && header[2] >= 0;
+        if (!ok) break;
+        pvs.words = words;
+        
+        vector<int32_t> runs(header[2] * 2);
+        ok = fread(runs.data(), sizeof(int32_t), runs.size(), file) == runs.size();
+        for (size_t r = 0; ok && r < runs.size(); r += 2) {
+            ok = runs[r] >= -1 && runs[r] < header[1] && runs[r + 1] > 0 &&
+                 pvs.cellSet.size() + (size_t)runs[r + 1] <= cells;
+            if (ok) pvs.cellSet.insert(pvs.cellSet.end(), runs[r + 1], runs[r]);
+        }
+        ok = ok && pvs.cellSet.size() == cells;
+        
+        pvs.sets.resize(header[1], vector<uint64_t>(words, 0));
+        for (int s = 0; ok && s < header[1]; s++) {
+            int32_t nonZero;
+            ok = fread(&nonZero, sizeof(nonZero), 1, file) == 1 && nonZero >= 0 && nonZero <= words;
+            for (int32_t i = 0; ok && i < nonZero; i++) {
+                int32_t w;
+                uint64_t bits;
+                ok = fread(&w, sizeof(w), 1, file) == 1 && w >= 0 && w < words &&
+                     fread(&bits, sizeof(bits), 1, file) == 1;
+                if (ok) pvs.sets[s][w] = bits;
+            }
+        }
+        
+        if (ok) cache.push_back(pvs);
+    }
+    
+    fclose(file);
+    if (!ok) cache.clear();
+    return ok;
+}
+
+// One PVS built at a time on a worker thread, so the frame loop never waits for one
+struct PVSBuilder {
+    thread worker;
+    bool running;
+    atomic<bool> done, cancel;
+    Uint32 startTicks;
+    PVS result;
+};
+
+// Starts building the PVS for the doors open in field, from copies of the map and field so
+// the game can go on picking up keys and opening doors meanwhile
+void startPVSBuild(PVSBuilder& builder, const Map& map, const ChunkGrid& chunks, const DistanceField& field) {
+    ChunkGrid grid;
+    grid.chunksX = chunks.chunksX;
+    grid.chunksZ = chunks.chunksZ;
+    builder.running = true;
+    builder.done = false;
+    builder.cancel = false;
+    builder.startTicks = SDL_GetTicks();
+    builder.worker = thread([&builder, map, grid, field]() {
+        builder.result = buildPVS(map, grid, field, builder.cancel);
+        builder.done = true;
+    });
+}
+
+void stopPVSBuild(PVSBuilder& builder) {
+    if (!builder.running) return;
+    builder.cancel = true;
+    builder.worker.join();
+    builder.running = false;
+}
+
+// Returns the PVS for the doors that are currently open, or NULL while it is being built in
+// the background (or for maps over PVS_MAX_CELLS), when the frustum alone culls. Finished
+// builds are added to the cache and saved.
+const PVS* getPVS(vector<PVS>& cache, PVSBuilder& builder, const Map& map, const ChunkGrid& chunks,
+                  const DistanceField& field, const string& cachePath) {
+    if (builder.running && builder.done) {
+        builder.worker.join();
+        builder.running = false;
+        cache.push_back(PVS());
+        swap(cache.back(), builder.result);
+        printf("Computed PVS for open doors 0x%llx: %d unique sets in %u ms\n",
+               (unsigned long long)cache.back().openDoors, (int)cache.back().sets.size(),
+               SDL_GetTicks() - builder.startTicks);
+        savePVSCache(cachePath, map, cache);
+    }
     
-    if (cell >= 'a' && cell <= 'e') {
-        keys.insert(cell);
-        map.grid[gridZ][gridX] = '0';
-        printf("Picked up key: %c\n", cell);
+    KeyMask openDoors = field.keys;
+    for (size_t i = 0; i < cache.size(); i++) {
+        if (cache[i].openDoors == openDoors) return &cache[i];
     }
+    if (!builder.running && (size_t)map.width * map.height <= PVS_MAX_CELLS) startPVSBuild(builder, map, chunks, field);
+    return NULL;
 }
 
-bool checkWin(const Map& map, glm::vec3 pos) {
+bool isChunkInPVS(const PVS& pvs, const Map& map, glm::vec3 pos, int chunk) {
     int gridX = (int)(pos.x / 2.0f + 0.5f);
     int gridZ = (int)(pos.z / 2.0f + 0.5f);
     
-    if (gridX < 0 || gridX >= map.width || gridZ < 0 || gridZ >= map.height)
-        return false;
+    // No data outside the map or inside a wall, so draw everything
+    if (gridX < 0 || gridX >= map.width || gridZ < 0 || gridZ >= map.height) return true;
+    int set = pvs.cellSet[gridZ * map.width + gridX];
+    if (set < 0) return true;
     
-    return map.grid[gridZ][gridX] == 'G';
+    return (pvs.sets[set][chunk >> 6] >> (chunk & 63)) & 1;
 }
 
-void renderDoor(GLuint shaderProgram, const Model& cubeModel, glm::mat4 baseModel, glm::vec3 color) {
-    GLint uniModel = glGetUniformLocation(shaderProgram, "model");
-    GLint uniColor = glGetUniformLocation(shaderProgram, "objectColor");
-    GLint uniUseTexture = glGetUniformLocation(shaderProgram, "useTexture");
-    
-    glUniform1i(uniUseTexture, 0);
-    glBindVertexArray(cubeModel.vao);
-    
+void addDoorInstances(vector<Instance>& instances, glm::mat4 baseModel, glm::vec3 color) {
     // Main door panel
-    glm::mat4 panel = baseModel;
-    panel = glm::scale(panel, glm::vec3(0.95f, 1.85f, 0.12f));
-    glUniform3fv(uniColor, 1, glm::value_ptr(color));
-    glUniformMatrix4fv(uniModel, 1, GL_FALSE, glm::value_ptr(panel));
-    glDrawArrays(GL_TRIANGLES, 0, cubeModel.numVertices);
+    glm::mat4 panel = glm::scale(baseModel, glm::vec3(0.95f, 1.85f, 0.12f));
+    instances.push_back(makeInstance(panel, color));
     
     // Door frame 
     glm::vec3 frameColor = color * 0.5f;
-    glUniform3fv(uniColor, 1, glm::value_ptr(frameColor));
     
     // Left frame
-    glm::mat4 leftFrame = baseModel;
-    leftFrame = glm::translate(leftFrame, glm::vec3(-0.55f, 0, 0));
+    glm::mat4 leftFrame = glm::translate(baseModel, glm::vec3(-0.55f, 0, 0));
     leftFrame = glm::scale(leftFrame, glm::vec3(0.1f, 2.0f, 0.18f));
-    glUniformMatrix4fv(uniModel, 1, GL_FALSE, glm::value_ptr(leftFrame));
-    glDrawArrays(GL_TRIANGLES, 0, cubeModel.numVertices);
+    instances.push_back(makeInstance(leftFrame, frameColor));
     
     // Right frame
-    glm::mat4 rightFrame = baseModel;
-    rightFrame = glm::translate(rightFrame, glm::vec3(0.55f, 0, 0));
+    glm::mat4 rightFrame = glm::translate(baseModel, glm::vec3(0.55f, 0, 0));
     rightFrame = glm::scale(rightFrame, glm::vec3(0.1f, 2.0f, 0.18f));
-    glUniformMatrix4fv(uniModel, 1, GL_FALSE, glm::value_ptr(rightFrame));
-    glDrawArrays(GL_TRIANGLES, 0, cubeModel.numVertices);
+    instances.push_back(makeInstance(rightFrame, frameColor));
     
     // Top frame
-    glm::mat4 topFrame = baseModel;
-    topFrame = glm::translate(topFrame, glm::vec3(0, 1.0f, 0));
+    glm::mat4 topFrame = glm::translate(baseModel, glm::vec3(0, 1.0f, 0));
     topFrame = glm::scale(topFrame, glm::vec3(1.2f, 0.1f, 0.18f));
-    glUniformMatrix4fv(uniModel, 1, GL_FALSE, glm::value_ptr(topFrame));
-    glDrawArrays(GL_TRIANGLES, 0, cubeModel.numVertices);
+    instances.push_back(makeInstance(topFrame, frameColor));
     
     // Door handle (brass/gold)
-    glUniform3f(uniColor, 0.8f, 0.6f, 0.2f);
-    glm::mat4 handle = baseModel;
-    handle = glm::translate(handle, glm::vec3(0.4f, 0, 0.12f));
+    glm::mat4 handle = glm::translate(baseModel, glm::vec3(0.4f, 0, 0.12f));
     handle = glm::scale(handle, glm::vec3(0.15f, 0.05f, 0.08f));
-    glUniformMatrix4fv(uniModel, 1, GL_FALSE, glm::value_ptr(handle));
-    glDrawArrays(GL_TRIANGLES, 0, cubeModel.numVertices);
+    instances.push_back(makeInstance(handle, glm::vec3(0.8f, 0.6f, 0.2f)));
+}
+
+// All programs share one fixed attribute layout so the same VAOs work with each of them
+GLuint createShaderProgram(const GLchar* defines) {
+    const GLchar* vertexSources[3] = { "#version 150 core\n", defines, vertexSource };
+    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vertexShader, 3, vertexSources, NULL);
+    glCompileShader(vertexShader);
+    
+    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fragmentShader, 1, &fragmentSource, NULL);
+    glCompileShader(fragmentShader);
+    
+    GLuint shaderProgram = glCreateProgram();
+    glAttachShader(shaderProgram, vertexShader);
+    glAttachShader(shaderProgram, fragmentShader);
+    glBindFragDataLocation(shaderProgram, 0, "outColor");
+    // Attribute 0 must always come from an array, never from a current value
+    glBindAttribLocation(shaderProgram, 0, "position");
+    glBindAttribLocation(shaderProgram, 1, "inTexCoord");
+    glBindAttribLocation(shaderProgram, 2, "inNormal");
+    glBindAttribLocation(shaderProgram, 3, "instanceModel");    // 3-6
+    glBindAttribLocation(shaderProgram, 7, "instanceColor");
+    glBindAttribLocation(shaderProgram, 8, "instanceNormal");   // 8-10
+    glLinkProgram(shaderProgram);
+    
+    // Flagged for deletion, freed together with the program
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+    return shaderProgram;
 }
 
 int main(int argc, char *argv[]){
     // map file is the 2nd argument
     string mapFile = argv[1]; 
-
+    
+    // Large compiled maps, or any with --stream, only keep the chunks around the player.
+    // --tick-rate sets how many times a second the player is simulated.
+    bool streaming = false;
+    int tickRate = SIM_DEFAULT_HZ;
+    for (int i = 2; i < argc; i++) {
+        if (string(argv[i]) == "--stream") streaming = true;
+        else if (string(argv[i]) == "--tick-rate" && i + 1 < argc) tickRate = max(1, atoi(argv[++i]));
+    }
+    if (!streaming && isMzbFile(mapFile.c_str())) {
+        MzbFile mzb;
+        if (openMzbFile(mapFile.c_str(), mzb)) {
+            streaming = (uint64_t)mzb.header->width * mzb.header->height > STREAM_MIN_CELLS;
+            closeMzbFile(mzb);
+        }
+    }
+    
+    Map map;
+    MapStream stream;
+    if (streaming) {
+        if (!isMzbFile(mapFile.c_str())) {
+            printf("%s: only compiled maps can be streamed, see mapc\n", mapFile.c_str());
+            return 1;
+        }
+        if (!openMapStream(mapFile.c_str(), stream)) return 1;
+        printf("Streaming %dx%d map, %d chunks resident\n", stream.width, stream.height, (int)stream.resident.size());
+    } else {
+        if (!loadMapAnyFormat(mapFile.c_str(), map)) return 1;
+        printf("Map %dx%d: start (%d, %d), goal (%d, %d), %d keys, %d doors\n", map.width, map.height,
+               worldToCell(map.startPos.x), worldToCell(map.startPos.z), worldToCell(map.goalPos.x), worldToCell(map.goalPos.z),
+               (int)map.keys.size(), (int)map.doors.size());
+    }
+    int mapWidth = streaming ? stream.width : map.width;
+    int mapHeight = streaming ? stream.height : map.height;
+    
     SDL_Init(SDL_INIT_VIDEO);
     
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 2);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
     
     SDL_Window* window = SDL_CreateWindow(window_title, 100, 100, 
                                           screen_width, screen_height, SDL_WINDOW_OPENGL);
@@ -395,23 +1206,25 @@ int main(int argc, char *argv[]){
         return -1;
     }
     
-    // Compile shaders
-    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &vertexSource, NULL);
-    glCompileShader(vertexShader);
-    
-    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &fragmentSource, NULL);
-    glCompileShader(fragmentShader);
+    // Compile shaders, [1] computes normal matrices per vertex for comparison
+    ShaderProgram programs[2] = {
+        resolveProgram(createShaderProgram("")),
+        resolveProgram(createShaderProgram("#define NORMAL_MATRIX_IN_SHADER\n"))
+    };
+    int normalVariant = 0;
+    GLuint shaderProgram = programs[normalVariant].id;
+    RenderState renderState = initRenderState();
     
-    GLuint shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glBindFragDataLocation(shaderProgram, 0, "outColor");
-    glLinkProgram(shaderProgram);
-    glUseProgram(shaderProgram);
+    // GPU timer queries, read back a few frames later to avoid stalling
+    const int NUM_QUERIES = 3;
+    GLuint gpuQueries[NUM_QUERIES];
+    int queryVariant[NUM_QUERIES];
+    glGenQueries(NUM_QUERIES, gpuQueries);
+    for (int i = 0; i < NUM_QUERIES; i++) queryVariant[i] = -1;
+    int frame = 0;
     
     // Load models
+    vector<float> cubeData = readModelData("models/cube.txt");
     Model cubeModel = loadModel("models/cube.txt", shaderProgram);
     Model teapotModel = loadModel("models/teapot.txt", shaderProgram);
     Model knotModel = loadModel("models/knot.txt", shaderProgram);
@@ -419,31 +1232,59 @@ int main(int argc, char *argv[]){
     // Load texture
     GLuint wallTexture = loadBMP("text.bmp");
     
-    // Load map from argument or default
-    Map map = loadMap(mapFile);
-    Camera camera(map.startPos);
-    set<char> collectedKeys;
+    // Whole maps are baked up front and get a distance field for movement and visibility
+    // rays. Their visibility sets are built in the background and cached next to the map
+    // file, up to PVS_MAX_CELLS; until one is ready the frustum alone culls. Streamed maps
+    // bake chunks as they arrive and rely on the frustum alone.
+    ChunkGrid chunks = ChunkGrid();
+    DistanceField field = DistanceField();
+    unordered_map<int, Chunk> streamedChunks;
+    string pvsFile = mapFile + ".pvs";
+    vector<PVS> pvsCache;
+    PVSBuilder pvsBuilder;
+    pvsBuilder.running = false;
+    if (!streaming) {
+        chunks = buildChunkGrid(map, cubeData, shaderProgram);
+        Uint32 t_field = SDL_GetTicks();
+        buildDistanceField(map, 0, field);
+        printf("Built distance field in %u ms\n", SDL_GetTicks() - t_field);
+        if ((size_t)map.width * map.height > PVS_MAX_CELLS)
+            printf("No visibility sets for maps over %d cells, culling by the frustum alone\n", PVS_MAX_CELLS);
+        else if (loadPVSCache(pvsFile, map, chunks, pvsCache))
+            printf("Loaded %d PVS entries from %s\n", (int)pvsCache.size(), pvsFile.c_str());
+    }
+    Camera camera(streaming ? stream.startPos : map.startPos);
+    SimWorld world = { &map, streaming ? NULL : &field, streaming ? &stream : NULL };
+    SimState sim = startSimulation(camera.position);
+    SimState previousSim = sim;
+    SimClock simClock = makeSimClock(tickRate);
+    vector<glm::vec3> keyPalette = buildKeyPalette(streaming ? stream.keyTypes : map.keyTypes);
     
     glEnable(GL_DEPTH_TEST);
     
     SDL_Event windowEvent;
     bool quit = false;
-    float lastTime = SDL_GetTicks() / 1000.0f;
+    Uint64 lastCounter = SDL_GetPerformanceCounter();
     
     printf("WASD: Move\n");
     printf("Mouse: Look around\n");
+    printf("N: Toggle normal matrix on CPU / in shader\n");
     printf("ESC: Exit\n");
     
     while (!quit){
         float t_start = SDL_GetTicks();
-        float currentTime = SDL_GetTicks() / 1000.0f;
-        float deltaTime = currentTime - lastTime;
-        lastTime = currentTime;
+        Uint64 counter = SDL_GetPerformanceCounter();
+        double frameSeconds = (double)(counter - lastCounter) / SDL_GetPerformanceFrequency();
+        lastCounter = counter;
         
         while (SDL_PollEvent(&windowEvent)){
             if (windowEvent.type == SDL_QUIT) quit = true;
             if (windowEvent.type == SDL_KEYUP && windowEvent.key.keysym.sym == SDLK_ESCAPE) 
                 quit = true;
+            if (windowEvent.type == SDL_KEYUP && windowEvent.key.keysym.sym == SDLK_n) {
+                normalVariant = 1 - normalVariant;
+                shaderProgram = programs[normalVariant].id;
+            }
             
             if (windowEvent.type == SDL_MOUSEMOTION) {
                 float sensitivity = 0.1f;
@@ -452,132 +1293,150 @@ int main(int argc, char *argv[]){
             }
         }
         
+        // Run the ticks this frame's time is due, then draw where the player is between
+        // the last two of them
         const Uint8* keyState = SDL_GetKeyboardState(NULL);
-        float moveSpeed = 3.0f * deltaTime;
-        
-        glm::vec3 forward = glm::normalize(glm::vec3(camera.front.x, 0, camera.front.z));
-        glm::vec3 right = glm::normalize(glm::cross(forward, camera.up));
-        
-        glm::vec3 newPos = camera.position;
-        
-        if (keyState[SDL_SCANCODE_W]) newPos += forward * moveSpeed;
-        if (keyState[SDL_SCANCODE_S]) newPos -= forward * moveSpeed;
-        if (keyState[SDL_SCANCODE_A]) newPos -= right * moveSpeed;
-        if (keyState[SDL_SCANCODE_D]) newPos += right * moveSpeed;
+        SimInput input = { camera.yaw, keyState[SDL_SCANCODE_W] != 0, keyState[SDL_SCANCODE_S] != 0,
+                           keyState[SDL_SCANCODE_A] != 0, keyState[SDL_SCANCODE_D] != 0 };
+        int ticks = advanceSimClock(simClock, frameSeconds);
+        for (int i = 0; i < ticks && !sim.won; i++) {
+            previousSim = sim;
+            if (!stepSimulation(sim, input, (float)simClock.tickSeconds, world)) continue;
+            printf("Picked up key: %c\n", (streaming ? stream.keyTypes : map.keyTypes)[sim.pickedKey].key);
+            if (!streaming) markCellDirty(chunks, worldToCell(sim.position.x), worldToCell(sim.position.z));
+        }
+        if (sim.won) {
+            printf("\n YOU WIN! \n");
+            quit = true;
+        }
+        camera.position = glm::mix(previousSim.position, sim.position, simClockAlpha(simClock));
         
-        if (!checkCollision(map, newPos, collectedKeys)) {
-            camera.position = newPos;
-            checkKeyPickup(map, camera.position, collectedKeys);
-            
-            if (checkWin(map, camera.position)) {
-                printf("\n YOU WIN! \n");
-                quit = true;
-            }
+        // Collect the GPU time of the frame that last used this query
+        int query = frame++ % NUM_QUERIES;
+        if (queryVariant[query] >= 0) {
+            GLuint64 elapsed;
+            glGetQueryObjectui64v(gpuQueries[query], GL_QUERY_RESULT, &elapsed);
+            int v = queryVariant[query];
+            float ms = elapsed / 1000000.0f;
+            avg_gpu_time[v] = gpu_time_samples[v] == 0 ? ms : .98*avg_gpu_time[v] + .02*ms;
+            gpu_time_samples[v]++;
         }
+        queryVariant[query] = normalVariant;
+        glBeginQuery(GL_TIME_ELAPSED, gpuQueries[query]);
         
         glClearColor(.1f, 0.1f, 0.15f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         
+        renderState.calls = renderState.skipped = 0;
+        ShaderProgram& program = programs[normalVariant];
+        useProgram(renderState, program);
+        
         glm::mat4 view = camera.getViewMatrix();
-        GLint uniView = glGetUniformLocation(shaderProgram, "view");
-        glUniformMatrix4fv(uniView, 1, GL_FALSE, glm::value_ptr(view));
+        setUniform(renderState, program.view, program.viewValue, view);
         
         glm::mat4 proj = glm::perspective(3.14f/4, aspect, 0.1f, 100.0f);
-        GLint uniProj = glGetUniformLocation(shaderProgram, "proj");
-        glUniformMatrix4fv(uniProj, 1, GL_FALSE, glm::value_ptr(proj));
-        
-        GLint uniModel = glGetUniformLocation(shaderProgram, "model");
-        GLint uniColor = glGetUniformLocation(shaderProgram, "objectColor");
-        GLint uniUseTexture = glGetUniformLocation(shaderProgram, "useTexture");
+        setUniform(renderState, program.proj, program.projValue, proj);
         
         // Set lighting uniforms
-        glm::vec3 lightPos(map.width, 8.0f, map.height);
-        GLint lightPosLoc = glGetUniformLocation(shaderProgram, "lightPos");
-        glUniform3fv(lightPosLoc, 1, glm::value_ptr(lightPos));
-
-        GLint viewPosLoc = glGetUniformLocation(shaderProgram, "viewPos");
-        glUniform3fv(viewPosLoc, 1, glm::value_ptr(camera.position));
-
-        GLint shininessLoc = glGetUniformLocation(shaderProgram, "shininess");
+        glm::vec3 lightPos(mapWidth, 8.0f, mapHeight);
+        setUniform(renderState, program.lightPos, program.lightPosValue, lightPos);
+        setUniform(renderState, program.viewPos, program.viewPosValue, camera.position);
         
-        // Render the map
-        for (int z = 0; z < map.height; z++) {
-            for (int x = 0; x < map.width; x++) {
-                char cell = map.grid[z][x];
-                glm::vec3 pos(x * 2.0f, 0.0f, z * 2.0f);
-                
-                // Draw floor
-                glUniform1f(shininessLoc, 8.0f);
-                glUniform1i(uniUseTexture, 0);
-                glBindVertexArray(cubeModel.vao);
-                
-                glm::mat4 floorModel = glm::translate(glm::mat4(1), pos);
-                floorModel = glm::scale(floorModel, glm::vec3(2.0f, 0.1f, 2.0f));
-                glUniform3f(uniColor, 0.3f, 0.3f, 0.3f);
-                glUniformMatrix4fv(uniModel, 1, GL_FALSE, glm::value_ptr(floorModel));
-                glDrawArrays(GL_TRIANGLES, 0, cubeModel.numVertices);
-                
-                // Draw walls with texture
-                if (cell == 'W') {
-                    glUniform1f(shininessLoc, 16.0f);
-                    glUniform1i(uniUseTexture, 1);
-                    glBindTexture(GL_TEXTURE_2D, wallTexture);
-                    glBindVertexArray(cubeModel.vao);
-                    
-                    glm::mat4 wallModel = glm::translate(glm::mat4(1), pos + glm::vec3(0, 1.0f, 0));
-                    wallModel = glm::scale(wallModel, glm::vec3(1.0f, 2.0f, 1.0f));
-                    glUniform3f(uniColor, 1.0f, 1.0f, 1.0f);
-                    glUniformMatrix4fv(uniModel, 1, GL_FALSE, glm::value_ptr(wallModel));
-                    glDrawArrays(GL_TRIANGLES, 0, cubeModel.numVertices);
-                }
+        // Rebake chunks whose cells changed (e.g. a picked up key), uploading or deleting
+        // leaves VAO 0 bound. Streamed chunks are paged in and out around the player first.
+        if (streaming) {
+            updateMapStream(stream, worldToCell(sim.position.x), worldToCell(sim.position.z));
+            if (syncStreamedChunks(streamedChunks, stream, cubeData, shaderProgram) > 0 || !stream.evicted.empty())
+                renderState.vao = 0;
+        } else if (updateDirtyChunks(chunks, map, cubeData, shaderProgram) > 0) {
+            renderState.vao = 0;
+        }
+        
+        // Skip chunks that can't be seen from the player's cell or lie outside the view frustum
+        Frustum frustum = extractFrustum(proj * view);
+        vector<const Chunk*> visibleChunks;
+        int chunkCount;
+        if (streaming) {
+            for (unordered_map<int, Chunk>::const_iterator it = streamedChunks.begin(); it != streamedChunks.end(); ++it) {
+                if (isBoxVisible(frustum, it->second.boundsMin, it->second.boundsMax))
+                    visibleChunks.push_back(&it->second);
+            }
+            chunkCount = streamedChunks.size();
+        } else {
+            const PVS* pvs = getPVS(pvsCache, pvsBuilder, map, chunks, field, pvsFile);
+            for (size_t i = 0; i < chunks.chunks.size(); i++) {
+                if ((!pvs || isChunkInPVS(*pvs, map, camera.position, i)) &&
+                    isBoxVisible(frustum, chunks.chunks[i].boundsMin, chunks.chunks[i].boundsMax))
+                    visibleChunks.push_back(&chunks.chunks[i]);
+            }
+            chunkCount = chunks.chunks.size();
+        }
+        int chunksDrawn = visibleChunks.size();
+        int chunksCulled = chunkCount - chunksDrawn;
+        
+        // Draw floors, static geometry is already in world space
+        glm::mat4 identity(1);
+        setUniform(renderState, program.shininess, program.shininessValue, 8.0f);
+        setUniform(renderState, program.useTexture, program.useTextureValue, 0);
+        setInstance(renderState, program, identity, glm::vec3(0.3f, 0.3f, 0.3f));
+        for (size_t i = 0; i < visibleChunks.size(); i++) {
+            const Model& floor = visibleChunks[i]->floor;
+            if (floor.numVertices == 0) continue;
+            bindVertexArray(renderState, floor.vao);
+            glDrawArrays(GL_TRIANGLES, 0, floor.numVertices);
+        }
+        
+        // Draw walls with texture
+        setUniform(renderState, program.shininess, program.shininessValue, 16.0f);
+        setUniform(renderState, program.useTexture, program.useTextureValue, 1);
+        bindTexture(renderState, wallTexture);
+        setInstance(renderState, program, identity, glm::vec3(1.0f, 1.0f, 1.0f));
+        for (size_t i = 0; i < visibleChunks.size(); i++) {
+            const Model& walls = visibleChunks[i]->walls;
+            if (walls.numVertices == 0) continue;
+            bindVertexArray(renderState, walls.vao);
+            glDrawArrays(GL_TRIANGLES, 0, walls.numVertices);
+        }
+        
+        // Gather the animated props, one instance list per mesh
+        float time = SDL_GetTicks() / 1000.0f;
+        vector<Instance> keyInstances;
+        vector<Instance> doorInstances;
+        vector<Instance> goalInstances;
+        for (size_t i = 0; i < visibleChunks.size(); i++) {
+            const vector<Prop>& props = visibleChunks[i]->props;
+            for (size_t p = 0; p < props.size(); p++) {
+                char cell = props[p].cell;
+                glm::vec3 pos(props[p].x * 2.0f, 0.0f, props[p].z * 2.0f);
                 
-                // Draw keys (teapots)
-                if (cell >= 'a' && cell <= 'e') {
-                    float time = SDL_GetTicks() / 1000.0f;
-                    glUniform1f(shininessLoc, 128.0f);
-                    glUniform1i(uniUseTexture, 0);
-                    glBindVertexArray(teapotModel.vao);
-                    
+                // Keys (teapots)
+                if (isKeyCell(cell)) {
                     glm::mat4 keyModel = glm::translate(glm::mat4(1), pos + glm::vec3(0, 0.8f + sin(time * 2) * 0.2f, 0));
                     keyModel = glm::rotate(keyModel, time, glm::vec3(0, 1, 0));
                     keyModel = glm::scale(keyModel, glm::vec3(0.3f, 0.3f, 0.3f));
-                    glUniform3fv(uniColor, 1, glm::value_ptr(getKeyColor(cell)));
-                    glUniformMatrix4fv(uniModel, 1, GL_FALSE, glm::value_ptr(keyModel));
-                    glDrawArrays(GL_TRIANGLES, 0, teapotModel.numVertices);
+                    keyInstances.push_back(makeInstance(keyModel, keyPalette[cellKeyType(cell)]));
                 }
                 
-                // Draw doors
-                if (cell >= 'A' && cell <= 'E') {
-                    glUniform1f(shininessLoc, 32.0f);
+                // Doors
+                if (isDoorCell(cell)) {
                     glm::mat4 doorModel = glm::translate(glm::mat4(1), pos + glm::vec3(0, 1.0f, 0));
-                    renderDoor(shaderProgram, cubeModel, doorModel, getKeyColor(cell));
+                    addDoorInstances(doorInstances, doorModel, keyPalette[cellKeyType(cell)]);
                 }
-
-                // Draw goal (knot model)
+                
+                // Goal (knot model)
                 if (cell == 'G') {
-                    float time = SDL_GetTicks() / 1000.0f;
-                    glUniform1f(shininessLoc, 128.0f);
-                    glUniform1i(uniUseTexture, 0);
-                    glBindVertexArray(knotModel.vao);
-                    
                     glm::mat4 goalModel = glm::translate(glm::mat4(1), pos + glm::vec3(0, 1.0f + sin(time * 1.5f) * 0.15f, 0));
                     goalModel = glm::rotate(goalModel, time * 0.5f, glm::vec3(0, 1, 0));
                     goalModel = glm::scale(goalModel, glm::vec3(0.4f, 0.4f, 0.4f));
-                    glUniform3f(uniColor, 1.0f, 0.8f, 0.0f);
-                    glUniformMatrix4fv(uniModel, 1, GL_FALSE, glm::value_ptr(goalModel));
-                    glDrawArrays(GL_TRIANGLES, 0, knotModel.numVertices);
+                    goalInstances.push_back(makeInstance(goalModel, glm::vec3(1.0f, 0.8f, 0.0f)));
                 }
             }
         }
         
-        // Render held key (teapot) in player's hand
-        if (!collectedKeys.empty()) {
-            float time = SDL_GetTicks() / 1000.0f;
-            char lastKey = *collectedKeys.rbegin();
-            
-            glUniform1f(shininessLoc, 128.0f);
-            glUniform1i(uniUseTexture, 0);
-            glBindVertexArray(teapotModel.vao);
+        // Held key (teapot) in player's hand, the highest type collected
+        if (sim.keys) {
+            int lastKey = MAX_KEY_TYPES - 1;
+            while (!((sim.keys >> lastKey) & 1)) lastKey--;
             
             glm::vec3 keyPos = camera.position + 
                              camera.front * 0.8f +
@@ -587,26 +1446,43 @@ int main(int argc, char *argv[]){
             glm::mat4 heldKeyModel = glm::translate(glm::mat4(1), keyPos);
             heldKeyModel = glm::rotate(heldKeyModel, time * 2.0f, glm::vec3(0, 1, 0));
             heldKeyModel = glm::scale(heldKeyModel, glm::vec3(0.2f, 0.2f, 0.2f));
-            
-            glUniform3fv(uniColor, 1, glm::value_ptr(getKeyColor(lastKey)));
-            glUniformMatrix4fv(uniModel, 1, GL_FALSE, glm::value_ptr(heldKeyModel));
-            glDrawArrays(GL_TRIANGLES, 0, teapotModel.numVertices);
+            keyInstances.push_back(makeInstance(heldKeyModel, keyPalette[lastKey]));
         }
         
+        // One draw per mesh and material
+        setUniform(renderState, program.useTexture, program.useTextureValue, 0);
+        setUniform(renderState, program.shininess, program.shininessValue, 32.0f);
+        drawInstances(renderState, cubeModel, doorInstances);
+        setUniform(renderState, program.shininess, program.shininessValue, 128.0f);
+        drawInstances(renderState, teapotModel, keyInstances);
+        drawInstances(renderState, knotModel, goalInstances);
+        
+        glEndQuery(GL_TIME_ELAPSED);
         SDL_GL_SwapWindow(window);
         
         float t_end = SDL_GetTicks();
-        char update_title[100];
+        char update_title[280];
         float time_per_frame = t_end-t_start;
         avg_render_time = .98*avg_render_time + .02*time_per_frame;
-        snprintf(update_title, sizeof(update_title), "%s [%3.0f ms] Keys: %lu", 
-                 window_title, avg_render_time, collectedKeys.size());
+        char stream_status[64] = "";
+        if (streaming)
+            snprintf(stream_status, sizeof(stream_status), " Resident: %d chunks, %zu KB",
+                     (int)stream.resident.size(), mapStreamBytes(stream) / 1024);
+        snprintf(update_title, sizeof(update_title), "%s [%3.0f ms, GPU %.2f ms %s] Keys: %d Chunks: %d drawn, %d culled GL state: %d calls, %d skipped%s", 
+                 window_title, avg_render_time, avg_gpu_time[normalVariant],
+                 normalVariant ? "normals in shader" : "normals on CPU",
+                 (int)bitset<MAX_KEY_TYPES>(sim.keys).count(), chunksDrawn, chunksCulled, renderState.calls, renderState.skipped, stream_status);
         SDL_SetWindowTitle(window, update_title);
     }
     
-    glDeleteProgram(shaderProgram);
-    glDeleteShader(fragmentShader);
-    glDeleteShader(vertexShader);
+    printf("GPU time per frame: normal matrix on CPU %.3f ms (%d frames), in shader %.3f ms (%d frames)\n",
+           avg_gpu_time[0], gpu_time_samples[0], avg_gpu_time[1], gpu_time_samples[1]);
+    
+    if (streaming) closeMapStream(stream);
+    stopPVSBuild(pvsBuilder);
+    glDeleteQueries(NUM_QUERIES, gpuQueries);
+    glDeleteProgram(programs[0].id);
+    glDeleteProgram(programs[1].id);
     
     SDL_GL_DeleteContext(context);
     SDL_Quit();
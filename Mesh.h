@@ -0,0 +1,334 @@
+#ifndef MESH_H
+#define MESH_H
+
+// Model files. The text format (models/*.txt) is a float count followed by the floats,
+// 8 per vertex: position (3), texture coordinate (2), normal (3), as a triangle soup.
+// The binary .mesh format stores the welded vertices and a cache-optimized index buffer
+// behind a header so both can be mapped and handed straight to GL.
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <unordered_map>
+#include <algorithm>
+#include "MappedFile.h"
+
+// Layout bits
+const uint32_t MESH_POSITION = 1;
+const uint32_t MESH_TEXCOORD = 2;
+const uint32_t MESH_NORMAL = 4;
+
+const uint32_t MESH_VERSION = 2;
+const uint32_t MESH_DATA_OFFSET = 64;   // vertex data starts here, keeps it aligned
+
+struct MeshHeader {
+    char magic[4];          // "MESH"
+    uint32_t version;
+    uint32_t vertexCount;
+    uint32_t layout;        // MESH_* bits
+    uint32_t stride;        // bytes per vertex
+    float boundsMin[3];
+    float boundsMax[3];
+    uint32_t checksum;      // FNV-1a of the vertex and index data
+    uint32_t dataOffset;
+    uint32_t indexCount;    // indices follow the vertices
+    uint32_t indexSize;     // 2 or 4 bytes
+};
+
+// Post-transform cache size the index order is optimized and measured for
+const int VERTEX_CACHE_SIZE = 16;
+
+struct IndexedMesh {
+    std::vector<float> vertices;     // 8 floats per vertex
+    std::vector<uint32_t> indices;   // 3 per triangle
+};
+
+inline uint32_t meshChecksum(const void* data, size_t bytes, uint32_t hash = 2166136261u) {
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < bytes; i++) hash = (hash ^ p[i]) * 16777619u;
+    return hash;
+}
+
+// "models/teapot.txt" -> "models/teapot.mesh"
+inline std::string meshPath(const std::string& textPath) {
+    size_t dot = textPath.find_last_of('.');
+    size_t slash = textPath.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return textPath + ".mesh";
+    return textPath.substr(0, dot) + ".mesh";
+}
+
+inline std::vector<float> readTextMesh(const char* filepath) {
+    std::ifstream file(filepath);
+    
+    int numFloats = 0;
+    file >> numFloats;
+    
+    std::vector<float> data(numFloats);
+    for (int i = 0; i < numFloats; i++) {
+        file >> data[i];
+    }
+    file.close();
+    
+    return data;
+}
+
+// Merges bit-identical vertices of a triangle soup into an index buffer
+inline IndexedMesh weldVertices(const std::vector<float>& soup) {
+    struct VertexHash {
+        const std::vector<float>* data;
+        size_t operator()(uint32_t v) const { return meshChecksum(&(*data)[v * 8], 8 * sizeof(float)); }
+    };
+    struct VertexEqual {
+        const std::vector<float>* data;
+        bool operator()(uint32_t a, uint32_t b) const { return memcmp(&(*data)[a * 8], &(*data)[b * 8], 8 * sizeof(float)) == 0; }
+    };
+    
+    // Keys are soup vertex numbers, values the welded index
+    uint32_t soupCount = soup.size() / 8;
+    std::unordered_map<uint32_t, uint32_t, VertexHash, VertexEqual> unique(soupCount, VertexHash{&soup}, VertexEqual{&soup});
+    
+    IndexedMesh mesh;
+    mesh.indices.reserve(soupCount);
+    for (uint32_t v = 0; v < soupCount; v++) {
+        std::pair<std::unordered_map<uint32_t, uint32_t, VertexHash, VertexEqual>::iterator, bool> inserted =
+            unique.insert(std::make_pair(v, (uint32_t)(mesh.vertices.size() / 8)));
+        if (inserted.second) mesh.vertices.insert(mesh.vertices.end(), &soup[v * 8], &soup[v * 8] + 8);
+        mesh.indices.push_back(inserted.first->second);
+    }
+    return mesh;
+}
+
+// Average cache miss ratio: vertex shader runs per triangle with a FIFO post-transform cache.
+// 3.0 means no reuse at all, 0.5 is the best a regular grid can do.
+inline float computeACMR(const std::vector<uint32_t>& indices, uint32_t vertexCount, int cacheSize = VERTEX_CACHE_SIZE) {
+    if (indices.empty()) return 0;
+    
+    // A vertex is in the cache if it entered within the last cacheSize misses
+    std::vector<uint32_t> enteredAt(vertexCount, 0);
+    uint32_t misses = 0;
+    for (size_t i = 0; i < indices.size(); i++) {
+        uint32_t v = indices[i];
+        if (enteredAt[v] == 0 || misses - enteredAt[v] + 1 > (uint32_t)cacheSize) {
+            misses++;
+            enteredAt[v] = misses;
+        }
+    }
+    return (float)misses / (indices.size() / 3);
+}
+
+// Tipsify (Sander, Nehab and Barczak 2007): fans triangles around vertices still in the
+// cache, in linear time
+inline void optimizeVertexCache(std::vector<uint32_t>& indices, uint32_t vertexCount, int cacheSize = VERTEX_CACHE_SIZE) {
+    uint32_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0) return;
+    
+    // Triangles using each vertex, as offsets into one array
+    std::vector<uint32_t> live(vertexCount, 0);
+    for (size_t i = 0; i < indices.size(); i++) live[indices[i]]++;
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    for (uint32_t v = 0; v < vertexCount; v++) offsets[v + 1] = offsets[v] + live[v];
+    std::vector<uint32_t> adjacency(indices.size());
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++) adjacency[fill[indices[i]]++] = i / 3;
+    
+    std::vector<uint32_t> cacheTime(vertexCount, 0);
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<uint32_t> deadEnd;
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+    
+    uint32_t time = cacheSize + 1;
+    uint32_t cursor = 0;
+    int64_t fanning = indices[0];
+    
+    while (fanning >= 0) {
+        candidates.clear();
+        uint32_t f = (uint32_t)fanning;
+        for (uint32_t a = offsets[f]; a < offsets[f + 1]; a++) {
+            uint32_t t = adjacency[a];
+            if (emitted[t]) continue;
+            for (int k = 0; k < 3; k++) {
+                uint32_t v = indices[t * 3 + k];
+                output.push_back(v);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (time - cacheTime[v] > (uint32_t)cacheSize) cacheTime[v] = time++;
+            }
+            emitted[t] = true;
+        }
+        
+        // Next fan: the candidate that stays in the cache longest while its fan is emitted
+        fanning = -1;
+        int64_t best = -1;
+        for (size_t c = 0; c < candidates.size(); c++) {
+            uint32_t v = candidates[c];
+            if (live[v] == 0) continue;
+            int64_t priority = 0;
+            if (time - cacheTime[v] + 2 * live[v] <= (uint32_t)cacheSize) priority = time - cacheTime[v];
+            if (priority > best) {
+                best = priority;
+                fanning = v;
+            }
+        }
+        
+        // Dead end: fall back to recently used vertices, then to any vertex left
+        while (fanning < 0 && !deadEnd.empty()) {
+            uint32_t v = deadEnd.back();
+            deadEnd.pop_back();
+            if (live[v] > 0) fanning = v;
+        }
+        while (fanning < 0 && cursor < vertexCount) {
+            if (live[cursor] > 0) fanning = cursor;
+            cursor++;
+        }
+    }
+    
+    indices.swap(output);
+}
+
+// Renumbers vertices in order of first use so vertex fetches walk the buffer forwards
+inline void optimizeVertexFetch(IndexedMesh& mesh) {
+    uint32_t vertexCount = mesh.vertices.size() / 8;
+    std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+    std::vector<float> vertices;
+    vertices.reserve(mesh.vertices.size());
+    
+    for (size_t i = 0; i < mesh.indices.size(); i++) {
+        uint32_t& v = mesh.indices[i];
+        if (remap[v] == UINT32_MAX) {
+            remap[v] = vertices.size() / 8;
+            vertices.insert(vertices.end(), &mesh.vertices[v * 8], &mesh.vertices[v * 8] + 8);
+        }
+        v = remap[v];
+    }
+    mesh.vertices.swap(vertices);
+}
+
+// Reorders a welded mesh for the vertex cache, then its vertices for fetching
+inline void optimizeIndexedMesh(IndexedMesh& mesh) {
+    optimizeVertexCache(mesh.indices, mesh.vertices.size() / 8);
+    optimizeVertexFetch(mesh);
+}
+
+inline IndexedMesh buildIndexedMesh(const std::vector<float>& soup) {
+    IndexedMesh mesh = weldVertices(soup);
+    optimizeIndexedMesh(mesh);
+    return mesh;
+}
+
+// Bytes per index in the .mesh file, 16-bit whenever the vertex count allows it
+inline uint32_t meshIndexSize(const IndexedMesh& mesh) {
+    return mesh.vertices.size() / 8 <= 65536 ? 2 : 4;
+}
+
+inline bool writeMeshFile(const char* filepath, const IndexedMesh& mesh) {
+    MeshHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "MESH", 4);
+    header.version = MESH_VERSION;
+    header.vertexCount = mesh.vertices.size() / 8;
+    header.layout = MESH_POSITION | MESH_TEXCOORD | MESH_NORMAL;
+    header.stride = 8 * sizeof(float);
+    header.dataOffset = MESH_DATA_OFFSET;
+    header.indexCount = mesh.indices.size();
+    header.indexSize = meshIndexSize(mesh);
+    
+    std::vector<uint16_t> shortIndices;
+    const void* indexData = mesh.indices.data();
+    if (header.indexSize == 2) {
+        shortIndices.assign(mesh.indices.begin(), mesh.indices.end());
+        indexData = shortIndices.data();
+    }
+    size_t vertexBytes = (size_t)header.vertexCount * header.stride;
+    size_t indexBytes = (size_t)header.indexCount * header.indexSize;
+    header.checksum = meshChecksum(indexData, indexBytes, meshChecksum(mesh.vertices.data(), vertexBytes));
+    
+    for (int a = 0; a < 3; a++) {
+        header.boundsMin[a] = header.vertexCount ? mesh.vertices[a] : 0;
+        header.boundsMax[a] = header.boundsMin[a];
+    }
+    for (uint32_t v = 0; v < header.vertexCount; v++) {
+        for (int a = 0; a < 3; a++) {
+            float f = mesh.vertices[v * 8 + a];
+            if (f < header.boundsMin[a]) header.boundsMin[a] = f;
+            if (f > header.boundsMax[a]) header.boundsMax[a] = f;
+        }
+    }
+    
+    FILE* file = fopen(filepath, "wb");
+    if (!file) return false;
+    
+    char padding[MESH_DATA_OFFSET] = {0};
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(padding, 1, MESH_DATA_OFFSET - sizeof(header), file) == MESH_DATA_OFFSET - sizeof(header) &&
+              fwrite(mesh.vertices.data(), 1, vertexBytes, file) == vertexBytes &&
+              fwrite(indexData, 1, indexBytes, file) == indexBytes;
+    return fclose(file) == 0 && ok;
+}
+
+// A mapped .mesh file; vertices and indices point into the mapping
+struct MeshFile {
+    MappedFile mapped;
+    const MeshHeader* header;
+    const float* vertices;
+    const void* indices;
+};
+
+inline uint32_t meshIndex(const MeshFile& mesh, uint32_t i) {
+    if (mesh.header->indexSize == 2) return ((const uint16_t*)mesh.indices)[i];
+    return ((const uint32_t*)mesh.indices)[i];
+}
+
+// Maps and validates a .mesh file. Prints why and returns false if it can't be used.
+inline bool openMeshFile(const char* filepath, MeshFile& mesh) {
+    if (!mapFile(filepath, mesh.mapped)) return false;
+    
+    const char* error = NULL;
+    mesh.header = (const MeshHeader*)mesh.mapped.data;
+    if (mesh.mapped.size < MESH_DATA_OFFSET || memcmp(mesh.header->magic, "MESH", 4) != 0)
+        error = "not a mesh file";
+    else if (mesh.header->version != MESH_VERSION)
+        error = "unsupported version";
+    else if (mesh.header->layout != (MESH_POSITION | MESH_TEXCOORD | MESH_NORMAL) || mesh.header->stride != 8 * sizeof(float))
+        error = "unsupported vertex layout";
+    else if (mesh.header->indexSize != 2 && mesh.header->indexSize != 4)
+        error = "unsupported index size";
+    else if (mesh.header->dataOffset < sizeof(MeshHeader) || mesh.header->dataOffset > mesh.mapped.size ||
+             mesh.mapped.size - mesh.header->dataOffset <
+                 (uint64_t)mesh.header->vertexCount * mesh.header->stride + (uint64_t)mesh.header->indexCount * mesh.header->indexSize)
+        error = "truncated";
+    
+    // The header can only be trusted once every check above has passed
+    if (!error) {
+        size_t vertexBytes = (size_t)mesh.header->vertexCount * mesh.header->stride;
+        const char* vertexData = mesh.mapped.data + mesh.header->dataOffset;
+        uint32_t checksum = meshChecksum(vertexData, vertexBytes);
+        checksum = meshChecksum(vertexData + vertexBytes, (size_t)mesh.header->indexCount * mesh.header->indexSize, checksum);
+        if (checksum != mesh.header->checksum) error = "checksum mismatch";
+        mesh.vertices = (const float*)vertexData;
+        mesh.indices = vertexData + vertexBytes;
+    }
+    
+    // The checksum only catches damage, so the indices are checked before anything reads
+    // vertices through them
+    for (uint32_t i = 0; !error && i < mesh.header->indexCount; i++)
+        if (meshIndex(mesh, i) >= mesh.header->vertexCount) error = "index out of range";
+    
+    if (error) {
+        printf("Ignoring %s: %s\n", filepath, error);
+        unmapFile(mesh.mapped);
+        return false;
+    }
+    return true;
+}
+
+inline void closeMeshFile(MeshFile& mesh) {
+    unmapFile(mesh.mapped);
+}
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef PATH_DISTANCE_H
+#define PATH_DISTANCE_H
+
+// Steps from one cell to every cell of the map, for level analysis (distance from the start,
+// distance from the goal), by a breadth-first search split across threads one level at a
+// time. Cells block as they do for the player.
+//
+// Each thread expands its share of the frontier into a queue of its own and, once through
+// its own queue, takes chunks of the others'. While the frontier is small against what is
+// left unvisited every frontier cell looks at its neighbours (top-down). Once it is large
+// the remaining cells look for a neighbour in the frontier instead (bottom-up), a word of
+// 64 cells at a time over bitmaps laid out like Map::blockers, and only over the words that
+// still have unvisited cells.
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+#include "Map.h"
+#include "ThreadPool.h"
+
+const size_t BFS_CHUNK = 256;           // frontier cells, or bitmap words, a thread takes at a time
+const size_t BFS_PARALLEL_MIN = 4096;   // smaller frontiers are expanded by the calling thread alone
+const size_t BFS_BOTTOM_UP_RATIO = 14;  // bottom-up once the frontier is over this share of the unvisited cells
+const size_t BFS_TOP_DOWN_RATIO = 24;   // top-down again once it is under this share of all open cells
+
+// -1 for cells that can't be reached
+typedef std::vector<int32_t, UninitializedAllocator<int32_t> > PathDistances;
+
+struct PathDistanceStats {
+    int levels;            // the farthest distance plus one
+    int bottomUpLevels;
+    size_t reached;        // cells, the start included
+};
+
+// Distances from (sx, sz) with the doors of keys open, using the pool's threads
+inline PathDistanceStats computePathDistances(const Map& map, KeyMask keys, int sx, int sz, PathDistances& dist,
+                                              ThreadPool& pool) {
+    PathDistanceStats stats = { 0, 0, 0 };
+    const int W = map.wordsPerRow;
+    const size_t words = (size_t)W * map.height;
+    const int threads = pool.size();
+    dist.resize((size_t)map.width * map.height);
+    
+    // Blocked cells and the padding at the end of each row start out visited
+    std::vector<uint64_t> blocked(map.blockers.begin(), map.blockers.end());
+    for (size_t i = 0; i < map.doors.size(); i++) {
+        const MapItem& door = map.doors[i];
+        if (!blocksPlayer(map, door.x, door.z, keys)) blocked[(size_t)door.z * W + (door.x >> 6)] &= ~(1ull << (door.x & 63));
+    }
+    if (map.width & 63) {
+        for (int z = 0; z < map.height; z++) blocked[(size_t)z * W + W - 1] |= ~0ull << (map.width & 63);
+    }
+    std::vector<std::atomic<uint64_t> > visited(words);
+    size_t open = 0;
+    for (size_t w = 0; w < words; w++) {
+        visited[w].store(blocked[w], std::memory_order_relaxed);
+        open += 64 - __builtin_popcountll(blocked[w]);
+    }
+    
+    std::vector<std::vector<uint32_t> > frontier(threads), next(threads);
+    if (!blocksPlayer(map, sx, sz, keys)) {
+        uint32_t start = (uint32_t)map.index(sx, sz);
+        visited[(size_t)sz * W + (sx >> 6)].fetch_or(1ull << (sx & 63), std::memory_order_relaxed);
+        dist[start] = 0;
+        frontier[0].push_back(start);
+    }
+    
+    std::vector<std::atomic<size_t> > cursors(threads);
+    std::vector<uint64_t> frontierBits, nextBits;
+    std::vector<uint32_t> activeWords;
+    std::vector<std::vector<uint32_t> > keptWords(threads);
+    bool bottomUp = false;
+    size_t unvisited = open;
+    for (int32_t level = 0;; level++) {
+        size_t frontierSize = 0;
+        for (int t = 0; t < threads; t++) frontierSize += frontier[t].size();
+        if (frontierSize == 0) break;
+        stats.levels++;
+        stats.reached += frontierSize;
+        unvisited -= frontierSize;
+        for (int t = 0; t < threads; t++) next[t].clear();
+        
+        if (!bottomUp && frontierSize > unvisited / BFS_BOTTOM_UP_RATIO && frontierSize >= BFS_PARALLEL_MIN) {
+            // The frontier as a bitmap, and the words that still have unvisited cells
+            bottomUp = true;
+            frontierBits.assign(words, 0);
+            nextBits.assign(words, 0);
+            for (int t = 0; t < threads; t++) {
+                for (size_t i = 0; i < frontier[t].size(); i++) {
+                    uint32_t c = frontier[t][i];
+                    int x = (int)(c % map.width), z = (int)(c / map.width);
+                    frontierBits[(size_t)z * W + (x >> 6)] |= 1ull << (x & 63);
+                }
+            }
+            activeWords.clear();
+            for (size_t w = 0; w < words; w++)
+                if (~visited[w].load(std::memory_order_relaxed) || frontierBits[w]) activeWords.push_back((uint32_t)w);
+        } else if (bottomUp && frontierSize < open / BFS_TOP_DOWN_RATIO) {
+            bottomUp = false;
+        }
+        
+        if (bottomUp) {
+            // Every unvisited cell next to a frontier cell joins the next frontier; each word
+            // is only written by the thread that took it
+            stats.bottomUpLevels++;
+            cursors[0].store(0);
+            pool.run(threads, [&](int t) {
+                std::vector<uint32_t>& out = next[t];
+                std::vector<uint32_t>& kept = keptWords[t];
+                kept.clear();
+                for (size_t begin = cursors[0].fetch_add(BFS_CHUNK); begin < activeWords.size();
+                     begin = cursors[0].fetch_add(BFS_CHUNK)) {
+                    size_t end = std::min(begin + BFS_CHUNK, activeWords.size());
+                    for (size_t i = begin; i < end; i++) {
+                        size_t w = activeWords[i];
+                        int z = (int)(w / W), column = (int)(w % W);
+                        uint64_t f = frontierBits[w];
+                        uint64_t near = (f << 1) | (f >> 1);
+                        if (column > 0) near |= frontierBits[w - 1] >> 63;
+                        if (column + 1 < W) near |= frontierBits[w + 1] << 63;
+                        if (z > 0) near |= frontierBits[w - W];
+                        if (z + 1 < map.height) near |= frontierBits[w + W];
+                        uint64_t seen = visited[w].load(std::memory_order_relaxed);
+                        uint64_t found = near & ~seen;
+                        nextBits[w] = found;
+                        if (found) {
+                            visited[w].store(seen | found, std::memory_order_relaxed);
+                            for (uint64_t bits = found; bits; bits &= bits - 1) {
+                                uint32_t c = (uint32_t)((size_t)z * map.width + column * 64 + __builtin_ctzll(bits));
+                                dist[c] = level + 1;
+                                out.push_back(c);
+                            }
+                        }
+                        // Dropped once full with no frontier bits, when both bitmaps are clear there
+                        if (~seen || f) kept.push_back((uint32_t)w);
+                    }
+                }
+            });
+            activeWords.clear();
+            for (int t = 0; t < threads; t++) activeWords.insert(activeWords.end(), keptWords[t].begin(), keptWords[t].end());
+            frontierBits.swap(nextBits);
+        } else {
+            // Each thread starts on its own queue, then helps with the others'
+            int parts = frontierSize < BFS_PARALLEL_MIN ? 1 : threads;
+            for (int t = 0; t < threads; t++) cursors[t].store(0);
+            pool.run(parts, [&](int t) {
+                std::vector<uint32_t>& out = next[t];
+                for (int k = 0; k < threads; k++) {
+                    int q = (t + k) % threads;
+                    const std::vector<uint32_t>& in = frontier[q];
+                    for (size_t begin = cursors[q].fetch_add(BFS_CHUNK); begin < in.size();
+                         begin = cursors[q].fetch_add(BFS_CHUNK)) {
+                        size_t end = std::min(begin + BFS_CHUNK, in.size());
+                        for (size_t i = begin; i < end; i++) {
+                            int x = (int)(in[i] % map.width), z = (int)(in[i] / map.width);
+                            for (int d = 0; d < 4; d++) {
+                                int nx = x + (d == 0) - (d == 1), nz = z + (d == 2) - (d == 3);
+                                if (nx < 0 || nx >= map.width || nz < 0 || nz >= map.height) continue;
+                                std::atomic<uint64_t>& word = visited[(size_t)nz * W + (nx >> 6)];
+                                uint64_t bit = 1ull << (nx & 63);
+                                if (word.load(std::memory_order_relaxed) & bit) continue;
+                                if (word.fetch_or(bit, std::memory_order_relaxed) & bit) continue;
+                                uint32_t c = (uint32_t)map.index(nx, nz);
+                                dist[c] = level + 1;
+                                out.push_back(c);
+                            }
+                        }
+                    }
+                }
+            });
+        }
+        frontier.swap(next);
+    }
+    
+    // Everything left unvisited or blocked can't be reached
+    int rowsPerTask = std::max(1, map.height / (threads * 8));
+    pool.run((map.height + rowsPerTask - 1) / rowsPerTask, [&](int task) {
+        int z1 = std::min(map.height, (task + 1) * rowsPerTask);
+        for (int z = task * rowsPerTask; z < z1; z++) {
+            for (int column = 0; column < W; column++) {
+                size_t w = (size_t)z * W + column;
+                uint64_t unreached = (~visited[w].load(std::memory_order_relaxed) | blocked[w]);
+                if (column == W - 1 && (map.width & 63)) unreached &= ~(~0ull << (map.width & 63));
+                for (; unreached; unreached &= unreached - 1)
+                    dist[(size_t)z * map.width + column * 64 + __builtin_ctzll(unreached)] = -1;
+            }
+        }
+    });
+    return stats;
+}
+
+// The same with threads of its own, 0 for one per core
+inline PathDistanceStats computePathDistances(const Map& map, KeyMask keys, int sx, int sz, PathDistances& dist,
+                                              int threads = 0) {
+    ThreadPool pool(threads);
+    return computePathDistances(map, keys, sx, sz, dist, pool);
+}
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef REPAIR_PATH_H
+#define REPAIR_PATH_H
+
+// A shortest path that is kept up to date as the map changes under it (D* Lite), for
+// planners that follow one path while doors open and cells change. The search runs
+// backwards from the goal, so every cell it has settled knows its steps to the goal (g),
+// and rhs is what g should be going by the neighbours. When cells change only those and
+// their neighbours are rechecked, and the search goes on from the cells whose g and rhs no
+// longer agree, settling no further than the start needs. The start may move along the path
+// between repairs; its keys are offset by how far it has moved so earlier ones stay valid.
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+#include "Map.h"
+
+const int REPAIR_DX[4] = { 1, -1, 0, 0 };
+const int REPAIR_DZ[4] = { 0, 0, 1, -1 };
+const int32_t REPAIR_INF = 0x3FFFFFFF;
+
+struct RepairSearch {
+    int width, height;
+    KeyMask keys;                  // doors of these key types are open
+    int startX, startZ, goalX, goalZ;
+    int32_t km;                    // how far the start has moved, added to every new key
+    std::vector<int32_t> g, rhs;   // steps to the goal, REPAIR_INF where unknown or blocked
+    std::vector<std::pair<int64_t, uint32_t> > open;   // min-heap on the packed key, with stale entries
+    size_t expanded;               // by the last findRepairPath
+};
+
+// min(g, rhs) plus the distance to the start, packed in one integer with the tie-break:
+// cells whose g is going up first, then the larger min(g, rhs) first, so on open floor the
+// search heads for the start as A* does instead of settling every cell as far
+inline int64_t repairKey(const RepairSearch& search, uint32_t cell) {
+    int x = (int)(cell % search.width), z = (int)(cell / search.width);
+    int64_t m = std::min(search.g[cell], search.rhs[cell]);
+    int64_t h = std::abs(x - search.startX) + std::abs(z - search.startZ);
+    int64_t rising = search.g[cell] < search.rhs[cell];
+    return ((m + h + search.km) << 32) | ((1 - rising) << 31) | (REPAIR_INF - m);
+}
+
+// Recomputes rhs of the cell from its neighbours and queues it if it disagrees with g
+inline void updateRepairCell(const Map& map, RepairSearch& search, int x, int z) {
+    uint32_t cell = (uint32_t)map.index(x, z);
+    if (x != search.goalX || z != search.goalZ) {
+        int32_t best = REPAIR_INF;
+        if (!blocksPlayer(map, x, z, search.keys)) {
+            for (int d = 0; d < 4; d++) {
+                int nx = x + REPAIR_DX[d], nz = z + REPAIR_DZ[d];
+                if (blocksPlayer(map, nx, nz, search.keys)) continue;
+                best = std::min(best, search.g[map.index(nx, nz)] + 1);
+            }
+        }
+        search.rhs[cell] = std::min(best, REPAIR_INF);
+    }
+    if (search.g[cell] != search.rhs[cell]) {
+        search.open.push_back(std::make_pair(repairKey(search, cell), cell));
+        std::push_heap(search.open.begin(), search.open.end(), std::greater<std::pair<int64_t, uint32_t> >());
+    }
+}
+
+// Starts a search from (sx, sz) to (gx, gz) with the doors of keys open; findRepairPath
+// does the work
+inline void initRepairSearch(const Map& map, KeyMask keys, int sx, int sz, int gx, int gz, RepairSearch& search) {
+    size_t cells = (size_t)map.width * map.height;
+    search.width = map.width;
+    search.height = map.height;
+    search.keys = keys;
+    search.startX = sx;
+    search.startZ = sz;
+    search.goalX = gx;
+    search.goalZ = gz;
+    search.km = 0;
+    search.g.assign(cells, REPAIR_INF);
+    search.rhs.assign(cells, REPAIR_INF);
+    search.open.clear();
+    search.expanded = 0;
+    if (blocksPlayer(map, gx, gz, keys)) return;
+    
+    uint32_t goal = (uint32_t)map.index(gx, gz);
+    search.rhs[goal] = 0;
+    search.open.push_back(std::make_pair(repairKey(search, goal), goal));
+}
+
+// Settles cells until the start's steps to the goal are known; returns them, or -1 if the
+// goal can't be reached
+inline int findRepairPath(const Map& map, RepairSearch& search) {
+    search.expanded = 0;
+    uint32_t start = (uint32_t)map.index(search.startX, search.startZ);
+    while (!search.open.empty()) {
+        std::pair<int64_t, uint32_t> top = search.open.front();
+        if (top.first >= repairKey(search, start) && search.g[start] == search.rhs[start]) break;
+        std::pop_heap(search.open.begin(), search.open.end(), std::greater<std::pair<int64_t, uint32_t> >());
+        search.open.pop_back();
+        
+        // Entries for cells settled since, or queued again with another key, are skipped;
+        // those queued before the start moved go back in with their key brought up to date
+        uint32_t cell = top.second;
+        if (search.g[cell] == search.rhs[cell]) continue;
+        int64_t key = repairKey(search, cell);
+        if (top.first > key) continue;
+        if (top.first < key) {
+            search.open.push_back(std::make_pair(key, cell));
+            std::push_heap(search.open.begin(), search.open.end(), std::greater<std::pair<int64_t, uint32_t> >());
+            continue;
+        }
+        
+        search.expanded++;
+        int x = (int)(cell % map.width), z = (int)(cell / map.width);
+        if (search.g[cell] > search.rhs[cell]) {
+            search.g[cell] = search.rhs[cell];
+        } else {
+            search.g[cell] = REPAIR_INF;
+            updateRepairCell(map, search, x, z);
+        }
+        for (int d = 0; d < 4; d++) {
+            int nx = x + REPAIR_DX[d], nz = z + REPAIR_DZ[d];
+            if (map.inBounds(nx, nz)) updateRepairCell(map, search, nx, nz);
+        }
+    }
+    return search.g[start] >= REPAIR_INF ? -1 : search.g[start];
+}
+
+// Moves the start, normally along the path, before the next findRepairPath
+inline void moveRepairStart(RepairSearch& search, int x, int z) {
+    search.km += std::abs(x - search.startX) + std::abs(z - search.startZ);
+    search.startX = x;
+    search.startZ = z;
+}
+
+// Rechecks cells whose blocking changed (walls put up or taken down) and their neighbours
+inline void changeRepairCells(const Map& map, RepairSearch& search, const std::vector<std::pair<int, int> >& cells) {
+    for (size_t i = 0; i < cells.size(); i++) {
+        int x = cells[i].first, z = cells[i].second;
+        updateRepairCell(map, search, x, z);
+        for (int d = 0; d < 4; d++) {
+            int nx = x + REPAIR_DX[d], nz = z + REPAIR_DZ[d];
+            if (map.inBounds(nx, nz)) updateRepairCell(map, search, nx, nz);
+        }
+    }
+}
+
+// Opens the doors of keys that weren't open yet, as when the player picks up a key; returns
+// how many doors opened. Only the doors need rechecking: a door that was shut has no steps
+// to the goal, so its neighbours can't gain any through it until it is settled.
+inline int unlockRepairDoors(const Map& map, RepairSearch& search, KeyMask keys) {
+    KeyMask added = keys & ~search.keys;
+    search.keys |= keys;
+    int opened = 0;
+    for (size_t i = 0; i < map.doors.size(); i++) {
+        const MapItem& door = map.doors[i];
+        if (!((added >> door.type) & 1)) continue;
+        updateRepairCell(map, search, door.x, door.z);
+        opened++;
+    }
+    return opened;
+}
+
+// The direction (into REPAIR_DX / REPAIR_DZ) of the next step from (x, z) along the path,
+// -1 at the goal or where it can't be reached
+inline int repairStep(const Map& map, const RepairSearch& search, int x, int z) {
+    int32_t here = search.g[map.index(x, z)];
+    if (here == 0 || here >= REPAIR_INF) return -1;
+    for (int d = 0; d < 4; d++) {
+        int nx = x + REPAIR_DX[d], nz = z + REPAIR_DZ[d];
+        if (!blocksPlayer(map, nx, nz, search.keys) && search.g[map.index(nx, nz)] == here - 1) return d;
+    }
+    return -1;
+}
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+// The player's movement, key pickups and the win check, stepped at a fixed rate. The state
+// is plain data and stepping it needs neither SDL nor GL, so the same controls at the same
+// tick rate always give the same run whatever the frame rate. The game renders in between
+// ticks by interpolating the last two states.
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#include "Map.h"
+#include "MapStream.h"
+#include "DistanceField.h"
+
+const int SIM_DEFAULT_HZ = 120;
+const float PLAYER_SPEED = 3.0f;     // units per second
+const double SIM_MAX_FRAME = 0.25;   // seconds of a frame simulated at most, after a stall the rest is dropped
+
+// Controls as sampled for a tick
+struct SimInput {
+    float yaw;                          // degrees, the way forward faces
+    bool forward, back, left, right;
+};
+
+struct SimState {
+    glm::vec3 position;
+    KeyMask keys;      // collected
+    int pickedKey;     // type of the key picked up by the last tick, -1 if none
+    bool won;
+    uint64_t tick;
+};
+
+// What the player moves through: a whole map, with its distance field if it has one, or a
+// streamed map
+struct SimWorld {
+    Map* map;
+    DistanceField* field;
+    MapStream* stream;
+};
+
+inline SimState startSimulation(glm::vec3 startPos) {
+    SimState state;
+    state.position = startPos;
+    state.keys = 0;
+    state.pickedKey = -1;
+    state.won = false;
+    state.tick = 0;
+    return state;
+}
+
+// Returns the type of the key picked up, whose cell is floor now, or -1 if there was none
+template <typename Grid>
+int checkKeyPickup(Grid& map, glm::vec3 pos, KeyMask& keys) {
+    int gridX = worldToCell(pos.x);
+    int gridZ = worldToCell(pos.z);
+    
+    if (gridX < 0 || gridX >= map.width || gridZ < 0 || gridZ >= map.height)
+        return -1;
+    
+    char cell = map.cell(gridX, gridZ);
+    
+    if (isKeyCell(cell)) {
+        keys |= 1ull << cellKeyType(cell);
+        map.setCell(gridX, gridZ, '0');
+        return cellKeyType(cell);
+    }
+    return -1;
+}
+
+// Advances the state by one tick of dt seconds. Returns true if a key was picked up, from
+// the cell the player is now on; state.pickedKey says which.
+inline bool stepSimulation(SimState& state, const SimInput& input, float dt, SimWorld& world) {
+    state.tick++;
+    state.pickedKey = -1;
+    if (state.won) return false;
+    
+    float yaw = glm::radians(input.yaw);
+    glm::vec3 forward(std::cos(yaw), 0.0f, std::sin(yaw));
+    glm::vec3 right(-forward.z, 0.0f, forward.x);
+    float step = PLAYER_SPEED * dt;
+    
+    glm::vec3 move(0.0f);
+    if (input.forward) move += forward * step;
+    if (input.back) move -= forward * step;
+    if (input.left) move -= right * step;
+    if (input.right) move += right * step;
+    
+    // Swept, so a long tick can't carry the player through a wall, and blocked moves
+    // slide along walls instead of stopping. Moves that stay clear of everything per the
+    // distance field skip the sweep.
+    glm::vec3 newPos;
+    if (world.stream) newPos = sweepPlayer(*world.stream, state.position, move, state.keys);
+    else if (world.field) newPos = movePlayer(*world.map, *world.field, state.position, move, state.keys);
+    else newPos = sweepPlayer(*world.map, state.position, move, state.keys);
+    if (newPos == state.position) return false;
+    state.position = newPos;
+    
+    if (world.stream) {
+        state.pickedKey = checkKeyPickup(*world.stream, state.position, state.keys);
+        state.won = checkWin(*world.stream, state.position);
+    } else {
+        state.pickedKey = checkKeyPickup(*world.map, state.position, state.keys);
+        if (state.pickedKey >= 0 && world.field) unlockFieldDoors(*world.map, *world.field, state.keys);
+        state.won = checkWin(*world.map, state.position);
+    }
+    return state.pickedKey >= 0;
+}
+
+// Turns frame times into whole ticks, carrying the remainder over to the next frame
+struct SimClock {
+    double tickSeconds;
+    double accumulator;
+};
+
+inline SimClock makeSimClock(int hz) {
+    SimClock clock;
+    clock.tickSeconds = 1.0 / hz;
+    clock.accumulator = 0;
+    return clock;
+}
+
+// Adds a frame's time and returns how many ticks are due
+inline int advanceSimClock(SimClock& clock, double frameSeconds) {
+    clock.accumulator += std::min(frameSeconds, SIM_MAX_FRAME);
+    int ticks = (int)(clock.accumulator / clock.tickSeconds);
+    clock.accumulator -= ticks * clock.tickSeconds;
+    return ticks;
+}
+
+// How far the frame is from the last tick towards the next, 0 to 1
+inline float simClockAlpha(const SimClock& clock) {
+    return (float)(clock.accumulator / clock.tickSeconds);
+}
+
+#endif
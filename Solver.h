@@ -0,0 +1,206 @@
+#ifndef SOLVER_H
+#define SOLVER_H
+
+// Shortest solution of a map without playing it: a breadth-first search over states of
+// (cell, keys held), moving between side-by-side cells under the same rules as the player,
+// so walls and the doors of keys not held block and stepping on a key picks it up.
+//
+// Each key mask that turns up gets a layer of 2 bits per cell, 0 for not reached or the
+// state's depth mod 3 plus 1. Within a layer every move can be walked back, so neighbouring
+// states are at most one step apart and the depth mod 3 is enough to find the way back
+// from the goal. The few states first reached by picking up a key remember their parent.
+// A 10000x10000 map costs 25 MB per key mask reached.
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+
+#include "Map.h"
+
+// Moves between cells, as stored in Solution::moves
+const char SOLVE_MOVES[4] = { 'R', 'L', 'D', 'U' };   // +x, -x, +z, -z
+const int SOLVE_DX[4] = { 1, -1, 0, 0 };
+const int SOLVE_DZ[4] = { 0, 0, 1, -1 };
+
+// A state packs its cell index into the low 40 bits and its layer above them
+const int SOLVE_CELL_BITS = 40;
+const uint64_t SOLVE_CELL_MASK = (1ull << SOLVE_CELL_BITS) - 1;
+
+struct Solution {
+    bool solved;            // false means every reachable state was searched without reaching the goal
+    std::string moves;      // one letter of SOLVE_MOVES per step, start to goal
+    std::vector<MapItem> pickups;   // keys in the order the solution picks them up
+    uint64_t states;        // states reached, start included
+    int keyMasks;           // distinct sets of held keys reached
+    size_t bytes;           // of the layers
+};
+
+// Key types that open at least one door; keys of other types change nothing
+inline KeyMask doorKeyTypes(const Map& map) {
+    KeyMask types = 0;
+    for (size_t i = 0; i < map.doors.size(); i++) types |= 1ull << map.doors[i].type;
+    return types;
+}
+
+struct SolveLayers {
+    size_t wordsPerLayer;
+    std::vector<KeyMask> masks;
+    std::vector<std::vector<uint64_t> > marks;   // 32 cells per word
+    std::unordered_map<KeyMask, int> index;
+    
+    int layer(KeyMask mask) {
+        std::unordered_map<KeyMask, int>::iterator it = index.find(mask);
+        if (it != index.end()) return it->second;
+        index[mask] = (int)masks.size();
+        masks.push_back(mask);
+        marks.push_back(std::vector<uint64_t>(wordsPerLayer, 0));
+        return (int)masks.size() - 1;
+    }
+    
+    int mark(int layer, uint64_t cell) const {
+        return (marks[layer][cell >> 5] >> ((cell & 31) * 2)) & 3;
+    }
+    
+    void setMark(int layer, uint64_t cell, int value) {
+        marks[layer][cell >> 5] |= (uint64_t)value << ((cell & 31) * 2);
+    }
+};
+
+// Where the move from cell (x, z) holding mask leads: false if out of the map or blocked,
+// otherwise the cell and the mask held on arrival
+inline bool solveStep(const Map& map, KeyMask doorTypes, int x, int z, int dir, KeyMask mask,
+                      uint64_t& next, KeyMask& nextMask) {
+    int nx = x + SOLVE_DX[dir], nz = z + SOLVE_DZ[dir];
+    if (nx < 0 || nx >= map.width || nz < 0 || nz >= map.height) return false;
+    char c = map.cell(nx, nz);
+    if (c == 'W') return false;
+    if (isDoorCell(c) && !((mask >> cellKeyType(c)) & 1)) return false;
+    next = map.index(nx, nz);
+    nextMask = mask;
+    if (isKeyCell(c)) nextMask |= (1ull << cellKeyType(c)) & doorTypes;
+    return true;
+}
+
+inline Solution solveMap(const Map& map) {
+    Solution solution;
+    solution.solved = false;
+    solution.states = 0;
+    
+    KeyMask doorTypes = doorKeyTypes(map);
+    SolveLayers layers;
+    layers.wordsPerLayer = ((size_t)map.width * map.height + 31) / 32;
+    std::unordered_map<uint64_t, uint64_t> parents;   // states first reached by picking up a key
+    
+    int startX = worldToCell(map.startPos.x), startZ = worldToCell(map.startPos.z);
+    int goalX = worldToCell(map.goalPos.x), goalZ = worldToCell(map.goalPos.z);
+    uint64_t goalCell = map.index(goalX, goalZ);
+    uint64_t start = map.index(startX, startZ);
+    layers.setMark(layers.layer(0), start, 1);
+    solution.states = 1;
+    
+    std::vector<uint64_t> frontier(1, start), next;
+    uint64_t goal = 0;
+    uint64_t depth = 0;
+    bool found = start == goalCell;
+    while (!frontier.empty() && !found) {
+        depth++;
+        int markValue = (int)(depth % 3) + 1;
+        next.clear();
+        for (size_t i = 0; i < frontier.size() && !found; i++) {
+            uint64_t cell = frontier[i] & SOLVE_CELL_MASK;
+            int layer = (int)(frontier[i] >> SOLVE_CELL_BITS);
+            KeyMask mask = layers.masks[layer];
+            int x = (int)(cell % map.width), z = (int)(cell / map.width);
+            for (int dir = 0; dir < 4; dir++) {
+                uint64_t nextCell;
+                KeyMask nextMask;
+                if (!solveStep(map, doorTypes, x, z, dir, mask, nextCell, nextMask)) continue;
+                int nextLayer = nextMask == mask ? layer : layers.layer(nextMask);
+                if (layers.mark(nextLayer, nextCell)) continue;
+                
+                layers.setMark(nextLayer, nextCell, markValue);
+                uint64_t state = ((uint64_t)nextLayer << SOLVE_CELL_BITS) | nextCell;
+                if (nextLayer != layer) parents[state] = frontier[i];
+                next.push_back(state);
+                solution.states++;
+                if (nextCell == goalCell) {
+                    goal = state;
+                    found = true;
+                    break;
+                }
+            }
+        }
+        frontier.swap(next);
+    }
+    
+    solution.keyMasks = (int)layers.masks.size();
+    solution.bytes = layers.masks.size() * layers.wordsPerLayer * sizeof(uint64_t);
+    if (!found) return solution;
+    
+    // Walk back from the goal: to a neighbour one step shallower in the same layer, or to
+    // the recorded parent where a key was picked up
+    std::string moves;
+    uint64_t state = goal;
+    for (uint64_t d = depth; d > 0; d--) {
+        uint64_t cell = state & SOLVE_CELL_MASK;
+        int layer = (int)(state >> SOLVE_CELL_BITS);
+        int x = (int)(cell % map.width), z = (int)(cell / map.width);
+        int want = (int)((d - 1) % 3) + 1;
+        uint64_t previous = state;
+        int dir;
+        for (dir = 0; dir < 4; dir++) {
+            int px = x - SOLVE_DX[dir], pz = z - SOLVE_DZ[dir];
+            if (px < 0 || px >= map.width || pz < 0 || pz >= map.height) continue;
+            if (layers.mark(layer, map.index(px, pz)) != want) continue;
+            previous = ((uint64_t)layer << SOLVE_CELL_BITS) | map.index(px, pz);
+            break;
+        }
+        if (dir == 4) {
+            previous = parents[state];
+            uint64_t from = previous & SOLVE_CELL_MASK;
+            for (dir = 0; dir < 4; dir++)
+                if (from + SOLVE_DX[dir] + (int64_t)SOLVE_DZ[dir] * map.width == cell) break;
+        }
+        moves.push_back(SOLVE_MOVES[dir]);
+        state = previous;
+    }
+    std::reverse(moves.begin(), moves.end());
+    
+    // Replay it for the keys it picks up
+    KeyMask held = 0;
+    int x = startX, z = startZ;
+    for (size_t i = 0; i < moves.size(); i++) {
+        int dir = (int)(std::find(SOLVE_MOVES, SOLVE_MOVES + 4, moves[i]) - SOLVE_MOVES);
+        x += SOLVE_DX[dir];
+        z += SOLVE_DZ[dir];
+        char c = map.cell(x, z);
+        if (isKeyCell(c) && ((doorTypes >> cellKeyType(c)) & 1) && !((held >> cellKeyType(c)) & 1)) {
+            held |= 1ull << cellKeyType(c);
+            MapItem key = { x, z, (uint8_t)cellKeyType(c) };
+            solution.pickups.push_back(key);
+        }
+    }
+    
+    solution.solved = true;
+    solution.moves.swap(moves);
+    return solution;
+}
+
+// Whether moves lead from the start to the goal under the player's rules
+inline bool checkSolution(const Map& map, const std::string& moves) {
+    KeyMask doorTypes = doorKeyTypes(map), mask = 0;
+    int x = worldToCell(map.startPos.x), z = worldToCell(map.startPos.z);
+    for (size_t i = 0; i < moves.size(); i++) {
+        int dir = (int)(std::find(SOLVE_MOVES, SOLVE_MOVES + 4, moves[i]) - SOLVE_MOVES);
+        uint64_t next;
+        if (dir == 4 || !solveStep(map, doorTypes, x, z, dir, mask, next, mask)) return false;
+        x += SOLVE_DX[dir];
+        z += SOLVE_DZ[dir];
+    }
+    return x == worldToCell(map.goalPos.x) && z == worldToCell(map.goalPos.z);
+}
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// Fixed set of worker threads for splitting a loop into independent tasks
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <atomic>
+#include <cstddef>
+
+class ThreadPool {
+public:
+    // threads includes the caller, which works on tasks too; 0 picks one per core
+    explicit ThreadPool(int threads = 0) : stop(false), generation(0), busy(0), taskCount(0), nextTask(0) {
+        if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+        if (threads <= 0) threads = 1;
+        for (int i = 1; i < threads; i++)
+            workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+    }
+    
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+    }
+    
+    int size() const {
+        return (int)workers.size() + 1;
+    }
+    
+    // Calls task(0) .. task(count - 1) across the pool and returns when all have finished
+    void run(int count, const std::function<void(int)>& task) {
+        if (workers.empty() || count <= 1) {
+            for (int i = 0; i < count; i++) task(i);
+            return;
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current = &task;
+            taskCount = count;
+            nextTask = 0;
+            busy = (int)workers.size();
+            generation++;
+        }
+        wake.notify_all();
+        
+        runTasks(task, count);
+        
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return busy == 0; });
+        current = NULL;
+    }
+
+private:
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+    
+    void runTasks(const std::function<void(int)>& task, int count) {
+        for (int i = nextTask++; i < count; i = nextTask++) task(i);
+    }
+    
+    void workerLoop() {
+        unsigned seen = 0;
+        for (;;) {
+            const std::function<void(int)>* task;
+            int count;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stop || generation != seen; });
+                if (stop) return;
+                seen = generation;
+                task = current;
+                count = taskCount;
+            }
+            
+            runTasks(*task, count);
+            
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busy == 0) done.notify_one();
+        }
+    }
+    
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    bool stop;
+    unsigned generation;
+    int busy;
+    const std::function<void(int)>* current = NULL;
+    int taskCount;
+    std::atomic<int> nextTask;
+};
+
+#endif
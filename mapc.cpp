@@ -0,0 +1,131 @@
+// Compiles text maps (map*.txt) into the chunked binary .mzb format MazeGame loads
+// without parsing. Each chunk is stored raw, run-length or bit-packed, whichever is smallest.
+//
+// Usage: ./mapc map1.txt map2.txt ...
+// Each input is written next to itself with a .mzb extension. Maps are checked for keys that
+// can't be reached and doors that can't be opened, and fail if the goal can't be reached.
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <bitset>
+
+#include "MapBinary.h"
+#include "FloodFill.h"
+
+using namespace std;
+
+double elapsedMs(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Prints what can't be reached, at most MAP_MAX_ERRORS lines; returns false if the goal can't
+bool reportReachability(const char* path, const Map& map, const Reachability& reach) {
+    vector<string> lines;
+    char line[160];
+    if (!reach.goal) lines.push_back("the goal can't be reached");
+    for (size_t i = 0; i < reach.lostKeys.size(); i++) {
+        const MapItem& key = reach.lostKeys[i];
+        snprintf(line, sizeof(line), "key '%c' at (%d, %d) can't be reached", map.keyTypes[key.type].key, key.x, key.z);
+        lines.push_back(line);
+    }
+    for (size_t i = 0; i < reach.stuckDoors.size(); i++) {
+        const MapItem& door = reach.stuckDoors[i];
+        snprintf(line, sizeof(line), "door '%c' at (%d, %d) can't be opened, no '%c' key can be reached",
+                 map.keyTypes[door.type].door, door.x, door.z, map.keyTypes[door.type].key);
+        lines.push_back(line);
+    }
+    for (size_t i = 0; i < lines.size() && i < MAP_MAX_ERRORS; i++) printf("%s: %s\n", path, lines[i].c_str());
+    if (lines.size() > MAP_MAX_ERRORS) printf("%s: %zu more\n", path, lines.size() - MAP_MAX_ERRORS);
+    return reach.goal;
+}
+
+bool sameMap(const Map& a, const Map& b) {
+    if (a.width != b.width || a.height != b.height || a.cells != b.cells || a.blockers != b.blockers ||
+        a.startPos != b.startPos || a.goalPos != b.goalPos || a.keys.size() != b.keys.size() || a.doors.size() != b.doors.size() ||
+        a.keyTypes.size() != b.keyTypes.size())
+        return false;
+    for (size_t t = 0; t < a.keyTypes.size(); t++)
+        if (a.keyTypes[t].key != b.keyTypes[t].key || a.keyTypes[t].door != b.keyTypes[t].door ||
+            memcmp(a.keyTypes[t].color, b.keyTypes[t].color, 3) != 0) return false;
+    for (size_t i = 0; i < a.keys.size(); i++)
+        if (a.keys[i].x != b.keys[i].x || a.keys[i].z != b.keys[i].z || a.keys[i].type != b.keys[i].type) return false;
+    for (size_t i = 0; i < a.doors.size(); i++)
+        if (a.doors[i].x != b.doors[i].x || a.doors[i].z != b.doors[i].z || a.doors[i].type != b.doors[i].type) return false;
+    return true;
+}
+
+int main(int argc, char *argv[]){
+    if (argc < 2) {
+        printf("Usage: %s map.txt [map.txt ...]\n", argv[0]);
+        return 1;
+    }
+    
+    int failed = 0;
+    for (int i = 1; i < argc; i++) {
+        string textPath = argv[i];
+        string binaryPath = mzbPath(textPath);
+        
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        Map map;
+        if (!loadMap(textPath.c_str(), map)) {
+            failed++;
+            continue;
+        }
+        double parseMs = elapsedMs(start);
+        
+        start = chrono::steady_clock::now();
+        Reachability reach = checkReachability(map);
+        double reachMs = elapsedMs(start);
+        bool goalReached = reportReachability(textPath.c_str(), map, reach);
+        
+        start = chrono::steady_clock::now();
+        if (!writeMzbFile(binaryPath.c_str(), map)) {
+            printf("%s: could not write %s\n", textPath.c_str(), binaryPath.c_str());
+            failed++;
+            continue;
+        }
+        double writeMs = elapsedMs(start);
+        
+        // Time the path MazeGame takes and check it gives back the same map
+        start = chrono::steady_clock::now();
+        Map compiled;
+        if (!loadMzbMap(binaryPath.c_str(), compiled)) {
+            failed++;
+            continue;
+        }
+        double loadMs = elapsedMs(start);
+        if (!sameMap(map, compiled)) {
+            printf("%s: %s doesn't load back to the same map\n", textPath.c_str(), binaryPath.c_str());
+            failed++;
+            continue;
+        }
+        
+        MzbFile mzb;
+        if (!openMzbFile(binaryPath.c_str(), mzb)) {
+            failed++;
+            continue;
+        }
+        size_t chunkCount = (size_t)mzb.header->chunksX * mzb.header->chunksZ;
+        size_t encodings[3] = {0, 0, 0};
+        for (size_t c = 0; c < chunkCount; c++) encodings[mzb.chunks[c].encoding]++;
+        size_t binaryBytes = mzb.mapped.size;
+        closeMzbFile(mzb);
+        size_t textBytes = (size_t)(map.width + 1) * map.height;
+        
+        printf("%s -> %s\n", textPath.c_str(), binaryPath.c_str());
+        printf("  %dx%d, %d keys, %d doors, %d key types\n", map.width, map.height, (int)map.keys.size(), (int)map.doors.size(),
+               (int)map.keyTypes.size());
+        printf("  chunks: %zu of %ux%u cells, %zu bit-packed, %zu run-length, %zu raw\n", chunkCount,
+               MZB_CHUNK_SIZE, MZB_CHUNK_SIZE, encodings[MZB_BITS], encodings[MZB_RLE], encodings[MZB_RAW]);
+        printf("  size: %zu bytes as text, %zu compiled (%.1fx smaller)\n", textBytes, binaryBytes, (double)textBytes / binaryBytes);
+        printf("  reachable: %zu of %zu open cells, %d key types, goal %s\n", reach.reached, reach.open,
+               (int)bitset<MAX_KEY_TYPES>(reach.keys).count(), goalReached ? "reached" : "NOT REACHED");
+        printf("  text load %.1f ms, reachability %.1f ms, compile %.1f ms, compiled load %.1f ms\n", parseMs, reachMs, writeMs, loadMs);
+        if (!goalReached) failed++;
+    }
+    
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,1601 @@
+// Benchmarks for the map code, run on generated mazes
+//
+// Usage: ./mazebench grid [size]          cell lookups: nested rows vs flat store vs bit layer
+//        ./mazebench load [size|map.txt]  text map loading: getline vs the mapped loader
+//        ./mazebench parse [size|map.txt] mapped loader scaling over 1-16 threads (default 1 GB map)
+//        ./mazebench stream [size|map.mzb] chunk streaming on a walk across a compiled map (default 100000)
+//        ./mazebench sweep [size]         swept player movement: cost per move and a huge time step stress test
+//        ./mazebench field [size]         distance field: build, door unlocks, move acceptance and sight rays
+//        ./mazebench sim [size]           fixed-step simulation run headless: tick cost and reproducibility
+//        ./mazebench solve [size]         solver on a maze with five key colors, solvable and not (default 10001)
+//        ./mazebench jps [size]           jump point search against plain A*, and jump table updates on door unlocks (default 4097)
+//        ./mazebench hpa [size]           clustered search against jump point search, and cluster updates on door unlocks (default 8193)
+//        ./mazebench bfs [size]           whole-map distances from the start and the goal over 1-16 threads (default 16385)
+//        ./mazebench flood [size]         64-cell flood fill against a cell by cell one, and map reachability checks (default 8193)
+//        ./mazebench flow [size] [agents] agents sharing flow fields against A* per agent, and the field cache (default 2049, 10000)
+//        ./mazebench repair [size]        D* Lite path repair as doors open and walls change against A* replans (default 4097)
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <set>
+#include <fstream>
+#include <cctype>
+#include <chrono>
+#include <thread>
+#include <random>
+#include <bitset>
+#include <functional>
+
+#include "Map.h"
+#include "MapBinary.h"
+#include "MapStream.h"
+#include "DistanceField.h"
+#include "Simulation.h"
+#include "Solver.h"
+#include "JumpPath.h"
+#include "ClusterPath.h"
+#include "PathDistance.h"
+#include "FloodFill.h"
+#include "FlowField.h"
+#include "RepairPath.h"
+
+using namespace std;
+
+double elapsedMs(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Perfect maze carved by an iterative depth-first search over the odd cells
+Map generateMaze(int width, int height, unsigned seed) {
+    Map map;
+    initMap(map, width, height);
+    for (int z = 0; z < height; z++)
+        for (int x = 0; x < width; x++)
+            map.setCell(x, z, 'W');
+    
+    mt19937 rng(seed);
+    vector<pair<int, int>> stack;
+    stack.push_back(make_pair(1, 1));
+    map.setCell(1, 1, '0');
+    const int dx[4] = { 2, -2, 0, 0 };
+    const int dz[4] = { 0, 0, 2, -2 };
+    
+    while (!stack.empty()) {
+        int x = stack.back().first;
+        int z = stack.back().second;
+        int options[4];
+        int count = 0;
+        for (int d = 0; d < 4; d++) {
+            int nx = x + dx[d], nz = z + dz[d];
+            if (nx > 0 && nx < width - 1 && nz > 0 && nz < height - 1 && map.cell(nx, nz) == 'W')
+                options[count++] = d;
+        }
+        if (count == 0) {
+            stack.pop_back();
+            continue;
+        }
+        int d = options[rng() % count];
+        map.setCell(x + dx[d] / 2, z + dz[d] / 2, '0');
+        map.setCell(x + dx[d], z + dz[d], '0');
+        stack.push_back(make_pair(x + dx[d], z + dz[d]));
+    }
+    
+    int gx = (width - 2) | 1, gz = (height - 2) | 1;
+    if (gx >= width - 1) gx -= 2;
+    if (gz >= height - 1) gz -= 2;
+    map.setCell(1, 1, 'S');
+    map.setCell(gx, gz, 'G');
+    map.startPos = glm::vec3(1 * CELL_SIZE, 1.0f, 1 * CELL_SIZE);
+    map.goalPos = glm::vec3(gx * CELL_SIZE, 1.0f, gz * CELL_SIZE);
+    return map;
+}
+
+// Writes the map in the text format the game reads. Generated mazes have no keys or doors,
+// so the cells are written as stored.
+bool writeMapText(const char* path, const Map& map) {
+    FILE* file = fopen(path, "wb");
+    if (!file) return false;
+    fprintf(file, "%d %d\n", map.width, map.height);
+    for (int z = 0; z < map.height; z++) {
+        fwrite(&map.cells[map.index(0, z)], 1, map.width, file);
+        fputc('\n', file);
+    }
+    return fclose(file) == 0;
+}
+
+// ---- grid: lookup throughput of the old nested-vector layout against the flat store ----
+
+// checkCollision as it was written against vector<vector<char>>
+bool nestedCheckCollision(const vector<vector<char>>& grid, int width, int height, glm::vec3 pos, const set<char>& keys) {
+    int gridX = (int)(pos.x / 2.0f + 0.5f);
+    int gridZ = (int)(pos.z / 2.0f + 0.5f);
+    if (gridX < 0 || gridX >= width || gridZ < 0 || gridZ >= height) return true;
+    char cell = grid[gridZ][gridX];
+    if (cell == 'W') return true;
+    if (cell >= 'A' && cell <= 'E' && keys.find(cell - 'A' + 'a') == keys.end()) return true;
+    
+    float radius = 0.3f;
+    glm::vec3 offsets[] = {
+        glm::vec3(radius, 0, radius), glm::vec3(-radius, 0, radius),
+        glm::vec3(radius, 0, -radius), glm::vec3(-radius, 0, -radius)
+    };
+    for (int i = 0; i < 4; i++) {
+        glm::vec3 checkPos = pos + offsets[i];
+        int checkX = (int)(checkPos.x / 2.0f + 0.5f);
+        int checkZ = (int)(checkPos.z / 2.0f + 0.5f);
+        if (checkX < 0 || checkX >= width || checkZ < 0 || checkZ >= height) return true;
+        char checkCell = grid[checkZ][checkX];
+        if (checkCell == 'W') return true;
+        if (checkCell >= 'A' && checkCell <= 'E' && keys.find(checkCell - 'A' + 'a') == keys.end()) return true;
+    }
+    return false;
+}
+
+void reportRate(const char* name, double lookups, double ms, double baselineMs) {
+    printf("  %-28s %8.1f M lookups/s  %6.2fx\n", name, lookups / ms / 1000.0, baselineMs / ms);
+}
+
+int benchGrid(int size) {
+    printf("Generating %dx%d maze\n", size, size);
+    Map map = generateMaze(size, size, 1);
+    
+    // The old layout: one heap allocation per row
+    vector<vector<char>> nested(map.height);
+    for (int z = 0; z < map.height; z++) {
+        nested[z].resize(map.width);
+        for (int x = 0; x < map.width; x++) nested[z][x] = map.cell(x, z);
+    }
+    
+    const int SAMPLES = 1 << 22;
+    mt19937 rng(2);
+    vector<int> xs(SAMPLES), zs(SAMPLES);
+    vector<glm::vec3> positions(SAMPLES);
+    for (int i = 0; i < SAMPLES; i++) {
+        xs[i] = rng() % map.width;
+        zs[i] = rng() % map.height;
+        positions[i] = glm::vec3(xs[i] * CELL_SIZE + (rng() % 1000) / 1000.0f - 0.5f, 1.0f,
+                                 zs[i] * CELL_SIZE + (rng() % 1000) / 1000.0f - 0.5f);
+    }
+    long walls[3] = {0, 0, 0};
+    
+    printf("Random cell reads (%d):\n", SAMPLES);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < SAMPLES; i++) walls[0] += nested[zs[i]][xs[i]] == 'W';
+    double nestedMs = elapsedMs(start);
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < SAMPLES; i++) walls[1] += map.cell(xs[i], zs[i]) == 'W';
+    double flatMs = elapsedMs(start);
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < SAMPLES; i++) walls[2] += map.isBlocker(xs[i], zs[i]);
+    double bitsMs = elapsedMs(start);
+    reportRate("vector<vector<char>>", SAMPLES, nestedMs, nestedMs);
+    reportRate("flat cells", SAMPLES, flatMs, nestedMs);
+    reportRate("blocker bits", SAMPLES, bitsMs, nestedMs);
+    if (walls[0] != walls[1] || walls[1] != walls[2]) printf("  MISMATCH: %ld %ld %ld\n", walls[0], walls[1], walls[2]);
+    
+    // Turn one floor cell in 8 into a door, with keys a and c held: the old code searches a
+    // set<char> for each door, the key mask is one shift
+    for (int z = 0; z < map.height; z++) {
+        for (int x = 0; x < map.width; x++) {
+            if (map.cell(x, z) != '0' || rng() % 8) continue;
+            int type = rng() % 5;
+            nested[z][x] = 'A' + type;
+            map.setCell(x, z, doorCell(type));
+        }
+    }
+    set<char> keySet;
+    keySet.insert('a');
+    keySet.insert('c');
+    KeyMask keyMask = (1ull << 0) | (1ull << 2);
+    
+    printf("Collision queries, 5 cells each (%d):\n", SAMPLES);
+    long hits[2] = {0, 0};
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < SAMPLES; i++) hits[0] += nestedCheckCollision(nested, map.width, map.height, positions[i], keySet);
+    nestedMs = elapsedMs(start);
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < SAMPLES; i++) hits[1] += checkCollision(map, positions[i], keyMask);
+    flatMs = elapsedMs(start);
+    reportRate("vector<vector<char>> + set", SAMPLES * 5.0, nestedMs, nestedMs);
+    reportRate("blocker bits + key mask", SAMPLES * 5.0, flatMs, nestedMs);
+    if (hits[0] != hits[1]) printf("  MISMATCH: %ld %ld\n", hits[0], hits[1]);
+    
+    double cells = (double)map.width * map.height;
+    printf("Full grid scans (%.0f cells):\n", cells);
+    long count[2] = {0, 0};
+    start = chrono::steady_clock::now();
+    for (int z = 0; z < map.height; z++)
+        for (int x = 0; x < map.width; x++) count[0] += nested[z][x] == 'W';
+    nestedMs = elapsedMs(start);
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < map.cells.size(); i++) count[1] += map.cells[i] == 'W';
+    flatMs = elapsedMs(start);
+    reportRate("vector<vector<char>>", cells, nestedMs, nestedMs);
+    reportRate("flat cells", cells, flatMs, nestedMs);
+    if (count[0] != count[1]) printf("  MISMATCH: %ld %ld\n", count[0], count[1]);
+    
+    return 0;
+}
+
+// ---- load: the mapped single-pass loader against the getline loader it replaced ----
+
+// loadMap as it was: getline per row, one setCell per character
+Map getlineLoadMap(const string& filename) {
+    Map map;
+    ifstream file(filename);
+    int width = 0, height = 0;
+    file >> width >> height;
+    initMap(map, width, height);
+    string line;
+    getline(file, line);
+    for (int y = 0; y < map.height; y++) {
+        getline(file, line);
+        for (int x = 0; x < map.width && x < (int)line.length(); x++) {
+            map.setCell(x, y, line[x]);
+            if (line[x] == 'S') map.startPos = glm::vec3(x * CELL_SIZE, 1.0f, y * CELL_SIZE);
+            if (line[x] == 'G') map.goalPos = glm::vec3(x * CELL_SIZE, 1.0f, y * CELL_SIZE);
+        }
+    }
+    return map;
+}
+
+int benchLoad(const string& arg) {
+    string path = arg;
+    if (arg.empty() || isdigit((unsigned char)arg[0])) {
+        int size = arg.empty() ? 8192 : atoi(arg.c_str());
+        path = "/tmp/mazebench_load.txt";
+        printf("Writing %dx%d maze to %s\n", size, size, path.c_str());
+        if (!writeMapText(path.c_str(), generateMaze(size, size, 1))) {
+            printf("Can't write %s\n", path.c_str());
+            return 1;
+        }
+    }
+    
+    // Warm the page cache so both loaders read from memory
+    Map map;
+    if (!loadMap(path.c_str(), map, 1)) return 1;
+    double megabytes = ((double)(map.width + 1) * map.height) / (1024.0 * 1024.0);
+    
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    Map legacy = getlineLoadMap(path);
+    double getlineMs = elapsedMs(start);
+    
+    start = chrono::steady_clock::now();
+    bool loaded = loadMap(path.c_str(), map, 1);
+    double mappedMs = elapsedMs(start);
+    
+    printf("%s: %dx%d, %.1f MB, %d keys, %d doors\n", path.c_str(), map.width, map.height, megabytes,
+           (int)map.keys.size(), (int)map.doors.size());
+    printf("  getline       %9.1f ms  %7.1f MB/s\n", getlineMs, megabytes / getlineMs * 1000.0);
+    printf("  mapped        %9.1f ms  %7.1f MB/s  %6.2fx\n", mappedMs, megabytes / mappedMs * 1000.0, getlineMs / mappedMs);
+    if (!loaded || legacy.cells != map.cells || legacy.blockers != map.blockers ||
+        legacy.startPos != map.startPos || legacy.goalPos != map.goalPos)
+        printf("  MISMATCH between loaders\n");
+    return 0;
+}
+
+// ---- parse: loader scaling with thread count on a map of a gigabyte or more ----
+
+// Streams a binary tree maze straight to disk, so maps larger than the generator could
+// hold in memory can be written. Keys and doors are sprinkled over the floor.
+bool writeStreamedMaze(const char* path, int width, int height, unsigned seed) {
+    FILE* file = fopen(path, "wb");
+    if (!file) return false;
+    fprintf(file, "%d %d\n", width, height);
+    
+    mt19937 rng(seed);
+    int lastX = (width - 2) | 1, lastZ = (height - 2) | 1;
+    if (lastX >= width - 1) lastX -= 2;
+    if (lastZ >= height - 1) lastZ -= 2;
+    vector<char> row(width + 1), south(width + 1);
+    row[width] = south[width] = '\n';
+    memset(row.data(), 'W', width);
+    fwrite(row.data(), 1, width + 1, file);
+    int written = 1;
+    
+    // Every odd cell opens east or south, so all paths lead to the bottom right corner
+    for (int z = 1; z <= lastZ; z += 2) {
+        memset(row.data(), 'W', width);
+        memset(south.data(), 'W', width);
+        for (int x = 1; x <= lastX; x += 2) {
+            row[x] = rng() % 100000 ? '0' : (rng() & 1 ? 'a' : 'A') + rng() % 5;
+            bool canEast = x < lastX, canSouth = z < lastZ;
+            if (canEast && (!canSouth || (rng() & 1))) row[x + 1] = '0';
+            else if (canSouth) south[x] = '0';
+        }
+        if (z == 1) row[1] = 'S';
+        if (z == lastZ) row[lastX] = 'G';
+        fwrite(row.data(), 1, width + 1, file);
+        fwrite(south.data(), 1, width + 1, file);
+        written += 2;
+    }
+    memset(row.data(), 'W', width);
+    for (; written < height; written++) fwrite(row.data(), 1, width + 1, file);
+    return fclose(file) == 0;
+}
+
+// Cheap fingerprint of the loaded cells and bits, to check every thread count agrees
+uint64_t mapFingerprint(const Map& map) {
+    uint64_t hash = 0;
+    const char* cells = map.cells.data();
+    for (size_t i = 0; i + 8 <= map.cells.size(); i += 8) {
+        uint64_t word;
+        memcpy(&word, cells + i, 8);
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+    }
+    for (size_t i = 0; i < map.blockers.size(); i++) hash = (hash ^ map.blockers[i]) * 0x9E3779B97F4A7C15ull;
+    return hash ^ map.keys.size() ^ (map.doors.size() << 32);
+}
+
+int benchParse(const string& arg) {
+    string path = arg;
+    if (arg.empty() || isdigit((unsigned char)arg[0])) {
+        int size = arg.empty() ? 32768 : atoi(arg.c_str());
+        path = "/tmp/mazebench_parse.txt";
+        printf("Writing %dx%d maze to %s\n", size, size, path.c_str());
+        if (!writeStreamedMaze(path.c_str(), size, size, 1)) {
+            printf("Can't write %s\n", path.c_str());
+            return 1;
+        }
+    }
+    
+    Map map;
+    if (!loadMap(path.c_str(), map, 1)) return 1;
+    double megabytes = ((double)(map.width + 1) * map.height) / (1024.0 * 1024.0);
+    printf("%s: %dx%d, %.1f MB, %d keys, %d doors, %d cores\n", path.c_str(), map.width, map.height, megabytes,
+           (int)map.keys.size(), (int)map.doors.size(), (int)thread::hardware_concurrency());
+    uint64_t expected = mapFingerprint(map);
+    
+    const int threadCounts[] = { 1, 2, 4, 8, 16 };
+    double singleMs = 0;
+    for (int i = 0; i < 5; i++) {
+        map = Map();   // free the previous load so every run faults its pages in fresh
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        bool loaded = loadMap(path.c_str(), map, threadCounts[i]);
+        double ms = elapsedMs(start);
+        if (i == 0) singleMs = ms;
+        printf("  %2d threads  %9.1f ms  %7.1f MB/s  %6.2fx%s\n", threadCounts[i], ms, megabytes / ms * 1000.0, singleMs / ms,
+               loaded && mapFingerprint(map) == expected ? "" : "  MISMATCH");
+    }
+    return 0;
+}
+
+// ---- stream: chunk streaming while walking across a map larger than memory ----
+
+// Same binary tree maze as writeStreamedMaze, compiled to .mzb one band of chunk rows at a
+// time. A key is always placed at (3, 1), next to the start, for the eviction check.
+bool writeStreamedMzb(const char* path, int width, int height, unsigned seed) {
+    MzbWriter writer;
+    if (!beginMzbFile(writer, path, width, height)) {
+        if (writer.file) fclose(writer.file);
+        return false;
+    }
+    
+    mt19937 rng(seed);
+    int lastX = (width - 2) | 1, lastZ = (height - 2) | 1;
+    if (lastX >= width - 1) lastX -= 2;
+    if (lastZ >= height - 1) lastZ -= 2;
+    vector<MapItem> keys, doors;
+    vector<char> band((size_t)width * MZB_CHUNK_SIZE), south(width, 'W');
+    for (int z0 = 0; z0 < height; z0 += MZB_CHUNK_SIZE) {
+        int rows = min((int)MZB_CHUNK_SIZE, height - z0);
+        for (int z = z0; z < z0 + rows; z++) {
+            char* row = &band[(size_t)(z - z0) * width];
+            if (z % 2 == 0 || z > lastZ) {
+                // South openings of the row above, or solid wall
+                if (z > 0 && z <= lastZ + 1) memcpy(row, south.data(), width);
+                else memset(row, 'W', width);
+                continue;
+            }
+            
+            memset(row, 'W', width);
+            memset(south.data(), 'W', width);
+            for (int x = 1; x <= lastX; x += 2) {
+                row[x] = '0';
+                if (rng() % 100000 == 0) {
+                    bool key = rng() & 1;
+                    int type = rng() % 5;
+                    row[x] = key ? keyCell(type) : doorCell(type);
+                }
+                if (z == 1 && x == 3) row[x] = keyCell(0);
+                if (row[x] != '0') {
+                    MapItem item = { x, z, (uint8_t)cellKeyType(row[x]) };
+                    (isKeyCell(row[x]) ? keys : doors).push_back(item);
+                }
+                bool canEast = x < lastX, canSouth = z < lastZ;
+                if (canEast && (!canSouth || (rng() & 1))) row[x + 1] = '0';
+                else if (canSouth) south[x] = '0';
+            }
+            if (z == 1) row[1] = 'S';
+            if (z == lastZ) row[lastX] = 'G';
+        }
+        if (!writeMzbBand(writer, band.data(), width)) break;
+    }
+    return finishMzbFile(writer, 1, 1, lastX, lastZ, keys, doors, defaultKeyTypes());
+}
+
+int benchStream(const string& arg) {
+    string path = arg;
+    if (arg.empty() || isdigit((unsigned char)arg[0])) {
+        int size = arg.empty() ? 100000 : atoi(arg.c_str());
+        path = "/tmp/mazebench_stream.mzb";
+        printf("Writing %dx%d maze to %s\n", size, size, path.c_str());
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (!writeStreamedMzb(path.c_str(), size, size, 1)) {
+            printf("Can't write %s\n", path.c_str());
+            return 1;
+        }
+        printf("  written in %.1f s\n", elapsedMs(start) / 1000.0);
+    }
+    
+    MapStream stream;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (!openMapStream(path.c_str(), stream)) return 1;
+    printf("%s: %dx%d, %d chunks, opened in %.1f ms\n", path.c_str(), stream.width, stream.height,
+           stream.chunksX * stream.chunksZ, elapsedMs(start));
+    
+    // Pick up a key by the start, then walk diagonally to the far corner and back so its
+    // chunk is evicted and reloaded
+    int keyX = worldToCell(stream.startPos.x) + 2, keyZ = worldToCell(stream.startPos.z);
+    if (isKeyCell(stream.cell(keyX, keyZ))) stream.setCell(keyX, keyZ, '0');
+    else printf("No key at (%d, %d) to pick up\n", keyX, keyZ);
+    int keyChunk = stream.chunkIndex(keyX, keyZ);
+    
+    // Each update stands in for a frame: the player moves STREAM_BENCH_STEP cells, far faster
+    // than walking, and the rest of the frame gives the I/O thread a millisecond
+    const int STREAM_BENCH_STEP = 4;
+    int last = min(stream.width, stream.height) - 1;
+    double totalMs = 0, maxMs = 0;
+    int updates = 0, misses = 0, maxResident = 0, installed = 0;
+    size_t maxBytes = 0;
+    bool keyEvicted = false;
+    for (int leg = 0; leg < 2; leg++) {
+        for (int i = 0; i <= last; i += STREAM_BENCH_STEP) {
+            int p = leg == 0 ? i : last - i;
+            chrono::steady_clock::time_point stepStart = chrono::steady_clock::now();
+            installed += updateMapStream(stream, p, p);
+            double ms = elapsedMs(stepStart);
+            totalMs += ms;
+            maxMs = max(maxMs, ms);
+            updates++;
+            
+            // Steps taken before the chunk underfoot arrived
+            if (stream.slots[stream.chunkIndex(p, p)] < 0) misses++;
+            if (stream.slots[keyChunk] == STREAM_ABSENT) keyEvicted = true;
+            maxResident = max(maxResident, (int)stream.resident.size());
+            maxBytes = max(maxBytes, mapStreamBytes(stream));
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+    }
+    flushMapStream(stream);
+    
+    printf("  %d updates: %.4f ms avg, %.3f ms max, %d chunks installed\n", updates, totalMs / updates, maxMs, installed);
+    printf("  at most %d chunks resident, %.1f KB (whole map %.1f MB)\n", maxResident, maxBytes / 1024.0,
+           (double)stream.width * stream.height / (1024.0 * 1024.0));
+    printf("  %d steps onto chunks still loading\n", misses);
+    bool kept = stream.cell(keyX, keyZ) == '0' && !stream.isBlocker(keyX, keyZ);
+    printf("  key at (%d, %d) %s, pickup %s\n", keyX, keyZ, keyEvicted ? "evicted and reloaded" : "never evicted",
+           kept ? "kept" : "LOST");
+    closeMapStream(stream);
+    return kept && keyEvicted ? 0 : 1;
+}
+
+// ---- sweep: swept player movement, its cost and a stress test with huge time steps ----
+
+// Locked doors on one floor cell in every; with no keys held they block like walls
+void addLockedDoors(Map& map, mt19937& rng, int every = 16) {
+    for (int z = 1; z < map.height - 1; z++) {
+        for (int x = 1; x < map.width - 1; x++) {
+            if (map.cell(x, z) != '0' || rng() % every != 0) continue;
+            MapItem door = { x, z, (uint8_t)(rng() % 5) };
+            map.setCell(x, z, doorCell(door.type));
+            map.doors.push_back(door);
+        }
+    }
+}
+
+// Floor cell centers to start from, with the circle a little off center
+glm::vec3 randomStart(const Map& map, mt19937& rng) {
+    for (;;) {
+        int x = rng() % map.width, z = rng() % map.height;
+        if (map.isBlocker(x, z)) continue;
+        float jitter = 1.0f - PLAYER_RADIUS - 0.01f;
+        return glm::vec3(x * CELL_SIZE + ((rng() % 2001) / 1000.0f - 1.0f) * jitter, 1.0f,
+                         z * CELL_SIZE + ((rng() % 2001) / 1000.0f - 1.0f) * jitter);
+    }
+}
+
+glm::vec3 randomMove(mt19937& rng, float length) {
+    float angle = (rng() % 36000) * 3.14159265f / 18000.0f;
+    return glm::vec3(cos(angle), 0.0f, sin(angle)) * length;
+}
+
+// How far inside the circle the nearest blocker around its center reaches, 0 if none does
+float blockerOverlap(const Map& map, glm::vec3 pos, KeyMask keys) {
+    int cx = (int)floor(pos.x / CELL_SIZE + 0.5f), cz = (int)floor(pos.z / CELL_SIZE + 0.5f);
+    float overlap = 0;
+    for (int z = cz - 1; z <= cz + 1; z++) {
+        for (int x = cx - 1; x <= cx + 1; x++) {
+            if (!blocksPlayer(map, x, z, keys)) continue;
+            glm::vec2 center(x * CELL_SIZE, z * CELL_SIZE), p(pos.x, pos.z);
+            glm::vec2 closest = glm::clamp(p, center - CELL_SIZE * 0.5f, center + CELL_SIZE * 0.5f);
+            overlap = max(overlap, PLAYER_RADIUS - glm::length(p - closest));
+        }
+    }
+    return overlap;
+}
+
+// Whether (x1, z1) is at most maxSteps open cells from (x0, z0). A move that lands further
+// away along the corridors than it is long went through a wall.
+bool withinSteps(const Map& map, int x0, int z0, int x1, int z1, int maxSteps, KeyMask keys,
+                 vector<unsigned>& seen, unsigned stamp) {
+    vector<pair<int, int>> frontier(1, make_pair(x0, z0)), next;
+    seen[map.index(x0, z0)] = stamp;
+    const int dx[4] = { 1, -1, 0, 0 };
+    const int dz[4] = { 0, 0, 1, -1 };
+    for (int step = 0; step <= maxSteps && !frontier.empty(); step++) {
+        next.clear();
+        for (size_t i = 0; i < frontier.size(); i++) {
+            if (frontier[i].first == x1 && frontier[i].second == z1) return true;
+            for (int d = 0; d < 4; d++) {
+                int nx = frontier[i].first + dx[d], nz = frontier[i].second + dz[d];
+                if (blocksPlayer(map, nx, nz, keys) || seen[map.index(nx, nz)] == stamp) continue;
+                seen[map.index(nx, nz)] = stamp;
+                next.push_back(make_pair(nx, nz));
+            }
+        }
+        frontier.swap(next);
+    }
+    return false;
+}
+
+int benchSweep(int size) {
+    printf("Generating %dx%d maze with locked doors\n", size, size);
+    Map map = generateMaze(size, size, 1);
+    mt19937 rng(3);
+    addLockedDoors(map, rng);
+    KeyMask keys = 0;
+    
+    // Cost against the move length: a 60 fps frame, a cell, and frames after long stalls
+    const int SAMPLES = 1 << 20;
+    const float lengths[] = { 0.05f, CELL_SIZE, 10 * CELL_SIZE, 100 * CELL_SIZE };
+    vector<glm::vec3> starts(SAMPLES), moves(SAMPLES);
+    printf("Moves (%d each):\n", SAMPLES);
+    for (int l = 0; l < 4; l++) {
+        for (int i = 0; i < SAMPLES; i++) {
+            starts[i] = randomStart(map, rng);
+            moves[i] = randomMove(rng, lengths[l]);
+        }
+        
+        double moved = 0;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (int i = 0; i < SAMPLES; i++) {
+            glm::vec3 end = sweepPlayer(map, starts[i], moves[i], keys);
+            moved += fabs(end.x - starts[i].x) + fabs(end.z - starts[i].z);
+        }
+        double sweepMs = elapsedMs(start);
+        
+        // The point test it replaced, which only looks at where the move ends
+        long blocked = 0;
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < SAMPLES; i++) blocked += checkCollision(map, starts[i] + moves[i], keys);
+        double pointMs = elapsedMs(start);
+        
+        // Every cell the center enters costs one DDA step and 9 blocker tests
+        double cellsCrossed = SAMPLES + moved / CELL_SIZE;
+        printf("  %7.2f units  sweep %7.1f ns (%5.1f ns per cell crossed), point test %5.1f ns, %5.1f%% of point tests blocked\n",
+               lengths[l], sweepMs * 1e6 / SAMPLES, sweepMs * 1e6 / cellsCrossed, pointMs * 1e6 / SAMPLES,
+               100.0 * blocked / SAMPLES);
+    }
+    
+    // Random walk with time steps from a frame to minutes: the circle must never end up in
+    // a wall or a locked door, or in a corridor it couldn't have walked to
+    const int STEPS = 200000;
+    const float stepLengths[] = { 0.05f, 0.5f, 5.0f, 50.0f, 500.0f, 5000.0f };
+    vector<unsigned> seen(map.cells.size(), 0);
+    glm::vec3 pos = map.startPos;
+    int overlaps = 0, tunnels = 0, stuck = 0;
+    float worstOverlap = 0;
+    double distance = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < STEPS; i++) {
+        float length = stepLengths[rng() % 6];
+        glm::vec3 end = sweepPlayer(map, pos, randomMove(rng, length), keys);
+        
+        float overlap = blockerOverlap(map, end, keys);
+        worstOverlap = max(worstOverlap, overlap);
+        if (overlap > 1e-4f) overlaps++;
+        int x0 = (int)floor(pos.x / CELL_SIZE + 0.5f), z0 = (int)floor(pos.z / CELL_SIZE + 0.5f);
+        int x1 = (int)floor(end.x / CELL_SIZE + 0.5f), z1 = (int)floor(end.z / CELL_SIZE + 0.5f);
+        int maxSteps = (int)(length / CELL_SIZE) + 2;
+        if (!map.inBounds(x1, z1) || !withinSteps(map, x0, z0, x1, z1, maxSteps, keys, seen, i + 1)) tunnels++;
+        if (end == pos) stuck++;
+        distance += glm::length(end - pos);
+        pos = end;
+    }
+    printf("Stress: %d steps of %.2f to %.0f units in %.1f ms, %.0f units walked, %d steps didn't move\n",
+           STEPS, stepLengths[0], stepLengths[5], elapsedMs(start), distance, stuck);
+    printf("  %d ended overlapping a blocker (worst %.5f), %d went through one\n", overlaps, worstOverlap, tunnels);
+    return overlaps || tunnels ? 1 : 0;
+}
+
+// ---- field: the distance field against the sweep and cell walks it shortcuts ----
+
+// Open floor with scattered square pillars and locked doors standing in the open. Only four
+// doors are of key 0, like a hand made map, the rest open by the other four keys.
+Map generateArena(int width, int height, unsigned seed) {
+    Map map;
+    initMap(map, width, height);
+    for (int x = 0; x < width; x++) {
+        map.setCell(x, 0, 'W');
+        map.setCell(x, height - 1, 'W');
+    }
+    for (int z = 0; z < height; z++) {
+        map.setCell(0, z, 'W');
+        map.setCell(width - 1, z, 'W');
+    }
+    
+    mt19937 rng(seed);
+    long pillars = (long)width * height / 2000;
+    for (long i = 0; i < pillars; i++) {
+        int size = 1 + rng() % 4;
+        int px = 1 + rng() % (width - 1 - size), pz = 1 + rng() % (height - 1 - size);
+        for (int z = pz; z < pz + size; z++)
+            for (int x = px; x < px + size; x++)
+                map.setCell(x, z, 'W');
+    }
+    long doors = (long)width * height / 1000;
+    for (long i = 0; i < doors; i++) {
+        MapItem door = { 1 + (int)(rng() % (width - 2)), 1 + (int)(rng() % (height - 2)), (uint8_t)(i < 4 ? 0 : 1 + rng() % 4) };
+        if (map.cell(door.x, door.z) != '0') continue;
+        map.setCell(door.x, door.z, doorCell(door.type));
+        map.doors.push_back(door);
+    }
+    
+    map.setCell(1, 1, 'S');
+    map.startPos = glm::vec3(1 * CELL_SIZE, 1.0f, 1 * CELL_SIZE);
+    return map;
+}
+
+// The cell by cell walk traceField replaces: how far along from -> to the segment enters
+// the first blocker, or 1
+float traceCells(const Map& map, KeyMask keys, glm::vec2 from, glm::vec2 to) {
+    glm::vec2 p = from + 0.5f;
+    glm::vec2 d = to - from;
+    int x = (int)floor(p.x);
+    int z = (int)floor(p.y);
+    int stepX = d.x > 0 ? 1 : -1;
+    int stepZ = d.y > 0 ? 1 : -1;
+    float tDeltaX = d.x != 0 ? fabs(1.0f / d.x) : INFINITY;
+    float tDeltaZ = d.y != 0 ? fabs(1.0f / d.y) : INFINITY;
+    float tMaxX = d.x != 0 ? (d.x > 0 ? x + 1 - p.x : p.x - x) * tDeltaX : INFINITY;
+    float tMaxZ = d.y != 0 ? (d.y > 0 ? z + 1 - p.y : p.y - z) * tDeltaZ : INFINITY;
+    
+    float t = 0;
+    for (;;) {
+        if (blocksPlayer(map, x, z, keys)) return t;
+        if (tMaxX > 1.0f && tMaxZ > 1.0f) return 1.0f;
+        if (tMaxX < tMaxZ) {
+            t = tMaxX;
+            x += stepX;
+            tMaxX += tDeltaX;
+        } else {
+            t = tMaxZ;
+            z += stepZ;
+            tMaxZ += tDeltaZ;
+        }
+    }
+}
+
+void benchFieldMap(const char* name, const Map& map, mt19937& rng) {
+    printf("%s, %dx%d, %d locked doors:\n", name, map.width, map.height, (int)map.doors.size());
+    DistanceField field;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    buildDistanceField(map, 0, field);
+    double buildMs = elapsedMs(start);
+    printf("  build %.1f ms, %.1f M cells/s\n", buildMs, (double)map.width * map.height / buildMs / 1e3);
+    
+    // Doors open one key type at a time, against rebuilding the whole field each time
+    DistanceField incremental = field, rebuilt;
+    KeyMask keys = 0;
+    for (int type = 0; type < 5; type++) {
+        keys |= 1ull << type;
+        start = chrono::steady_clock::now();
+        int opened = unlockFieldDoors(map, incremental, keys);
+        double unlockMs = elapsedMs(start);
+        start = chrono::steady_clock::now();
+        buildDistanceField(map, keys, rebuilt);
+        double rebuildMs = elapsedMs(start);
+        printf("  unlock key %d: %6d doors in %7.2f ms, rebuild %7.1f ms, %s\n", type, opened, unlockMs, rebuildMs,
+               incremental.steps == rebuilt.steps ? "same field" : "FIELDS DIFFER");
+    }
+    
+    // Frame-sized and cell-sized moves with every door locked: how many the field accepts
+    // alone, and what that saves over always sweeping. The moves follow short random walks
+    // so that, as in the game, each one starts where the last ended.
+    const int SAMPLES = 1 << 20;
+    const float lengths[] = { 0.05f, 0.2f, CELL_SIZE };
+    vector<glm::vec3> starts(SAMPLES), moves(SAMPLES);
+    for (int l = 0; l < 3; l++) {
+        glm::vec3 pos;
+        for (int i = 0; i < SAMPLES; i++) {
+            if (i % 256 == 0) pos = randomStart(map, rng);
+            starts[i] = pos;
+            moves[i] = randomMove(rng, lengths[l]);
+            pos = sweepPlayer(map, pos, moves[i], 0);
+        }
+        
+        int accepted = 0;
+        for (int i = 0; i < SAMPLES; i++) {
+            float clearance = fieldClearance(field, glm::vec2(starts[i].x, starts[i].z) / CELL_SIZE) * CELL_SIZE;
+            accepted += lengths[l] + PLAYER_RADIUS <= clearance;
+        }
+        
+        vector<glm::vec3> swept(SAMPLES), moved(SAMPLES);
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < SAMPLES; i++) swept[i] = sweepPlayer(map, starts[i], moves[i], 0);
+        double sweepMs = elapsedMs(start);
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < SAMPLES; i++) moved[i] = movePlayer(map, field, starts[i], moves[i], 0);
+        double fieldMs = elapsedMs(start);
+        
+        int differ = 0;
+        for (int i = 0; i < SAMPLES; i++) differ += glm::length(swept[i] - moved[i]) > 1e-4f;
+        printf("  %5.2f unit moves: %5.1f%% accepted by the field, %6.1f ns vs %6.1f ns swept, %d end elsewhere\n",
+               lengths[l], 100.0 * accepted / SAMPLES, fieldMs * 1e6 / SAMPLES, sweepMs * 1e6 / SAMPLES, differ);
+    }
+    
+    // Sight rays as the PVS casts them, up to 50 cells from a point of an open cell
+    const int RAYS = 1 << 20;
+    vector<glm::vec2> from(RAYS), to(RAYS);
+    for (int i = 0; i < RAYS; i++) {
+        glm::vec3 p = randomStart(map, rng);
+        glm::vec3 ray = randomMove(rng, 50.0f);
+        from[i] = glm::vec2(p.x, p.z) / CELL_SIZE;
+        to[i] = from[i] + glm::vec2(ray.x, ray.z);
+    }
+    vector<float> cellHits(RAYS), fieldHits(RAYS);
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < RAYS; i++) cellHits[i] = traceCells(map, 0, from[i], to[i]);
+    double cellsMs = elapsedMs(start);
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < RAYS; i++) fieldHits[i] = traceField(field, from[i], to[i]);
+    double fieldMs = elapsedMs(start);
+    
+    int differ = 0;
+    double reach = 0;
+    for (int i = 0; i < RAYS; i++) {
+        differ += fabs(cellHits[i] - fieldHits[i]) * 50.0f > 1e-2f;
+        reach += cellHits[i] * 50.0;
+    }
+    printf("  sight rays: %.1f cells to the first blocker on average, %.1f ns vs %.1f ns cell by cell, %d differ\n",
+           reach / RAYS, fieldMs * 1e6 / RAYS, cellsMs * 1e6 / RAYS, differ);
+}
+
+int benchField(int size) {
+    mt19937 rng(5);
+    Map maze = generateMaze(size, size, 1);
+    addLockedDoors(maze, rng);
+    benchFieldMap("Maze", maze, rng);
+    Map arena = generateArena(size, size, 2);
+    benchFieldMap("Arena", arena, rng);
+    return 0;
+}
+
+// ---- sim: the fixed-step simulation run headless, its cost and reproducibility ----
+
+// Keys of random types on one floor cell in every
+void addKeys(Map& map, mt19937& rng, int every = 64) {
+    for (int z = 1; z < map.height - 1; z++) {
+        for (int x = 1; x < map.width - 1; x++) {
+            if (map.cell(x, z) != '0' || rng() % every != 0) continue;
+            MapItem key = { x, z, (uint8_t)(rng() % 5) };
+            map.setCell(x, z, keyCell(key.type));
+            map.keys.push_back(key);
+        }
+    }
+}
+
+// Scripted controls: every quarter second of game time turn by up to 60 degrees either way,
+// mostly walking forward with the odd step back or sideways
+void scriptInput(SimInput& input, mt19937& rng) {
+    input.yaw += (float)(rng() % 121) - 60.0f;
+    input.forward = rng() % 8 != 0;
+    input.back = !input.forward && rng() % 2 == 0;
+    input.left = rng() % 8 == 0;
+    input.right = !input.left && rng() % 8 == 0;
+}
+
+uint64_t stateFingerprint(const SimState& state) {
+    uint64_t hash = 14695981039346656037ull;
+    const unsigned char* bytes[3] = { (const unsigned char*)&state.position, (const unsigned char*)&state.keys,
+                                      (const unsigned char*)&state.tick };
+    const size_t sizes[3] = { sizeof(state.position), sizeof(state.keys), sizeof(state.tick) };
+    for (int i = 0; i < 3; i++)
+        for (size_t j = 0; j < sizes[i]; j++) hash = (hash ^ bytes[i][j]) * 1099511628211ull;
+    return hash;
+}
+
+// Runs the script for the given game time, either tick by tick or through the clock fed
+// with random frame lengths, and returns the final state
+SimState runScript(const Map& original, int hz, double seconds, unsigned frameSeed, double& ms) {
+    Map map = original;
+    DistanceField field;
+    buildDistanceField(map, 0, field);
+    SimWorld world = { &map, &field, NULL };
+    SimState state = startSimulation(map.startPos);
+    uint64_t ticks = (uint64_t)(seconds * hz);
+    SimInput input = { 45.0f, true, false, false, false };
+    mt19937 script(1), frames(frameSeed);
+    SimClock clock = makeSimClock(hz);
+    
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    while (state.tick < ticks) {
+        int due = frameSeed == 0 ? 1 : advanceSimClock(clock, (1 + frames() % 50) / 1000.0);
+        for (int i = 0; i < due && state.tick < ticks; i++) {
+            if (state.tick * 4 / hz != (state.tick + 1) * 4 / hz) scriptInput(input, script);
+            stepSimulation(state, input, (float)clock.tickSeconds, world);
+        }
+    }
+    ms = elapsedMs(start);
+    return state;
+}
+
+int benchSim(int size) {
+    printf("Generating %dx%d arena with keys and locked doors\n", size, size);
+    Map map = generateArena(size, size, 2);
+    mt19937 rng(7);
+    addKeys(map, rng);
+    
+    // Ten minutes of play at each rate; the tick rate changes the path, the frame rate mustn't
+    const double SECONDS = 600;
+    const int rates[] = { 30, 60, 120, 240, 1000 };
+    int failures = 0;
+    for (int r = 0; r < 5; r++) {
+        double ms, clockMs;
+        SimState ticked = runScript(map, rates[r], SECONDS, 0, ms);
+        SimState clocked = runScript(map, rates[r], SECONDS, r + 1, clockMs);
+        bool same = stateFingerprint(ticked) == stateFingerprint(clocked);
+        failures += !same;
+        printf("  %4d Hz: %7llu ticks, %.3f us per tick, ends at (%.3f, %.3f) with %d keys, %016llx, %s\n", rates[r],
+               (unsigned long long)ticked.tick, ms * 1e3 / ticked.tick, ticked.position.x, ticked.position.z,
+               (int)bitset<MAX_KEY_TYPES>(ticked.keys).count(), (unsigned long long)stateFingerprint(ticked),
+               same ? "same with random frame times" : "DIFFERS WITH RANDOM FRAME TIMES");
+    }
+    return failures ? 1 : 0;
+}
+
+// ---- solve: the (cell, keys) search on a large maze with five key colors ----
+
+void reportSolve(const char* name, const Map& map) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    Solution solution = solveMap(map);
+    double ms = elapsedMs(start);
+    if (solution.solved)
+        printf("  %s: %zu steps, %d keys picked up, %s\n", name, solution.moves.size(), (int)solution.pickups.size(),
+               checkSolution(map, solution.moves) ? "replays to the goal" : "DOESN'T REPLAY TO THE GOAL");
+    else
+        printf("  %s: no solution\n", name);
+    printf("    %llu states over %d key sets in %.0f ms, %.1f M states/s, %.0f MB of visited marks\n",
+           (unsigned long long)solution.states, solution.keyMasks, ms, solution.states / ms / 1e3, solution.bytes / 1048576.0);
+}
+
+int benchSolve(int size) {
+    printf("Generating %dx%d maze with keys and locked doors of five colors\n", size, size);
+    Map map = generateMaze(size, size, 1);
+    mt19937 rng(3);
+    addLockedDoors(map, rng, 4096);
+    addKeys(map, rng, 64);
+    printf("%d doors, %d keys\n", (int)map.doors.size(), (int)map.keys.size());
+    reportSolve("all keys", map);
+    
+    // Without the red keys every red door stays shut, the search has to exhaust the rest
+    for (size_t i = 0; i < map.keys.size(); i++)
+        if (map.keys[i].type == 0) map.setCell(map.keys[i].x, map.keys[i].z, '0');
+    reportSolve("no red keys", map);
+    
+    // The most layers there can be: an open arena where every set of the five keys can be
+    // held somewhere, with the goal walled in so that all of them are searched
+    int arenaSize = max(size / 4, 16);
+    printf("%dx%d arena with the goal walled in\n", arenaSize, arenaSize);
+    Map arena = generateArena(arenaSize, arenaSize, 2);
+    addKeys(arena, rng, 64);
+    int gx = arenaSize - 3, gz = arenaSize - 3;
+    for (int z = gz - 1; z <= gz + 1; z++)
+        for (int x = gx - 1; x <= gx + 1; x++)
+            arena.setCell(x, z, 'W');
+    arena.setCell(gx, gz, 'G');
+    arena.goalPos = glm::vec3(gx * CELL_SIZE, 1.0f, gz * CELL_SIZE);
+    reportSolve("walled in goal", arena);
+    return 0;
+}
+
+// ---- jps: jump point search against A* over every cell ----
+
+// Plain A* with the Manhattan distance, one cell at a time; returns the path length or -1
+int findCellPath(const Map& map, KeyMask keys, JumpSearch& search, int sx, int sz, int gx, int gz) {
+    size_t cells = (size_t)map.width * map.height;
+    if (search.stamp.size() != cells) {
+        search.stamp.assign(cells, 0);
+        search.g.resize(cells);
+        search.closed.resize(cells);
+        search.current = 0;
+    }
+    search.current++;
+    search.expanded = 0;
+    search.open.clear();
+    if (blocksPlayer(map, sx, sz, keys) || blocksPlayer(map, gx, gz, keys)) return -1;
+    
+    uint32_t goal = (uint32_t)map.index(gx, gz);
+    uint32_t start = (uint32_t)map.index(sx, sz);
+    search.stamp[start] = search.current;
+    search.g[start] = 0;
+    search.closed[start] = 0;
+    search.open.push_back(make_pair((int64_t)(abs(gx - sx) + abs(gz - sz)) << 32, start));
+    while (!search.open.empty()) {
+        pop_heap(search.open.begin(), search.open.end(), greater<pair<int64_t, uint32_t> >());
+        uint32_t cell = search.open.back().second;
+        search.open.pop_back();
+        if (search.closed[cell]) continue;
+        search.closed[cell] = 1;
+        search.expanded++;
+        if (cell == goal) return search.g[goal];
+        
+        int x = (int)(cell % map.width), z = (int)(cell / map.width);
+        for (int d = 0; d < 4; d++) {
+            int nx = x + JUMP_DX[d], nz = z + JUMP_DZ[d];
+            if (blocksPlayer(map, nx, nz, keys)) continue;
+            uint32_t next = (uint32_t)map.index(nx, nz);
+            int g = search.g[cell] + 1;
+            if (search.stamp[next] == search.current && (search.closed[next] || search.g[next] <= g)) continue;
+            search.stamp[next] = search.current;
+            search.g[next] = g;
+            search.closed[next] = 0;
+            int64_t f = g + abs(gx - nx) + abs(gz - nz);
+            search.open.push_back(make_pair((f << 32) | (uint32_t)(0x7FFFFFFF - g), next));
+            push_heap(search.open.begin(), search.open.end(), greater<pair<int64_t, uint32_t> >());
+        }
+    }
+    return -1;
+}
+
+// Query times in ms: mean, median, 99th percentile and worst, and the nodes expanded if counted
+void reportTimes(const char* name, vector<double>& ms, double expanded = -1) {
+    sort(ms.begin(), ms.end());
+    double sum = 0;
+    for (size_t i = 0; i < ms.size(); i++) sum += ms[i];
+    printf("    %-5s mean %7.3f ms, median %7.3f, p99 %7.3f, worst %7.3f", name,
+           sum / ms.size(), ms[ms.size() / 2], ms[ms.size() * 99 / 100], ms.back());
+    if (expanded >= 0) printf(", %8.0f nodes expanded per query", expanded / ms.size());
+    printf("\n");
+}
+
+// Moves the goal to (x, z), for benches that want it somewhere the generator doesn't put it
+void setGoal(Map& map, int x, int z) {
+    map.goalPos = glm::vec3(x * CELL_SIZE, 1.0f, z * CELL_SIZE);
+    map.setCell(x, z, 'G');
+}
+
+// Runs bench on a maze with a locked door on one floor cell in 4096, then on an arena with
+// its goal moved to (goalX, goalZ), or left where it was generated if goalX is -1. Returns 1
+// if either run had failures.
+int benchMazeAndArena(int size, unsigned seed, int goalX, int goalZ,
+                      const function<int(const char*, Map&, mt19937&)>& bench) {
+    mt19937 rng(seed);
+    Map maze = generateMaze(size, size, 1);
+    addLockedDoors(maze, rng, 4096);
+    int failures = bench("Maze", maze, rng);
+    maze = Map();
+    Map arena = generateArena(size, size, 2);
+    if (goalX >= 0) setGoal(arena, goalX, goalZ);
+    failures += bench("Arena", arena, rng);
+    return failures ? 1 : 0;
+}
+
+// Returns how many tables or path lengths came out wrong
+int benchJumpMap(const char* name, const Map& map, mt19937& rng) {
+    printf("%s, %dx%d, %d locked doors:\n", name, map.width, map.height, (int)map.doors.size());
+    JumpTable table, rebuilt;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    buildJumpTable(map, 0, table);
+    printf("  jump table built in %.0f ms, %.0f MB\n", elapsedMs(start), table.dist.size() * sizeof(int16_t) / 1048576.0);
+    
+    // Doors open one key type at a time, against rebuilding the table each time
+    KeyMask keys = 0;
+    int failures = 0;
+    for (int type = 0; type < 5; type++) {
+        keys |= 1ull << type;
+        start = chrono::steady_clock::now();
+        int opened = unlockJumpDoors(map, table, keys);
+        double unlockMs = elapsedMs(start);
+        start = chrono::steady_clock::now();
+        buildJumpTable(map, keys, rebuilt);
+        double rebuildMs = elapsedMs(start);
+        printf("  unlock key %d: %5d doors in %7.2f ms, rebuild %5.0f ms, %s\n", type, opened, unlockMs, rebuildMs,
+               table.dist == rebuilt.dist ? "same table" : "TABLES DIFFER");
+        failures += table.dist != rebuilt.dist;
+    }
+    
+    // With every door open: random pairs of open cells, and pairs no more than 64 cells
+    // apart as an NPC chasing the player would ask for
+    JumpSearch jumpSearch, cellSearch;
+    vector<pair<int, int> > waypoints;
+    for (int near = 0; near < 2; near++) {
+        const int QUERIES = 200;
+        vector<double> jumpMs, cellMs;
+        double jumpExpanded = 0, cellExpanded = 0;
+        int mismatches = 0, unreachable = 0;
+        for (int q = 0; q < QUERIES; q++) {
+            int sx, sz, gx, gz;
+            do {
+                sx = rng() % map.width;
+                sz = rng() % map.height;
+            } while (blocksPlayer(map, sx, sz, keys));
+            do {
+                gx = near ? sx + (int)(rng() % 129) - 64 : (int)(rng() % map.width);
+                gz = near ? sz + (int)(rng() % 129) - 64 : (int)(rng() % map.height);
+            } while (blocksPlayer(map, gx, gz, keys));
+            
+            start = chrono::steady_clock::now();
+            int jumpLength = findJumpPath(map, table, jumpSearch, sx, sz, gx, gz, waypoints);
+            jumpMs.push_back(elapsedMs(start));
+            jumpExpanded += jumpSearch.expanded;
+            start = chrono::steady_clock::now();
+            int cellLength = findCellPath(map, keys, cellSearch, sx, sz, gx, gz);
+            cellMs.push_back(elapsedMs(start));
+            cellExpanded += cellSearch.expanded;
+            mismatches += jumpLength != cellLength;
+            unreachable += jumpLength < 0;
+        }
+        printf("  %d %s queries, %d unreachable, %d lengths differ from A*\n", QUERIES,
+               near ? "nearby (within 64 cells)" : "random", unreachable, mismatches);
+        reportTimes("JPS+", jumpMs, jumpExpanded);
+        reportTimes("A*", cellMs, cellExpanded);
+        failures += mismatches;
+    }
+    return failures;
+}
+
+int benchJump(int size) {
+    return benchMazeAndArena(size, 13, -1, -1, benchJumpMap);
+}
+
+// ---- hpa: the clustered search against the exact jump point search ----
+
+bool sameClusterGraph(const ClusterGraph& a, const ClusterGraph& b) {
+    if (a.clusters.size() != b.clusters.size()) return false;
+    for (size_t i = 0; i < a.clusters.size(); i++) {
+        const Cluster& x = a.clusters[i];
+        const Cluster& y = b.clusters[i];
+        if (x.nodes.size() != y.nodes.size() || x.edges.size() != y.edges.size()) return false;
+        for (size_t n = 0; n < x.nodes.size(); n++) {
+            if (x.nodes[n].x != y.nodes[n].x || x.nodes[n].z != y.nodes[n].z || x.nodes[n].crossings != y.nodes[n].crossings ||
+                x.nodes[n].edgeCount != y.nodes[n].edgeCount) return false;
+        }
+        for (size_t e = 0; e < x.edges.size(); e++) {
+            if (x.edges[e].to != y.edges[e].to || x.edges[e].cost != y.edges[e].cost || x.edges[e].needs != y.edges[e].needs) return false;
+        }
+    }
+    return true;
+}
+
+// Refines every segment of the path and checks that the cells join up, are open and add up
+// to its length; times the first segment, which is all a walker needs to set off
+bool walkClusterPath(const Map& map, const ClusterPath& path, KeyMask keys, double& firstMs, double& allMs) {
+    vector<pair<int, int> > cells;
+    int steps = 0;
+    pair<int, int> at = path.waypoints[0];
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    firstMs = 0;
+    for (size_t i = 0; i + 1 < path.waypoints.size(); i++) {
+        if (!refineClusterPath(map, path, keys, i, cells)) return false;
+        if (i == 0) firstMs = elapsedMs(start);
+        for (size_t c = 0; c < cells.size(); c++) {
+            if (abs(cells[c].first - at.first) + abs(cells[c].second - at.second) != 1 ||
+                blocksPlayer(map, cells[c].first, cells[c].second, keys)) return false;
+            at = cells[c];
+        }
+        steps += (int)cells.size();
+    }
+    allMs = elapsedMs(start);
+    return at == path.waypoints.back() && steps == path.length;
+}
+
+// Returns how many graphs or paths came out wrong
+int benchClusterMap(const char* name, const Map& map, mt19937& rng) {
+    printf("%s, %dx%d, %d locked doors:\n", name, map.width, map.height, (int)map.doors.size());
+    ClusterGraph graph, rebuilt;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    buildClusterGraph(map, 0, graph);
+    double buildMs = elapsedMs(start);
+    size_t nodes = 0, edges = 0;
+    for (size_t i = 0; i < graph.clusters.size(); i++) {
+        nodes += graph.clusters[i].nodes.size();
+        edges += graph.clusters[i].edges.size();
+    }
+    printf("  %zu clusters of %dx%d, %zu entrances, %zu paths between them, built in %.0f ms, %.0f MB\n",
+           graph.clusters.size(), CLUSTER_SIZE, CLUSTER_SIZE, nodes, edges, buildMs, clusterGraphBytes(graph) / 1048576.0);
+    
+    // Doors open one key type at a time, against rebuilding the graph each time
+    KeyMask keys = 0;
+    int failures = 0;
+    for (int type = 0; type < 5; type++) {
+        keys |= 1ull << type;
+        start = chrono::steady_clock::now();
+        int opened = unlockClusterDoors(map, graph, keys);
+        double unlockMs = elapsedMs(start);
+        start = chrono::steady_clock::now();
+        buildClusterGraph(map, keys, rebuilt);
+        double rebuildMs = elapsedMs(start);
+        bool same = sameClusterGraph(graph, rebuilt);
+        printf("  unlock key %d: %5d doors in %7.2f ms, rebuild %5.0f ms, %s\n", type, opened, unlockMs, rebuildMs,
+               same ? "same graph" : "GRAPHS DIFFER");
+        failures += !same;
+    }
+    rebuilt = ClusterGraph();
+    
+    // Random pairs, with every key and with none, against the exact search
+    for (int held = 1; held >= 0; held--) {
+        KeyMask searchKeys = held ? keys : 0;
+        JumpTable table;
+        buildJumpTable(map, searchKeys, table);
+        JumpSearch jumpSearch;
+        ClusterSearch clusterSearch;
+        vector<pair<int, int> > waypoints;
+        const int QUERIES = 100;
+        vector<double> clusterMs, firstMs, refineMs, jumpMs;
+        double expanded = 0, jumpExpanded = 0, extra = 0, worst = 0;
+        int found = 0, reachable = 0, broken = 0;
+        for (int q = 0; q < QUERIES; q++) {
+            int sx, sz, gx, gz;
+            do {
+                sx = rng() % map.width;
+                sz = rng() % map.height;
+            } while (blocksPlayer(map, sx, sz, searchKeys));
+            do {
+                gx = rng() % map.width;
+                gz = rng() % map.height;
+            } while (blocksPlayer(map, gx, gz, searchKeys));
+            
+            start = chrono::steady_clock::now();
+            ClusterPath path = findClusterPath(map, graph, clusterSearch, searchKeys, sx, sz, gx, gz);
+            clusterMs.push_back(elapsedMs(start));
+            expanded += path.expanded;
+            start = chrono::steady_clock::now();
+            int exact = findJumpPath(map, table, jumpSearch, sx, sz, gx, gz, waypoints);
+            jumpMs.push_back(elapsedMs(start));
+            jumpExpanded += jumpSearch.expanded;
+            reachable += exact >= 0;
+            if (path.length < 0) continue;
+            found++;
+            
+            double first, all;
+            if (!walkClusterPath(map, path, searchKeys, first, all) || path.needs & ~searchKeys || path.length < exact) {
+                broken++;
+                continue;
+            }
+            firstMs.push_back(first);
+            refineMs.push_back(all);
+            double over = exact > 0 ? (double)(path.length - exact) / exact : 0;
+            extra += over;
+            worst = max(worst, over);
+        }
+        printf("  %d random queries %s: %d of %d reachable found, %d bad paths, %.2f%% longer than the shortest on average, %.1f%% at worst\n",
+               QUERIES, held ? "with every key" : "with no keys", found, reachable, broken,
+               100 * extra / max(found - broken, 1), 100 * worst);
+        reportTimes("HPA*", clusterMs, expanded);
+        reportTimes("JPS+", jumpMs, jumpExpanded);
+        if (!firstMs.empty()) {
+            reportTimes("first", firstMs);
+            reportTimes("whole", refineMs);
+        }
+        failures += broken + (found != reachable);
+    }
+    return failures;
+}
+
+int benchCluster(int size) {
+    return benchMazeAndArena(size, 17, -1, -1, benchClusterMap);
+}
+
+// ---- bfs: whole-map distances, one thread against many ----
+
+// A plain queue, one cell at a time
+void queueDistances(const Map& map, KeyMask keys, int sx, int sz, PathDistances& dist) {
+    dist.resize((size_t)map.width * map.height);
+    fill(dist.begin(), dist.end(), -1);
+    if (blocksPlayer(map, sx, sz, keys)) return;
+    vector<uint32_t> queue(1, (uint32_t)map.index(sx, sz));
+    dist[queue[0]] = 0;
+    for (size_t head = 0; head < queue.size(); head++) {
+        int x = (int)(queue[head] % map.width), z = (int)(queue[head] / map.width);
+        for (int d = 0; d < 4; d++) {
+            int nx = x + JUMP_DX[d], nz = z + JUMP_DZ[d];
+            if (blocksPlayer(map, nx, nz, keys) || dist[map.index(nx, nz)] >= 0) continue;
+            dist[map.index(nx, nz)] = dist[queue[head]] + 1;
+            queue.push_back((uint32_t)map.index(nx, nz));
+        }
+    }
+}
+
+// Returns how many runs gave other distances than the queue
+int benchDistanceMap(const char* name, const Map& map) {
+    printf("%s, %dx%d, %d locked doors, %d cores:\n", name, map.width, map.height, (int)map.doors.size(),
+           (int)thread::hardware_concurrency());
+    KeyMask keys = doorKeyTypes(map);   // every door open
+    int failures = 0;
+    PathDistances expected, dist;
+    for (int from = 0; from < 2; from++) {
+        glm::vec3 pos = from ? map.goalPos : map.startPos;
+        int sx = worldToCell(pos.x), sz = worldToCell(pos.z);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        queueDistances(map, keys, sx, sz, expected);
+        double queueMs = elapsedMs(start);
+        printf("  from the %s: queue %.0f ms\n", from ? "goal" : "start", queueMs);
+        
+        const int threadCounts[] = { 1, 4, 8, 16 };
+        for (int i = 0; i < 4; i++) {
+            ThreadPool pool(threadCounts[i]);
+            start = chrono::steady_clock::now();
+            PathDistanceStats stats = computePathDistances(map, keys, sx, sz, dist, pool);
+            double ms = elapsedMs(start);
+            bool same = memcmp(dist.data(), expected.data(), dist.size() * sizeof(int32_t)) == 0;
+            failures += !same;
+            printf("    %2d threads %7.0f ms %5.2fx, %llu cells reached over %d levels, %d bottom-up%s\n", threadCounts[i], ms,
+                   queueMs / ms, (unsigned long long)stats.reached, stats.levels, stats.bottomUpLevels, same ? "" : ", DIFFERENT DISTANCES");
+        }
+    }
+    return failures;
+}
+
+int benchDistance(int size) {
+    return benchMazeAndArena(size, 19, size / 2, size / 2, [](const char* name, Map& map, mt19937&) {
+        return benchDistanceMap(name, map);
+    });
+}
+
+// ---- flood: reachability 64 cells at a time against one at a time ----
+
+// A queue over cells, marking the same bits floodFill would
+void queueFill(const Map& map, KeyMask keys, int sx, int sz, CellBits& reached) {
+    clearCellBits(reached, map.width, map.height);
+    if (blocksPlayer(map, sx, sz, keys)) return;
+    vector<uint32_t> queue(1, (uint32_t)map.index(sx, sz));
+    setCellBit(reached, sx, sz);
+    for (size_t head = 0; head < queue.size(); head++) {
+        int x = (int)(queue[head] % map.width), z = (int)(queue[head] / map.width);
+        for (int d = 0; d < 4; d++) {
+            int nx = x + JUMP_DX[d], nz = z + JUMP_DZ[d];
+            if (blocksPlayer(map, nx, nz, keys) || cellBit(reached, nx, nz)) continue;
+            setCellBit(reached, nx, nz);
+            queue.push_back((uint32_t)map.index(nx, nz));
+        }
+    }
+}
+
+// Returns how many fills or checks disagreed
+int benchFloodMap(const char* name, Map& map, mt19937& rng) {
+    printf("%s, %dx%d, %d locked doors:\n", name, map.width, map.height, (int)map.doors.size());
+    int sx = worldToCell(map.startPos.x), sz = worldToCell(map.startPos.z);
+    int failures = 0;
+    KeyMask all = doorKeyTypes(map);
+    for (int held = 0; held < 2; held++) {
+        KeyMask keys = held ? all : 0;
+        CellBits open, bits, cells;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        queueFill(map, keys, sx, sz, cells);
+        double queueMs = elapsedMs(start);
+        start = chrono::steady_clock::now();
+        openCellBits(map, keys, open);
+        double openMs = elapsedMs(start);
+        start = chrono::steady_clock::now();
+        floodFill(open, sx, sz, bits);
+        double fillMs = elapsedMs(start);
+        bool same = bits.words == cells.words;
+        failures += !same;
+        printf("  from the start %s: %9zu cells, cell by cell %7.1f ms, 64 at a time %6.1f ms (+%.1f ms for the open bits), %5.1fx%s\n",
+               held ? "with every key" : "with no keys ", countCellBits(bits), queueMs, fillMs, openMs, queueMs / fillMs,
+               same ? "" : ", DIFFERENT CELLS");
+    }
+    
+    // Which cells one key color opens up: filling on from the cells already reached
+    // against filling again from the start
+    CellBits open, reached, again;
+    openCellBits(map, 0, open);
+    floodFill(open, sx, sz, reached);
+    KeyMask keys = 0;
+    for (int type = 0; type < 5; type++) {
+        keys |= 1ull << type;
+        size_t before = countCellBits(reached);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        openDoorsFill(map, 1ull << type, open, reached);
+        double growMs = elapsedMs(start);
+        start = chrono::steady_clock::now();
+        floodFill(open, sx, sz, again);
+        double refillMs = elapsedMs(start);
+        bool same = reached.words == again.words;
+        failures += !same;
+        printf("  doors of key %d open up %9zu cells, filling on %6.2f ms, from the start %6.1f ms%s\n", type,
+               countCellBits(reached) - before, growMs, refillMs, same ? "" : ", DIFFERENT CELLS");
+    }
+    
+    // Map validation, against the solver's answer where it doesn't take minutes
+    addKeys(map, rng, 4096);
+    for (int red = 1; red >= 0; red--) {
+        if (!red) {
+            for (size_t i = 0; i < map.keys.size(); i++)
+                if (map.keys[i].type == 0) map.setCell(map.keys[i].x, map.keys[i].z, '0');
+            vector<MapItem> kept;
+            for (size_t i = 0; i < map.keys.size(); i++)
+                if (map.keys[i].type != 0) kept.push_back(map.keys[i]);
+            map.keys.swap(kept);
+        }
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        Reachability reach = checkReachability(map);
+        double checkMs = elapsedMs(start);
+        printf("  %s: goal %s, %zu keys and %zu doors stuck, %zu of %zu cells, checked in %.1f ms",
+               red ? "with red keys" : "no red keys  ", reach.goal ? "reached" : "not reached", reach.lostKeys.size(),
+               reach.stuckDoors.size(), reach.reached, reach.open, checkMs);
+        if ((size_t)map.width * map.height > 2049 * 2049) {
+            printf("\n");
+            continue;
+        }
+        start = chrono::steady_clock::now();
+        Solution solution = solveMap(map);
+        double solveMs = elapsedMs(start);
+        bool agree = reach.goal == solution.solved;
+        failures += !agree;
+        printf(", solver %.0f ms%s\n", solveMs, agree ? ", agrees" : ", SOLVER DISAGREES");
+    }
+    return failures;
+}
+
+int benchFlood(int size) {
+    return benchMazeAndArena(size, 23, size - 2, size - 2, benchFloodMap);
+}
+
+// ---- flow: agents sharing flow fields against a path each ----
+
+// Returns how many agents went astray and cached fields came out wrong
+int benchFlowMap(const char* name, Map& map, mt19937& rng, int agents) {
+    printf("%s, %dx%d, %d locked doors, %d agents:\n", name, map.width, map.height, (int)map.doors.size(), agents);
+    ThreadPool pool;
+    KeyMask keys = doorKeyTypes(map);
+    int gx = worldToCell(map.goalPos.x), gz = worldToCell(map.goalPos.z);
+    FlowField field;
+    PathDistances dist;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    buildFlowField(map, keys, gx, gz, field, dist, pool);
+    printf("  field to the goal built in %.1f ms, %zu cells lead there, the farthest %d steps away\n", elapsedMs(start),
+           field.reached, field.farthest);
+    
+    // Agents on random cells that lead to the goal, all walking there a step per tick
+    vector<pair<int, int> > from(agents), at(agents);
+    for (int i = 0; i < agents; i++) {
+        do {
+            at[i].first = rng() % map.width;
+            at[i].second = rng() % map.height;
+        } while (flowStep(field, at[i].first, at[i].second) == FLOW_NONE);
+        from[i] = at[i];
+    }
+    vector<int> steps(agents, 0);
+    int failures = 0, walking = agents, ticks = 0;
+    uint64_t moves = 0;
+    start = chrono::steady_clock::now();
+    while (walking > 0) {
+        walking = 0;
+        for (int i = 0; i < agents; i++) {
+            uint8_t step = flowStep(field, at[i].first, at[i].second);
+            if (step == FLOW_HERE) continue;
+            at[i].first += FLOW_DX[step];
+            at[i].second += FLOW_DZ[step];
+            steps[i]++;
+            walking++;
+        }
+        moves += walking;
+        ticks++;
+    }
+    double walkMs = elapsedMs(start);
+    for (int i = 0; i < agents; i++) failures += at[i].first != gx || at[i].second != gz;
+    printf("  all at the goal after %d ticks, %llu moves in %.1f ms, %.1f ns a move\n", ticks,
+           (unsigned long long)moves, walkMs, walkMs * 1e6 / max<uint64_t>(moves, 1));
+    
+    // The same walks planned one agent at a time
+    const int PLANNED = min(agents, 100);
+    JumpSearch search;
+    int longer = 0;
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < PLANNED; i++) {
+        int length = findCellPath(map, keys, search, from[i].first, from[i].second, gx, gz);
+        longer += steps[i] != length;
+    }
+    double planMs = elapsedMs(start) / PLANNED;
+    failures += longer;
+    printf("  A* per agent: %.2f ms each, %.0f ms for all %d, %d of %d walks a different length\n", planMs,
+           planMs * agents, agents, longer, PLANNED);
+    
+    // Runners to the goal with and without keys, key hunters and pursuers of a player who
+    // walks to the goal, through a cache with room for 8 fields
+    FlowFieldCache cache;
+    initFlowFieldCache(cache, map, field.dirs.size() * 8);
+    int px = worldToCell(map.startPos.x), pz = worldToCell(map.startPos.z);
+    size_t hunted = min<size_t>(map.keys.size(), 16);
+    vector<double> requestMs;
+    size_t mostBytes = 0;
+    for (int tick = 0; tick < 100; tick++) {
+        for (int request = 0; request < 4; request++) {
+            int tx = gx, tz = gz;
+            KeyMask held = keys;
+            if (request == 1) {
+                held = 0;
+            } else if (request == 2 && hunted) {
+                const MapItem& key = map.keys[rng() % hunted];
+                tx = key.x;
+                tz = key.z;
+                held = rng() % 2 ? keys : 0;
+            } else if (request == 3) {
+                tx = px;
+                tz = pz;
+            }
+            start = chrono::steady_clock::now();
+            flowField(cache, map, tx, tz, held, pool);
+            requestMs.push_back(elapsedMs(start));
+            mostBytes = max(mostBytes, cache.bytes);
+        }
+        
+        // The player moves on every fourth tick
+        uint8_t step = flowStep(field, px, pz);
+        if (tick % 4 == 3 && step < FLOW_HERE) {
+            px += FLOW_DX[step];
+            pz += FLOW_DZ[step];
+        }
+    }
+    printf("  cache: %llu requests, %llu hits, %llu builds, %llu evictions, at most %.1f of %.1f MB\n",
+           (unsigned long long)(cache.hits + cache.misses), (unsigned long long)cache.hits,
+           (unsigned long long)cache.misses, (unsigned long long)cache.evictions, mostBytes / 1048576.0,
+           cache.budget / 1048576.0);
+    reportTimes("field", requestMs);
+    failures += mostBytes > cache.budget;
+    
+    // What is still cached must match a fresh build
+    int stale = 0;
+    for (size_t i = 0; i < cache.fields.size(); i++) {
+        const FlowField& cached = *cache.fields[i];
+        buildFlowField(map, cached.keys, cached.targetX, cached.targetZ, field, dist, pool);
+        stale += cached.dirs != field.dirs;
+    }
+    printf("  %zu cached fields checked against a rebuild, %d differ\n", cache.fields.size(), stale);
+    clearFlowFieldCache(cache);
+    return failures + stale;
+}
+
+int benchFlow(int size, int agents) {
+    return benchMazeAndArena(size, 24, size / 2, size / 2, [agents](const char* name, Map& map, mt19937& rng) {
+        addKeys(map, rng, 4096);
+        return benchFlowMap(name, map, rng, agents);
+    });
+}
+
+// ---- repair: keeping a path up to date against planning it again ----
+
+// Repairs the path after a change and plans it again from scratch with A*; returns whether
+// the lengths agree
+bool reportRepair(const char* what, const Map& map, RepairSearch& search, JumpSearch& cellSearch, double changeMs) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    int length = findRepairPath(map, search);
+    double repairMs = changeMs + elapsedMs(start);
+    start = chrono::steady_clock::now();
+    int expected = findCellPath(map, search.keys, cellSearch, search.startX, search.startZ, search.goalX, search.goalZ);
+    double replanMs = elapsedMs(start);
+    printf("  %-28s length %7d, repair %8.2f ms %9zu cells, A* %8.2f ms %9zu cells, %6.1fx%s\n", what, length, repairMs,
+           search.expanded, replanMs, (size_t)cellSearch.expanded, replanMs / max(repairMs, 0.001),
+           length == expected ? "" : ", A* LENGTH DIFFERS");
+    return length == expected;
+}
+
+// Moves the start steps cells along the path, as a player following it would
+void walkRepairPath(const Map& map, RepairSearch& search, int steps) {
+    int x = search.startX, z = search.startZ;
+    for (int i = 0; i < steps; i++) {
+        int d = repairStep(map, search, x, z);
+        if (d < 0) break;
+        x += REPAIR_DX[d];
+        z += REPAIR_DZ[d];
+    }
+    moveRepairStart(search, x, z);
+}
+
+// Returns how many repaired paths differ from A*'s
+int benchRepairMap(const char* name, Map& map) {
+    printf("%s, %dx%d, %d locked doors:\n", name, map.width, map.height, (int)map.doors.size());
+    int sx = worldToCell(map.startPos.x), sz = worldToCell(map.startPos.z);
+    int gx = worldToCell(map.goalPos.x), gz = worldToCell(map.goalPos.z);
+    RepairSearch search;
+    JumpSearch cellSearch;
+    int failures = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    initRepairSearch(map, 0, sx, sz, gx, gz, search);
+    failures += !reportRepair("first plan, no keys", map, search, cellSearch, elapsedMs(start));
+    
+    // Picking up one key color at a time, having walked an eighth of the way since the last
+    char what[64];
+    for (int type = 0; type < 5; type++) {
+        if (search.g[map.index(search.startX, search.startZ)] < REPAIR_INF)
+            walkRepairPath(map, search, search.g[map.index(search.startX, search.startZ)] / 8);
+        start = chrono::steady_clock::now();
+        int opened = unlockRepairDoors(map, search, search.keys | (1ull << type));
+        snprintf(what, sizeof(what), "key %d, %d doors open", type, opened);
+        failures += !reportRepair(what, map, search, cellSearch, elapsedMs(start));
+    }
+    
+    // Walls put up across the path ahead, then taken down again
+    int length = search.g[map.index(search.startX, search.startZ)];
+    vector<pair<int, int> > walls;
+    int x = search.startX, z = search.startZ;
+    for (int i = 1; i < length; i++) {
+        int d = repairStep(map, search, x, z);
+        x += REPAIR_DX[d];
+        z += REPAIR_DZ[d];
+        if (i % (length / 4 + 1) == 0 && map.cell(x, z) == '0') walls.push_back(make_pair(x, z));
+    }
+    for (int up = 1; up >= 0; up--) {
+        start = chrono::steady_clock::now();
+        for (size_t i = 0; i < walls.size(); i++) map.setCell(walls[i].first, walls[i].second, up ? 'W' : '0');
+        changeRepairCells(map, search, walls);
+        snprintf(what, sizeof(what), "%d walls %s", (int)walls.size(), up ? "put up" : "taken down");
+        failures += !reportRepair(what, map, search, cellSearch, elapsedMs(start));
+    }
+    
+    // Following the steps must take exactly the path's length
+    length = search.g[map.index(search.startX, search.startZ)];
+    walkRepairPath(map, search, length);
+    bool arrived = search.startX == gx && search.startZ == gz;
+    printf("  followed to the goal: %s\n", arrived ? "yes" : "NO");
+    return failures + !arrived;
+}
+
+int benchRepair(int size) {
+    return benchMazeAndArena(size, 25, size - 2, size - 2, [](const char* name, Map& map, mt19937& rng) {
+        // The arena has no walls in the way, so it gets doors of its own to open
+        if (strcmp(name, "Arena") == 0) addLockedDoors(map, rng, 64);
+        return benchRepairMap(name, map);
+    });
+}
+
+int main(int argc, char *argv[]){
+    string mode = argc > 1 ? argv[1] : "";
+    
+    if (mode == "grid") return benchGrid(argc > 2 ? atoi(argv[2]) : 4096);
+    if (mode == "load") return benchLoad(argc > 2 ? argv[2] : "");
+    if (mode == "parse") return benchParse(argc > 2 ? argv[2] : "");
+    if (mode == "stream") return benchStream(argc > 2 ? argv[2] : "");
+    if (mode == "sweep") return benchSweep(argc > 2 ? atoi(argv[2]) : 1025);
+    if (mode == "field") return benchField(argc > 2 ? atoi(argv[2]) : 2049);
+    if (mode == "sim") return benchSim(argc > 2 ? atoi(argv[2]) : 513);
+    if (mode == "solve") return benchSolve(argc > 2 ? atoi(argv[2]) : 10001);
+    if (mode == "jps") return benchJump(argc > 2 ? atoi(argv[2]) : 4097);
+    if (mode == "hpa") return benchCluster(argc > 2 ? atoi(argv[2]) : 8193);
+    if (mode == "bfs") return benchDistance(argc > 2 ? atoi(argv[2]) : 16385);
+    if (mode == "flood") return benchFlood(argc > 2 ? atoi(argv[2]) : 8193);
+    if (mode == "flow") return benchFlow(argc > 2 ? atoi(argv[2]) : 2049, argc > 3 ? atoi(argv[3]) : 10000);
+    if (mode == "repair") return benchRepair(argc > 2 ? atoi(argv[2]) : 4097);
+    
+    printf("Usage: %s grid [size]\n", argv[0]);
+    printf("       %s load [size|map.txt]\n", argv[0]);
+    printf("       %s parse [size|map.txt]\n", argv[0]);
+    printf("       %s stream [size|map.mzb]\n", argv[0]);
+    printf("       %s sweep [size]\n", argv[0]);
+    printf("       %s field [size]\n", argv[0]);
+    printf("       %s sim [size]\n", argv[0]);
+    printf("       %s solve [size]\n", argv[0]);
+    printf("       %s jps [size]\n", argv[0]);
+    printf("       %s hpa [size]\n", argv[0]);
+    printf("       %s bfs [size]\n", argv[0]);
+    printf("       %s flood [size]\n", argv[0]);
+    printf("       %s flow [size] [agents]\n", argv[0]);
+    printf("       %s repair [size]\n", argv[0]);
+    return 1;
+}
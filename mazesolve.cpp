@@ -0,0 +1,75 @@
+// Finds the shortest solution of maps without playing them, through the keys and doors on
+// the way, or shows that there is none by searching every reachable state.
+//
+// Usage: ./mazesolve [--moves] map.txt|map.mzb ...
+// --moves writes each solution next to its map as <map>.moves, one letter per step:
+// R and L along +x and -x, D and U along +z and -z (down and up the rows of a text map).
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <chrono>
+
+#include "MapBinary.h"
+#include "Solver.h"
+
+using namespace std;
+
+double elapsedMs(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]){
+    bool writeMoves = false;
+    int first = 1;
+    if (argc > 1 && strcmp(argv[1], "--moves") == 0) {
+        writeMoves = true;
+        first = 2;
+    }
+    if (first >= argc) {
+        printf("Usage: %s [--moves] map.txt|map.mzb ...\n", argv[0]);
+        return 1;
+    }
+    
+    int failed = 0, unsolvable = 0;
+    for (int i = first; i < argc; i++) {
+        string path = argv[i];
+        Map map;
+        if (!loadMapAnyFormat(path.c_str(), map)) {
+            failed++;
+            continue;
+        }
+        
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        Solution solution = solveMap(map);
+        double ms = elapsedMs(start);
+        
+        if (solution.solved) {
+            string keys;
+            for (size_t k = 0; k < solution.pickups.size(); k++) {
+                if (k) keys += ", ";
+                keys += map.keyTypes[solution.pickups[k].type].key;
+            }
+            printf("%s: solved in %zu steps, keys %s\n", path.c_str(), solution.moves.size(),
+                   keys.empty() ? "none" : keys.c_str());
+        } else {
+            printf("%s: NO SOLUTION, all reachable states searched without reaching the goal\n", path.c_str());
+            unsolvable++;
+        }
+        printf("  %llu states over %d key sets in %.1f ms (%.1f M states/s), %.1f MB of visited marks\n",
+               (unsigned long long)solution.states, solution.keyMasks, ms, solution.states / ms / 1e3,
+               solution.bytes / 1048576.0);
+        
+        if (writeMoves && solution.solved) {
+            string movesPath = path + ".moves";
+            FILE* file = fopen(movesPath.c_str(), "wb");
+            if (!file || fwrite(solution.moves.data(), 1, solution.moves.size(), file) != solution.moves.size() ||
+                fputc('\n', file) == EOF || fclose(file) != 0) {
+                printf("%s: could not write %s\n", path.c_str(), movesPath.c_str());
+                failed++;
+            }
+        }
+    }
+    
+    return failed || unsolvable ? 1 : 0;
+}
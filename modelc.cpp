@@ -0,0 +1,84 @@
+// Converts text models (models/*.txt) into the binary .mesh format MazeGame maps at startup.
+// Identical vertices are welded into an index buffer whose triangle order is optimized
+// for the post-transform vertex cache.
+//
+// Usage: ./modelc models/cube.txt models/teapot.txt ...
+// Each input is written next to itself with a .mesh extension.
+
+#include <cstdio>
+#include <vector>
+#include <string>
+#include <chrono>
+
+#include "Mesh.h"
+
+using namespace std;
+
+double elapsedMs(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]){
+    if (argc < 2) {
+        printf("Usage: %s model.txt [model.txt ...]\n", argv[0]);
+        return 1;
+    }
+    
+    int failed = 0;
+    for (int i = 1; i < argc; i++) {
+        string textPath = argv[i];
+        string binaryPath = meshPath(textPath);
+        
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        vector<float> soup = readTextMesh(textPath.c_str());
+        double parseMs = elapsedMs(start);
+        
+        if (soup.empty() || soup.size() % 24 != 0) {
+            printf("%s: expected whole triangles of 8 floats per vertex, got %d floats\n", textPath.c_str(), (int)soup.size());
+            failed++;
+            continue;
+        }
+        
+        // The welded mesh is kept as it was for the ACMR report, so the copy isn't timed
+        start = chrono::steady_clock::now();
+        IndexedMesh welded = weldVertices(soup);
+        double processMs = elapsedMs(start);
+        IndexedMesh mesh = welded;
+        start = chrono::steady_clock::now();
+        optimizeIndexedMesh(mesh);
+        processMs += elapsedMs(start);
+        
+        if (!writeMeshFile(binaryPath.c_str(), mesh)) {
+            printf("%s: could not write %s\n", textPath.c_str(), binaryPath.c_str());
+            failed++;
+            continue;
+        }
+        
+        // Time the path MazeGame takes: map, validate, read every vertex
+        start = chrono::steady_clock::now();
+        MeshFile file;
+        if (!openMeshFile(binaryPath.c_str(), file)) {
+            failed++;
+            continue;
+        }
+        volatile float sink = 0;
+        for (uint32_t v = 0; v < file.header->vertexCount; v++) sink = sink + file.vertices[v * 8];
+        double mapMs = elapsedMs(start);
+        closeMeshFile(file);
+        
+        uint32_t soupVertices = soup.size() / 8;
+        uint32_t vertices = mesh.vertices.size() / 8;
+        size_t soupBytes = soup.size() * sizeof(float);
+        size_t indexedBytes = mesh.vertices.size() * sizeof(float) + mesh.indices.size() * meshIndexSize(mesh);
+        
+        printf("%s -> %s\n", textPath.c_str(), binaryPath.c_str());
+        printf("  vertices: %u in the soup, %u after welding\n", soupVertices, vertices);
+        printf("  ACMR (FIFO %d): soup 3.000, welded %.3f, optimized %.3f\n", VERTEX_CACHE_SIZE,
+               computeACMR(welded.indices, welded.vertices.size() / 8), computeACMR(mesh.indices, vertices));
+        printf("  memory: %zu bytes as soup, %zu indexed (%u-bit indices), %.1f%% saved\n",
+               soupBytes, indexedBytes, meshIndexSize(mesh) * 8, 100.0 * (soupBytes - (double)indexedBytes) / soupBytes);
+        printf("  text parse %.1f ms, weld and optimize %.1f ms, mapped load %.2f ms\n", parseMs, processMs, mapMs);
+    }
+    
+    return failed ? 1 : 0;
+}